@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#ifndef KWAI_UTIL_FRAME_POINTER_UNWIND_H
+#define KWAI_UTIL_FRAME_POINTER_UNWIND_H
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kwai {
+namespace util {
+
+// Bounds of the stacks of the current thread. The thread stack is read once,
+// the alternate signal stack only when a walk starts off the thread stack,
+// which only happens in a signal handler running on it. A walk starting on
+// neither, a coroutine stack or a thread whose stack can't be read, remembers
+// the region of its address, so the next walks there don't ask again.
+struct ThreadStackBounds {
+  static const uintptr_t kMissRegionSize = 64 * 1024;
+
+  uintptr_t start;
+  uintptr_t end;
+  uintptr_t alt_start;
+  uintptr_t alt_end;
+  // Region index plus one of the last address on no known stack, 0 if none
+  uintptr_t miss_region;
+  bool queried;
+};
+
+inline ThreadStackBounds &GetThreadStackBounds() {
+  static __thread __attribute__((tls_model("initial-exec")))
+  ThreadStackBounds bounds;
+  if (__builtin_expect(!bounds.queried, 0)) {
+    bounds.queried = true;
+    pthread_attr_t attr;
+    if (!pthread_getattr_np(pthread_self(), &attr)) {
+      void *stack_base;
+      size_t stack_size;
+      if (!pthread_attr_getstack(&attr, &stack_base, &stack_size)) {
+        bounds.start = reinterpret_cast<uintptr_t>(stack_base);
+        bounds.end = bounds.start + stack_size;
+      }
+      pthread_attr_destroy(&attr);
+    }
+  }
+  return bounds;
+}
+
+// Read the alternate stack of the thread again, a signal handler may call it
+// on entry if it unwinds in a hot loop
+inline void RefreshAltStackBounds() {
+  auto &bounds = GetThreadStackBounds();
+  stack_t ss;
+  if (!sigaltstack(nullptr, &ss) && (ss.ss_flags & SS_ONSTACK)) {
+    bounds.alt_start = reinterpret_cast<uintptr_t>(ss.ss_sp);
+    bounds.alt_end = bounds.alt_start + ss.ss_size;
+  }
+}
+
+// End of the stack holding |address|, 0 if it is on no known stack
+inline uintptr_t StackEndOf(uintptr_t address) {
+  auto &bounds = GetThreadStackBounds();
+  if (address >= bounds.start && address < bounds.end) {
+    return bounds.end;
+  }
+  if (address >= bounds.alt_start && address < bounds.alt_end) {
+    return bounds.alt_end;
+  }
+  uintptr_t region = address / ThreadStackBounds::kMissRegionSize + 1;
+  if (region == bounds.miss_region) {
+    return 0;
+  }
+  RefreshAltStackBounds();
+  if (address >= bounds.alt_start && address < bounds.alt_end) {
+    return bounds.alt_end;
+  }
+  bounds.miss_region = region;
+  return 0;
+}
+
+// Hash of a stack trace, fed frame by frame, so the walk hashes the frames
+// it stores and a dedup table gets the hash for free. It is a sum of the
+// frames mixed with their index: the terms don't wait for each other, and the
+// sum of a run of frames can be kept and added again.
+inline uint64_t StackHashStep(uint64_t hash, uintptr_t frame, size_t index) {
+  uint64_t term = frame + index * 0x9E3779B97F4A7C15ULL;
+  term ^= term >> 33;
+  term *= 0xFF51AFD7ED558CCDULL;
+  return hash + (term ^ (term >> 33));
+}
+
+inline uint32_t StackHashFinish(uint64_t hash, size_t num_frames) {
+  hash = StackHashStep(hash, num_frames, num_frames);
+  return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+inline uint32_t StackHash(const uintptr_t *frames, size_t num_frames) {
+  uint64_t hash = 0;
+  for (size_t i = 0; i < num_frames; i++) {
+    hash = StackHashStep(hash, frames[i], i);
+  }
+  return StackHashFinish(hash, num_frames);
+}
+
+// Return address minus one instruction, which is the call itself
+inline uintptr_t AdjustReturnAddress(uintptr_t pc) {
+#if defined(__aarch64__)
+  return pc > 4 ? pc - 4 : 0;
+#elif defined(__arm__)
+  if (pc < 4) {
+    return 0;
+  }
+  return pc & 1 ? pc - 2 : pc - 4;
+#else
+  return pc;
+#endif
+}
+
+// Walk the frame records from |frame_address|, a frame pointer of the calling
+// function, and store at most |max_frames| return addresses. A record is only
+// followed upward in the same stack and if aligned. If |hash| is not null it
+// gets StackHash of the stored frames.
+template <bool kAdjustPc>
+__attribute__((always_inline)) inline size_t FramePointerUnwind(
+    uintptr_t frame_address, uintptr_t *frames, size_t max_frames,
+    uint32_t *hash) {
+  struct FrameRecord {
+    uintptr_t next_frame;
+    uintptr_t return_address;
+  };
+
+  uintptr_t end = StackEndOf(frame_address);
+  uint64_t running_hash = 0;
+  size_t num_frames = 0;
+  while (num_frames < max_frames) {
+    auto *record = reinterpret_cast<const FrameRecord *>(frame_address);
+    uintptr_t pc = kAdjustPc ? AdjustReturnAddress(record->return_address)
+                             : record->return_address;
+    running_hash = StackHashStep(running_hash, pc, num_frames);
+    frames[num_frames++] = pc;
+    if (record->next_frame < frame_address + sizeof(FrameRecord) ||
+        record->next_frame >= end ||
+        record->next_frame % sizeof(uintptr_t) != 0) {
+      break;
+    }
+    frame_address = record->next_frame;
+  }
+  if (hash) {
+    *hash = StackHashFinish(running_hash, num_frames);
+  }
+  return num_frames;
+}
+
+// Outer frames of the last cached unwinds of a thread, the frames from the
+// record at the cache depth outward. Entries are indexed by that record, so
+// a few leaves of the same call chain, one frame deeper or shallower, keep
+// their own entry.
+struct UnwindPrefixCache {
+  static const size_t kNumEntries = 4;
+  static const size_t kMaxFrames = 32;
+
+  struct Entry {
+    // Frame records walked and their frames, records[0] is the record at
+    // the cache depth, num_frames is 0 if empty
+    uintptr_t records[kMaxFrames];
+    uintptr_t frames[kMaxFrames];
+    // Next frame of the outermost record, the walk stopped at it
+    uintptr_t last_next_frame;
+    // StackHashStep sum of the frames, after |num_inner| inner frames
+    uint64_t hash;
+    size_t num_inner;
+    size_t max_frames;
+    size_t num_frames;
+  };
+
+  Entry entries[kNumEntries];
+  // Counters of this thread
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t invalidations;
+};
+
+inline UnwindPrefixCache &GetUnwindPrefixCache() {
+  static thread_local UnwindPrefixCache cache;
+  return cache;
+}
+
+namespace internal {
+struct FrameRecord {
+  uintptr_t next_frame;
+  uintptr_t return_address;
+};
+
+inline bool IsNextFrame(uintptr_t frame_address, uintptr_t next_frame,
+                        uintptr_t end) {
+  return next_frame >= frame_address + sizeof(FrameRecord) &&
+         next_frame < end && next_frame % sizeof(uintptr_t) == 0;
+}
+
+template <bool kAdjustPc>
+inline uintptr_t FramePc(const FrameRecord *record) {
+  return kAdjustPc ? AdjustReturnAddress(record->return_address)
+                   : record->return_address;
+}
+
+// Whether the records of |entry| still hold what they held when walked.
+// Record addresses come from the entry, so unlike a walk the loads don't wait
+// for each other. The thread may have switched stacks since, every record is
+// checked to be in the stack ending at |end| before any is loaded.
+template <bool kAdjustPc>
+__attribute__((always_inline)) inline bool IsEntryValid(
+    const UnwindPrefixCache::Entry &entry, uintptr_t end) {
+  size_t last = entry.num_frames - 1;
+  for (size_t i = 1; i <= last; i++) {
+    if (entry.records[i] <= entry.records[i - 1] ||
+        entry.records[i] + sizeof(FrameRecord) > end) {
+      return false;
+    }
+  }
+  uintptr_t diff = 0;
+  for (size_t i = 0; i < last; i++) {
+    auto *record = reinterpret_cast<const FrameRecord *>(entry.records[i]);
+    diff |= (record->next_frame ^ entry.records[i + 1]) |
+            (FramePc<kAdjustPc>(record) ^ entry.frames[i]);
+  }
+  auto *record = reinterpret_cast<const FrameRecord *>(entry.records[last]);
+  diff |= (record->next_frame ^ entry.last_next_frame) |
+          (FramePc<kAdjustPc>(record) ^ entry.frames[last]);
+  return !diff;
+}
+}  // namespace internal
+
+// FramePointerUnwind, but the frames beyond |depth| come from the thread's
+// UnwindPrefixCache if an earlier cached unwind reached the same record
+// there, 0 |depth| disables the cache. Threads allocating from the same deep
+// call chain again and again only walk the inner |depth| frames then.
+//
+// An entry is used if every cached record still holds what it held when
+// walked, then walking them again gives the same frames. Checking a cached
+// record is independent loads instead of a chain of dependent ones.
+template <bool kAdjustPc>
+__attribute__((always_inline)) inline size_t FramePointerUnwindCached(
+    uintptr_t frame_address, uintptr_t *frames, size_t max_frames,
+    uint32_t *hash, size_t depth) {
+  using internal::FrameRecord;
+  if (!depth) {
+    return FramePointerUnwind<kAdjustPc>(frame_address, frames, max_frames,
+                                         hash);
+  }
+
+  uintptr_t end = StackEndOf(frame_address);
+  size_t num_frames = 0;
+  uint64_t running_hash = 0;
+  size_t inner_frames = depth < max_frames ? depth : max_frames;
+  const FrameRecord *record;
+  for (;;) {
+    record = reinterpret_cast<const FrameRecord *>(frame_address);
+    uintptr_t pc = internal::FramePc<kAdjustPc>(record);
+    running_hash = StackHashStep(running_hash, pc, num_frames);
+    frames[num_frames++] = pc;
+    if (!internal::IsNextFrame(frame_address, record->next_frame, end)) {
+      record = nullptr;
+      break;
+    }
+    frame_address = record->next_frame;
+    if (num_frames == inner_frames) {
+      break;
+    }
+  }
+  // The stack ends within |depth| frames, or the limit is reached
+  if (!record || num_frames == max_frames) {
+    if (hash) {
+      *hash = StackHashFinish(running_hash, num_frames);
+    }
+    return num_frames;
+  }
+
+  auto &cache = GetUnwindPrefixCache();
+  auto &entry = cache.entries[frame_address / sizeof(FrameRecord) %
+                              UnwindPrefixCache::kNumEntries];
+  bool hit = entry.num_frames && entry.records[0] == frame_address &&
+             entry.num_inner == num_frames && entry.max_frames == max_frames;
+  if (hit) {
+    hit = internal::IsEntryValid<kAdjustPc>(entry, end);
+    cache.invalidations += !hit;
+  }
+
+  if (hit) {
+    for (size_t i = 0; i < entry.num_frames; i++) {
+      frames[num_frames++] = entry.frames[i];
+    }
+    running_hash += entry.hash;
+    cache.hits++;
+  } else {
+    size_t num_inner = num_frames;
+    uint64_t inner_hash = running_hash;
+    entry.num_frames = 0;
+    while (num_frames < max_frames) {
+      record = reinterpret_cast<const FrameRecord *>(frame_address);
+      uintptr_t pc = internal::FramePc<kAdjustPc>(record);
+      size_t outer = num_frames - num_inner;
+      if (outer < UnwindPrefixCache::kMaxFrames) {
+        entry.records[outer] = frame_address;
+        entry.frames[outer] = pc;
+      }
+      running_hash = StackHashStep(running_hash, pc, num_frames);
+      frames[num_frames++] = pc;
+      if (!internal::IsNextFrame(frame_address, record->next_frame, end)) {
+        break;
+      }
+      frame_address = record->next_frame;
+    }
+    if (num_frames - num_inner <= UnwindPrefixCache::kMaxFrames) {
+      entry.last_next_frame = record->next_frame;
+      entry.hash = running_hash - inner_hash;
+      entry.num_inner = num_inner;
+      entry.max_frames = max_frames;
+      entry.num_frames = num_frames - num_inner;
+    }
+    cache.misses++;
+  }
+
+  if (hash) {
+    *hash = StackHashFinish(running_hash, num_frames);
+  }
+  return num_frames;
+}
+}  // namespace util
+}  // namespace kwai
+
+#endif  // KWAI_UTIL_FRAME_POINTER_UNWIND_H
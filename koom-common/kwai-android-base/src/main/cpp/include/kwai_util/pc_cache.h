@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#ifndef KWAI_UTIL_PC_CACHE_H
+#define KWAI_UTIL_PC_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace kwai {
+namespace util {
+
+// Bounded cache of per-pc results (symbol, formatted frame), shared by
+// threads. Keys are spread over shards with their own lock, each shard
+// evicts with the CLOCK policy once its part of the byte budget is used.
+// The caller tells the bytes a value holds, bookkeeping is added to it.
+template <typename V, size_t kNumShards = 8>
+class PcCache {
+  static_assert((kNumShards & (kNumShards - 1)) == 0,
+                "kNumShards must be power of 2");
+
+ public:
+  explicit PcCache(size_t max_bytes)
+      : max_shard_bytes_(max_bytes / kNumShards), hits_(0), misses_(0) {}
+
+  bool Find(uintptr_t pc, V *value) {
+    auto &shard = GetShard(pc);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(pc);
+    if (it == shard.index.end()) {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    auto &entry = shard.entries[it->second];
+    entry.referenced = true;
+    *value = entry.value;
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  void Put(uintptr_t pc, const V &value, size_t bytes) {
+    bytes += kEntryOverhead;
+    if (bytes > max_shard_bytes_) {
+      return;
+    }
+    auto &shard = GetShard(pc);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.index.count(pc)) {
+      return;
+    }
+    while (shard.bytes + bytes > max_shard_bytes_) {
+      Evict(&shard);
+    }
+    shard.index.emplace(pc, shard.entries.size());
+    shard.entries.push_back({pc, value, bytes, false});
+    shard.bytes += bytes;
+  }
+
+  void Clear() {
+    for (auto &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.entries.clear();
+      shard.index.clear();
+      shard.hand = 0;
+      shard.bytes = 0;
+    }
+  }
+
+  uint64_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+  uint64_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+  size_t Bytes() {
+    size_t bytes = 0;
+    for (auto &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      bytes += shard.bytes;
+    }
+    return bytes;
+  }
+
+ private:
+  // Entry slot plus a hash node, roughly
+  static const size_t kEntryOverhead = sizeof(V) + 64;
+
+  struct Entry {
+    uintptr_t pc;
+    V value;
+    size_t bytes;
+    // Set on hit, a referenced entry survives one more pass of the hand
+    bool referenced;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    std::unordered_map<uintptr_t, size_t> index;
+    size_t hand = 0;
+    size_t bytes = 0;
+  };
+
+  Shard &GetShard(uintptr_t pc) {
+    // Instructions are at least 2 bytes aligned
+    return shards_[((pc >> 1) * 0x9E3779B97F4A7C15ULL >> 40) &
+                   (kNumShards - 1)];
+  }
+
+  // Remove the first unreferenced entry from the hand, the last entry takes
+  // over its slot
+  static void Evict(Shard *shard) {
+    for (;;) {
+      if (shard->hand >= shard->entries.size()) {
+        shard->hand = 0;
+      }
+      auto &entry = shard->entries[shard->hand];
+      if (entry.referenced) {
+        entry.referenced = false;
+        shard->hand++;
+        continue;
+      }
+
+      shard->index.erase(entry.pc);
+      shard->bytes -= entry.bytes;
+      if (shard->hand != shard->entries.size() - 1) {
+        entry = std::move(shard->entries.back());
+        shard->index[entry.pc] = shard->hand;
+      }
+      shard->entries.pop_back();
+      return;
+    }
+  }
+
+  Shard shards_[kNumShards];
+  const size_t max_shard_bytes_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
+}  // namespace util
+}  // namespace kwai
+
+#endif  // KWAI_UTIL_PC_CACHE_H
@@ -0,0 +1,759 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#include <fast_unwind/fast_unwind.h>
+#include <fast_unwind/unwind_table.h>
+#include <kwai_util/frame_pointer_unwind.h>
+#include <kwai_util/kwai_macros.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unwindstack/DwarfSection.h>
+#include <unwindstack/DwarfStructs.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/ElfInterface.h>
+#include <unwindstack/MachineArm.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/RegsArm.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <thread>
+
+#include "../libunwindstack/ArmExidx.h"
+#include "../libunwindstack/ElfInterfaceArm.h"
+
+namespace kwai {
+namespace unwind {
+// Least time between two updates, unwinds through pcs of no module, e.g. JIT
+// code, ask for one again right after every update
+static const int kBuildIntervalMs = 200;
+
+// DWARF numbers of the registers a row tracks
+#if defined(__aarch64__)
+static const uint32_t kDwarfSp = 31;
+static const uint32_t kDwarfFp = 29;
+static const uint32_t kDwarfFp2 = UINT32_MAX;
+static const uint32_t kDwarfLr = 30;
+#elif defined(__arm__)
+static const uint32_t kDwarfSp = 13;
+static const uint32_t kDwarfFp = 7;
+static const uint32_t kDwarfFp2 = 11;
+static const uint32_t kDwarfLr = 14;
+#elif defined(__x86_64__)
+static const uint32_t kDwarfSp = 7;
+static const uint32_t kDwarfFp = 6;
+static const uint32_t kDwarfFp2 = UINT32_MAX;
+static const uint32_t kDwarfLr = UINT32_MAX;
+#elif defined(__i386__)
+static const uint32_t kDwarfSp = 4;
+static const uint32_t kDwarfFp = 5;
+static const uint32_t kDwarfFp2 = UINT32_MAX;
+static const uint32_t kDwarfLr = UINT32_MAX;
+#endif
+
+bool UnwindRow::SameRule(const UnwindRow &other) const {
+  return cfa_offset == other.cfa_offset &&
+         cfa_register == other.cfa_register &&
+         return_address == other.return_address &&
+         ra_offset == other.ra_offset && fp_offset == other.fp_offset &&
+         fp2_offset == other.fp2_offset;
+}
+
+// File offsets of a module read from where its segments are loaded
+class LoadedImageMemory : public unwindstack::Memory {
+ public:
+  LoadedImageMemory(uintptr_t load_bias, const ElfW(Phdr) *phdrs,
+                    size_t num_phdrs)
+      : load_bias_(load_bias),
+        process_memory_(unwindstack::Memory::CreateProcessMemory(getpid())) {
+    for (size_t i = 0; i < num_phdrs; i++) {
+      if (phdrs[i].p_type == PT_LOAD) {
+        loads_.push_back(phdrs[i]);
+      }
+    }
+  }
+
+  size_t Read(uint64_t addr, void *dst, size_t size) override {
+    for (auto &load : loads_) {
+      if (addr >= load.p_offset && addr < load.p_offset + load.p_filesz) {
+        size_t length =
+            std::min<uint64_t>(size, load.p_offset + load.p_filesz - addr);
+        return process_memory_->Read(
+            load_bias_ + load.p_vaddr + (addr - load.p_offset), dst, length);
+      }
+    }
+    return 0;
+  }
+
+ private:
+  uintptr_t load_bias_;
+  std::shared_ptr<unwindstack::Memory> process_memory_;
+  std::vector<ElfW(Phdr)> loads_;
+};
+
+template <typename T>
+static bool FitsIn(int64_t value) {
+  return value >= std::numeric_limits<T>::min() &&
+         value <= std::numeric_limits<T>::max();
+}
+
+static uint8_t CfaRegisterOf(uint64_t reg) {
+  if (reg == kDwarfSp) {
+    return UnwindRow::kCfaSp;
+  }
+  if (reg == kDwarfFp) {
+    return UnwindRow::kCfaFp;
+  }
+  if (reg == kDwarfFp2) {
+    return UnwindRow::kCfaFp2;
+  }
+  return UnwindRow::kCfaUndefined;
+}
+
+// Offset from the CFA a register is saved at, 0 if unchanged, false if the
+// rule is not an offset
+static bool SavedOffset(const unwindstack::dwarf_loc_regs_t &loc_regs,
+                        uint32_t reg, int16_t *offset) {
+  *offset = 0;
+  auto it = loc_regs.find(reg);
+  if (it == loc_regs.end() ||
+      it->second.type == unwindstack::DWARF_LOCATION_UNDEFINED) {
+    return true;
+  }
+  auto value = static_cast<int64_t>(it->second.values[0]);
+  if (it->second.type != unwindstack::DWARF_LOCATION_OFFSET ||
+      !FitsIn<int16_t>(value) || !value) {
+    return false;
+  }
+  *offset = value;
+  return true;
+}
+
+static UnwindRow DwarfRow(const unwindstack::dwarf_loc_regs_t &loc_regs,
+                          const unwindstack::DwarfCie *cie) {
+  UnwindRow row = {};
+  row.cfa_register = UnwindRow::kCfaUndefined;
+  auto cfa = loc_regs.find(unwindstack::CFA_REG);
+  if (cfa == loc_regs.end() ||
+      cfa->second.type != unwindstack::DWARF_LOCATION_REGISTER ||
+      cie->is_signal_frame) {
+    return row;
+  }
+  auto cfa_offset = static_cast<int64_t>(cfa->second.values[1]);
+  auto ra = loc_regs.find(cie->return_address_register);
+  if (ra == loc_regs.end() && cie->return_address_register == kDwarfLr) {
+    row.return_address = UnwindRow::kRaInLr;
+  } else if (ra != loc_regs.end() &&
+             ra->second.type == unwindstack::DWARF_LOCATION_UNDEFINED) {
+    row.return_address = UnwindRow::kRaUndefined;
+  } else if (ra == loc_regs.end() ||
+             !SavedOffset(loc_regs, cie->return_address_register,
+                          &row.ra_offset)) {
+    return row;
+  }
+  if (!FitsIn<int32_t>(cfa_offset) ||
+      !SavedOffset(loc_regs, kDwarfFp, &row.fp_offset) ||
+      !SavedOffset(loc_regs, kDwarfFp2, &row.fp2_offset)) {
+    return row;
+  }
+  row.cfa_offset = cfa_offset;
+  row.cfa_register = CfaRegisterOf(cfa->second.values[0]);
+  return row;
+}
+
+// A row for every change of rules within every FDE, and a gap row where an
+// FDE ends before the next starts
+static void AddDwarfRows(unwindstack::DwarfSection *section,
+                         unwindstack::ArchEnum arch,
+                         std::vector<UnwindRow> *rows) {
+  for (const unwindstack::DwarfFde *fde : *section) {
+    if (fde == nullptr || fde->cie == nullptr) {
+      continue;
+    }
+    uint64_t pc = fde->pc_start;
+    while (pc < fde->pc_end) {
+      unwindstack::dwarf_loc_regs_t loc_regs;
+      if (!section->GetCfaLocationInfo(pc, fde, &loc_regs, arch) ||
+          loc_regs.pc_end <= pc) {
+        break;
+      }
+      UnwindRow row = DwarfRow(loc_regs, fde->cie);
+      row.pc = pc;
+      rows->push_back(row);
+      pc = loc_regs.pc_end;
+    }
+    UnwindRow gap = {};
+    gap.pc = fde->pc_end;
+    gap.cfa_register = UnwindRow::kCfaUndefined;
+    gap.return_address = UnwindRow::kRaUndefined;
+    rows->push_back(gap);
+  }
+}
+
+// Register values exidx is evaluated with: loads return the tagged address
+// they read, so after evaluation every register tells where it came from
+static const uint32_t kLoadedTag = 0x80000000;
+static const uint32_t kSpBase = 0x10000000;
+static const uint32_t kFpBase = 0x20000000;
+static const uint32_t kFp2Base = 0x30000000;
+static const uint32_t kLrValue = 0x40000000;
+static const uint32_t kBaseRange = 0x01000000;
+
+class AddressEchoMemory : public unwindstack::Memory {
+ public:
+  size_t Read(uint64_t addr, void *dst, size_t size) override {
+    auto *words = static_cast<uint8_t *>(dst);
+    for (size_t i = 0; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t)) {
+      uint32_t value = kLoadedTag | static_cast<uint32_t>(addr + i);
+      memcpy(words + i, &value, sizeof(value));
+    }
+    return size / sizeof(uint32_t) * sizeof(uint32_t);
+  }
+};
+
+static bool ExidxSavedOffset(uint32_t value, uint32_t unchanged,
+                             uint32_t cfa, int16_t *offset) {
+  *offset = 0;
+  if (value == unchanged) {
+    return true;
+  }
+  int64_t saved_offset =
+      static_cast<int64_t>(value & ~kLoadedTag) - static_cast<int64_t>(cfa);
+  if (!(value & kLoadedTag) || !FitsIn<int16_t>(saved_offset)) {
+    return false;
+  }
+  *offset = saved_offset;
+  return true;
+}
+
+// The rules at the body of the function of an exidx entry: they don't hold
+// in its prologue and epilogue, but callers are always in a body
+static UnwindRow ExidxRow(unwindstack::ElfInterfaceArm *interface,
+                          size_t index) {
+  UnwindRow row = {};
+  row.cfa_register = UnwindRow::kCfaUndefined;
+  unwindstack::RegsArm regs;
+  for (size_t reg = 0; reg < unwindstack::ARM_REG_LAST; reg++) {
+    regs[reg] = 0;
+  }
+  regs[unwindstack::ARM_REG_SP] = kSpBase;
+  regs[unwindstack::ARM_REG_R7] = kFpBase;
+  regs[unwindstack::ARM_REG_R11] = kFp2Base;
+  regs[unwindstack::ARM_REG_LR] = kLrValue;
+  AddressEchoMemory echo_memory;
+  unwindstack::ArmExidx exidx(&regs, interface->memory(), &echo_memory);
+  exidx.set_cfa(kSpBase);
+  if (!exidx.ExtractEntryData(interface->start_offset() + index * 8)) {
+    if (exidx.status() == unwindstack::ARM_STATUS_NO_UNWIND) {
+      row.return_address = UnwindRow::kRaUndefined;
+    }
+    return row;
+  }
+  if (exidx.data()->empty() || !exidx.Eval()) {
+    return row;
+  }
+
+  uint32_t cfa = exidx.cfa();
+  uint32_t base;
+  uint8_t cfa_register;
+  if (cfa - kSpBase + kBaseRange < 2 * kBaseRange) {
+    base = kSpBase;
+    cfa_register = UnwindRow::kCfaSp;
+  } else if (cfa - kFpBase + kBaseRange < 2 * kBaseRange) {
+    base = kFpBase;
+    cfa_register = UnwindRow::kCfaFp;
+  } else if (cfa - kFp2Base + kBaseRange < 2 * kBaseRange) {
+    base = kFp2Base;
+    cfa_register = UnwindRow::kCfaFp2;
+  } else {
+    return row;
+  }
+  uint32_t ra = exidx.pc_set() ? regs[unwindstack::ARM_REG_PC]
+                               : regs[unwindstack::ARM_REG_LR];
+  if (ra == kLrValue) {
+    row.return_address = UnwindRow::kRaInLr;
+  } else if (!ExidxSavedOffset(ra, kLrValue, cfa, &row.ra_offset)) {
+    return row;
+  }
+  if (!ExidxSavedOffset(regs[unwindstack::ARM_REG_R7], kFpBase, cfa,
+                        &row.fp_offset) ||
+      !ExidxSavedOffset(regs[unwindstack::ARM_REG_R11], kFp2Base, cfa,
+                        &row.fp2_offset)) {
+    return row;
+  }
+  row.cfa_offset = static_cast<int32_t>(cfa - base);
+  row.cfa_register = cfa_register;
+  return row;
+}
+
+static void AddExidxRows(unwindstack::ElfInterfaceArm *interface,
+                         int64_t load_bias, std::vector<UnwindRow> *rows) {
+  size_t index = 0;
+  for (uint32_t addr : *interface) {
+    UnwindRow row = ExidxRow(interface, index++);
+    row.pc = addr + load_bias;
+    rows->push_back(row);
+  }
+}
+
+std::unique_ptr<UnwindTable> UnwindTable::Build(uintptr_t load_bias,
+                                                const ElfW(Phdr) *phdrs,
+                                                size_t num_phdrs) {
+  unwindstack::Elf elf(new LoadedImageMemory(load_bias, phdrs, num_phdrs));
+  if (!elf.Init() || !elf.valid()) {
+    return nullptr;
+  }
+
+  // Like libunwindstack on arm, exidx is used if present, DWARF otherwise
+  std::vector<UnwindRow> rows;
+  auto *interface = elf.interface();
+  if (elf.arch() == unwindstack::ARCH_ARM &&
+      static_cast<unwindstack::ElfInterfaceArm *>(interface)->total_entries()) {
+    AddExidxRows(static_cast<unwindstack::ElfInterfaceArm *>(interface),
+                 elf.GetLoadBias(), &rows);
+  } else if (interface->eh_frame() != nullptr) {
+    AddDwarfRows(interface->eh_frame(), elf.arch(), &rows);
+  }
+  if (rows.empty()) {
+    return nullptr;
+  }
+
+  // Rows of an FDE win over the gap row where the previous one ended
+  std::stable_sort(rows.begin(), rows.end(),
+                   [](const UnwindRow &a, const UnwindRow &b) {
+                     return a.pc < b.pc;
+                   });
+  std::unique_ptr<UnwindTable> table(new UnwindTable());
+  auto &table_rows = table->rows_;
+  for (auto &row : rows) {
+    if (!table_rows.empty() && table_rows.back().pc == row.pc) {
+      table_rows.back() = row;
+      if (table_rows.size() > 1 &&
+          table_rows[table_rows.size() - 2].SameRule(row)) {
+        table_rows.pop_back();
+      }
+    } else if (table_rows.empty() || !table_rows.back().SameRule(row)) {
+      table_rows.push_back(row);
+    }
+  }
+  table_rows.shrink_to_fit();
+
+  uintptr_t first_block = table_rows.front().pc >> kBlockShift;
+  uintptr_t last_block = table_rows.back().pc >> kBlockShift;
+  table->blocks_.resize(last_block - first_block + 2);
+  for (size_t block = 0, row = 0; block < table->blocks_.size(); block++) {
+    uintptr_t block_start = (first_block + block) << kBlockShift;
+    while (row + 1 < table_rows.size() &&
+           table_rows[row + 1].pc <= block_start) {
+      row++;
+    }
+    table->blocks_[block] = row;
+  }
+  return table;
+}
+
+const UnwindRow *UnwindTable::Find(uintptr_t pc) const {
+  if (pc < rows_.front().pc) {
+    return nullptr;
+  }
+  uintptr_t block = (pc >> kBlockShift) - (rows_.front().pc >> kBlockShift);
+  if (block + 1 >= blocks_.size()) {
+    return &rows_.back();
+  }
+  auto begin = rows_.begin() + blocks_[block];
+  auto end = rows_.begin() + blocks_[block + 1] + 1;
+  auto it = std::upper_bound(
+      begin, end, pc,
+      [](uintptr_t value, const UnwindRow &row) { return value < row.pc; });
+  return &*--it;
+}
+
+const TableUnwinder::Module *TableUnwinder::ModuleList::Find(
+    uintptr_t pc) const {
+  auto it = std::upper_bound(
+      modules.begin(), modules.end(), pc,
+      [](uintptr_t value, const Module *module) {
+        return value < module->start;
+      });
+  if (it == modules.begin() || pc >= (*--it)->end) {
+    return nullptr;
+  }
+  return *it;
+}
+
+TableUnwinder &TableUnwinder::GetInstance() {
+  static TableUnwinder &unwinder = *new TableUnwinder();
+  return unwinder;
+}
+
+void TableUnwinder::Start() {
+  if (started_.exchange(true)) {
+    return;
+  }
+  Update();
+  std::thread([this]() { BuildLoop(); }).detach();
+}
+
+// A futex instead of a condition variable, unwinds may run in a signal
+// handler
+void TableUnwinder::RequestUpdate() {
+  if (update_needed_.load(std::memory_order_relaxed) ||
+      update_needed_.exchange(1, std::memory_order_relaxed)) {
+    return;
+  }
+  syscall(__NR_futex, &update_needed_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr,
+          0);
+}
+
+void TableUnwinder::BuildLoop() {
+  for (;;) {
+    while (!update_needed_.load()) {
+      syscall(__NR_futex, &update_needed_, FUTEX_WAIT_PRIVATE, 0, nullptr,
+              nullptr, 0);
+    }
+    Update();
+    std::this_thread::sleep_for(std::chrono::milliseconds(kBuildIntervalMs));
+  }
+}
+
+// Program headers are copied, the loader may free them once the module is
+// unloaded
+struct LoadedModule {
+  uintptr_t start;
+  uintptr_t end;
+  uintptr_t load_bias;
+  std::vector<ElfW(Phdr)> phdrs;
+  std::string key;
+};
+
+static std::string ReadBuildId(const dl_phdr_info *info) {
+  for (size_t i = 0; i < info->dlpi_phnum; i++) {
+    auto &phdr = info->dlpi_phdr[i];
+    if (phdr.p_type != PT_NOTE) {
+      continue;
+    }
+    auto *note = reinterpret_cast<const uint8_t *>(info->dlpi_addr +
+                                                   phdr.p_vaddr);
+    auto *end = note + phdr.p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= end) {
+      auto *header = reinterpret_cast<const ElfW(Nhdr) *>(note);
+      auto *name = note + sizeof(ElfW(Nhdr));
+      auto *desc = name + ((header->n_namesz + 3) & ~3);
+      if (header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 &&
+          !memcmp(name, "GNU", 4) && desc + header->n_descsz <= end) {
+        return std::string(reinterpret_cast<const char *>(desc),
+                           header->n_descsz);
+      }
+      note = desc + ((header->n_descsz + 3) & ~3);
+    }
+  }
+  return "";
+}
+
+void TableUnwinder::Update() {
+  std::lock_guard<std::mutex> lock(update_mutex_);
+  update_needed_ = 0;
+  std::vector<LoadedModule> loaded;
+  dl_iterate_phdr(
+      [](dl_phdr_info *info, size_t, void *data) {
+        LoadedModule module = {UINTPTR_MAX, 0, info->dlpi_addr, {}, ""};
+        for (size_t i = 0; i < info->dlpi_phnum; i++) {
+          auto &phdr = info->dlpi_phdr[i];
+          if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X)) {
+            module.start = std::min<uintptr_t>(
+                module.start, module.load_bias + phdr.p_vaddr);
+            module.end = std::max<uintptr_t>(
+                module.end, module.load_bias + phdr.p_vaddr + phdr.p_memsz);
+          }
+        }
+        if (module.start < module.end) {
+          module.phdrs.assign(info->dlpi_phdr,
+                              info->dlpi_phdr + info->dlpi_phnum);
+          module.key = ReadBuildId(info);
+          if (module.key.empty() && info->dlpi_name) {
+            module.key = info->dlpi_name;
+          }
+          static_cast<std::vector<LoadedModule> *>(data)->push_back(
+              std::move(module));
+        }
+        return 0;
+      },
+      &loaded);
+
+  // Modules stay the same objects while loaded, so their tables are kept. A
+  // module loaded again at the same place may be another file.
+  auto *current = modules_.load(std::memory_order_acquire);
+  std::unique_ptr<ModuleList> list(new ModuleList());
+  for (auto &module : loaded) {
+    Module *existing = nullptr;
+    if (current) {
+      auto *found = current->Find(module.start);
+      if (found && found->start == module.start && found->end == module.end &&
+          found->load_bias == module.load_bias && found->key == module.key) {
+        existing = const_cast<Module *>(found);
+      }
+    }
+    if (!existing) {
+      all_modules_.emplace_back();
+      existing = &all_modules_.back();
+      existing->start = module.start;
+      existing->end = module.end;
+      existing->load_bias = module.load_bias;
+      existing->key = module.key;
+      existing->table = nullptr;
+      existing->wanted = false;
+      existing->tried = false;
+    }
+    if (existing->wanted && !existing->tried) {
+      existing->tried = true;
+      auto it = tables_.find(module.key);
+      if (it == tables_.end()) {
+        it = tables_
+                 .emplace(module.key,
+                          UnwindTable::Build(module.load_bias,
+                                             module.phdrs.data(),
+                                             module.phdrs.size()))
+                 .first;
+      }
+      existing->table.store(it->second.get(), std::memory_order_release);
+    }
+    list->modules.push_back(existing);
+  }
+  std::sort(list->modules.begin(), list->modules.end(),
+            [](const Module *a, const Module *b) {
+              return a->start < b->start;
+            });
+  // Lists are never freed, only publish one if the loaded modules changed.
+  // Tables are stored in the modules, they need no new list.
+  if (current && current->modules == list->modules) {
+    return;
+  }
+  modules_.store(list.get(), std::memory_order_release);
+  module_lists_.push_back(std::move(list));
+}
+
+// Rows last found by a thread, by pc. Entries are of one module list, rows
+// are never freed. A pc outside all modules of the list is kept with a null
+// row, it asks for an update only once per list. The pc is cleared while an
+// entry is written, so a signal handler unwinding on the same thread never
+// reads half an entry.
+struct RowCache {
+  static const size_t kNumEntries = 64;
+
+  struct Entry {
+    uintptr_t pc;
+    const void *modules;
+    const UnwindRow *row;
+  };
+  Entry entries[kNumEntries];
+
+  Entry &Get(uintptr_t pc) {
+    return entries[(pc * 0x9E3779B97F4A7C15ULL >> 32) % kNumEntries];
+  }
+};
+
+static FAST_UNWIND_TLS_INITIAL_EXEC RowCache row_cache;
+
+const UnwindRow *TableUnwinder::FindRow(const ModuleList *modules,
+                                        uintptr_t pc) {
+  auto &entry = row_cache.Get(pc);
+  if (entry.pc == pc && entry.modules == modules) {
+    return entry.row;
+  }
+
+  const Module *module = modules ? modules->Find(pc) : nullptr;
+  const UnwindTable *table =
+      module ? module->table.load(std::memory_order_acquire) : nullptr;
+  const UnwindRow *row = nullptr;
+  if (!module) {
+    // JIT code or a module loaded since, only the latter needs an update
+    RequestUpdate();
+  } else if (!table) {
+    if (!module->wanted.load(std::memory_order_relaxed)) {
+      const_cast<Module *>(module)->wanted.store(true,
+                                                 std::memory_order_relaxed);
+      RequestUpdate();
+    }
+    // Not cached, the table is stored in the module once it is built
+    return nullptr;
+  } else {
+    row = table->Find(pc - module->load_bias);
+  }
+
+  entry.pc = 0;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  entry.modules = modules;
+  entry.row = row;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  entry.pc = pc;
+  return row;
+}
+
+// One frame up by the table of the module of the pc, or by frame pointer.
+// Every load is checked to be in the stack first.
+TableUnwinder::StepKind TableUnwinder::Step(const ModuleList *modules,
+                                            bool innermost,
+                                            uintptr_t stack_start,
+                                            uintptr_t stack_end,
+                                            UnwindRegs *regs, bool *sp_exact) {
+  auto readable = [&](uintptr_t address) {
+    return address >= stack_start && address % sizeof(uintptr_t) == 0 &&
+           address + sizeof(uintptr_t) <= stack_end;
+  };
+  auto load = [](uintptr_t address) {
+    return *reinterpret_cast<const uintptr_t *>(address);
+  };
+
+  // A return address is past the call, the call is what's described
+  const UnwindRow *row =
+      FindRow(modules, innermost ? regs->pc : regs->pc - 1);
+  if (row && row->return_address == UnwindRow::kRaUndefined) {
+    return kStepNone;
+  }
+  if (row && row->cfa_register != UnwindRow::kCfaUndefined &&
+      (*sp_exact || row->cfa_register != UnwindRow::kCfaSp)) {
+    uintptr_t base = row->cfa_register == UnwindRow::kCfaSp   ? regs->sp
+                     : row->cfa_register == UnwindRow::kCfaFp ? regs->fp
+                                                              : regs->fp2;
+    uintptr_t cfa = base + row->cfa_offset;
+    uintptr_t ra_address = cfa + row->ra_offset;
+    uintptr_t fp_address = cfa + row->fp_offset;
+    uintptr_t fp2_address = cfa + row->fp2_offset;
+    if (cfa <= regs->sp || cfa > stack_end ||
+        (row->return_address == UnwindRow::kRaAtCfa &&
+         !readable(ra_address)) ||
+        (row->return_address == UnwindRow::kRaInLr && !innermost) ||
+        (row->fp_offset && !readable(fp_address)) ||
+        (row->fp2_offset && !readable(fp2_address))) {
+      return kStepNone;
+    }
+    regs->pc = row->return_address == UnwindRow::kRaAtCfa ? load(ra_address)
+                                                          : regs->lr;
+    regs->fp = row->fp_offset ? load(fp_address) : regs->fp;
+    regs->fp2 = row->fp2_offset ? load(fp2_address) : regs->fp2;
+    regs->sp = cfa;
+    *sp_exact = true;
+    return kStepTable;
+  }
+
+  // Same frame records as FramePointerUnwind
+  uintptr_t record = regs->fp;
+  if (record < regs->sp || !readable(record) ||
+      !readable(record + sizeof(uintptr_t))) {
+    return kStepNone;
+  }
+  regs->pc = load(record + sizeof(uintptr_t));
+  regs->fp = load(record);
+  regs->sp = record + 2 * sizeof(uintptr_t);
+  // Where the record is in the frame differs on arm, the CFA is unknown
+#if defined(__x86_64__) || defined(__i386__)
+  *sp_exact = true;
+#else
+  *sp_exact = false;
+#endif
+  return kStepFp;
+}
+
+size_t TableUnwinder::Unwind(const UnwindRegs &regs, uintptr_t *frames,
+                             size_t max_frames) {
+  uintptr_t stack_end = kwai::util::StackEndOf(regs.sp);
+  if (!stack_end) {
+    return 0;
+  }
+  auto *modules = modules_.load(std::memory_order_acquire);
+  UnwindRegs current = regs;
+  bool sp_exact = true;
+  size_t num_frames = 0;
+  size_t table_steps = 0;
+  for (bool innermost = true; num_frames < max_frames; innermost = false) {
+    StepKind kind =
+        Step(modules, innermost, regs.sp, stack_end, &current, &sp_exact);
+    if (kind == kStepNone || !current.pc) {
+      break;
+    }
+    table_steps += kind == kStepTable;
+    frames[num_frames++] = current.pc;
+  }
+  table_steps_.fetch_add(table_steps, std::memory_order_relaxed);
+  fp_steps_.fetch_add(num_frames - table_steps, std::memory_order_relaxed);
+  return num_frames;
+}
+
+TableUnwinder::Stats TableUnwinder::GetStats() {
+  std::lock_guard<std::mutex> lock(update_mutex_);
+  Stats stats = {};
+  stats.table_steps = table_steps_.load(std::memory_order_relaxed);
+  stats.fp_steps = fp_steps_.load(std::memory_order_relaxed);
+  auto *modules = modules_.load(std::memory_order_acquire);
+  stats.num_modules = modules ? modules->modules.size() : 0;
+  for (auto &table : tables_) {
+    if (table.second) {
+      stats.num_tables++;
+      stats.table_bytes += table.second->Bytes();
+    }
+  }
+  return stats;
+}
+}  // namespace unwind
+}  // namespace kwai
+
+// Registers at a pc within this function, the first step unwinds it
+__attribute__((noinline)) KWAI_EXPORT size_t table_unwind(uintptr_t *buf,
+                                                          size_t num_entries) {
+  kwai::unwind::UnwindRegs regs = {};
+#if defined(__aarch64__)
+  asm volatile(
+      "adr %0, .\n"
+      "mov %1, sp\n"
+      "mov %2, x29\n"
+      "mov %3, x30\n"
+      : "=&r"(regs.pc), "=&r"(regs.sp), "=&r"(regs.fp), "=&r"(regs.lr));
+#elif defined(__arm__)
+  asm volatile(
+      "mov %0, pc\n"
+      "mov %1, sp\n"
+      "mov %2, r7\n"
+      "mov %3, r11\n"
+      "mov %4, lr\n"
+      : "=&r"(regs.pc), "=&r"(regs.sp), "=&r"(regs.fp), "=&r"(regs.fp2),
+        "=&r"(regs.lr));
+#elif defined(__x86_64__)
+  asm volatile(
+      "lea 0(%%rip), %0\n"
+      "mov %%rsp, %1\n"
+      "mov %%rbp, %2\n"
+      : "=&r"(regs.pc), "=&r"(regs.sp), "=&r"(regs.fp));
+#elif defined(__i386__)
+  asm volatile(
+      "mov %%esp, %1\n"
+      "call 1f\n"
+      "1: pop %0\n"
+      "mov %%ebp, %2\n"
+      : "=&r"(regs.pc), "=&r"(regs.sp), "=&r"(regs.fp));
+#endif
+  return kwai::unwind::TableUnwinder::GetInstance().Unwind(regs, buf,
+                                                           num_entries);
+}
+
+KWAI_EXPORT void table_unwind_start() {
+  kwai::unwind::TableUnwinder::GetInstance().Start();
+}
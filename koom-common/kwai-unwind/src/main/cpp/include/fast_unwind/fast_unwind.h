@@ -21,6 +21,7 @@
 
 #include <sys/cdefs.h>
 #include <backtrace/backtrace_constants.h>
+#include <cstddef>
 #include <cstdint>
 
 __BEGIN_DECLS
@@ -36,6 +37,10 @@ void fast_unwind_init_main_thread();
 
 size_t frame_pointer_unwind(uintptr_t *buf, size_t num_entries);
 
+/* full stacks through code without frame pointers, by unwind tables built in the background */
+void table_unwind_start();
+size_t table_unwind(uintptr_t *buf, size_t num_entries);
+
 inline __attribute__((__always_inline__)) size_t fast_unwind(uintptr_t *buf, size_t num_entries) {
   if (android_unsafe_frame_pointer_chase) {
     return android_unsafe_frame_pointer_chase(buf, num_entries);
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#pragma once
+
+#include <link.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kwai {
+namespace unwind {
+
+// How to find the caller's registers from a range of pcs of a module,
+// reduced from .eh_frame or .ARM.exidx to what a frame step needs. The CFA
+// is the caller's sp, saved registers are at an offset from it.
+struct UnwindRow {
+  enum CfaRegister : uint8_t {
+    // No rule a step can follow, e.g. a DWARF expression or a gap
+    kCfaUndefined,
+    kCfaSp,
+    // x29, rbp, ebp, or r7 on arm
+    kCfaFp,
+    // r11 on arm
+    kCfaFp2,
+  };
+  enum ReturnAddress : uint8_t {
+    kRaAtCfa,
+    // Not saved yet, only valid in the innermost frame
+    kRaInLr,
+    // Outermost frame
+    kRaUndefined,
+  };
+
+  // Module relative pc the row starts at, it ends at the next row
+  uint32_t pc;
+  int32_t cfa_offset;
+  uint8_t cfa_register;
+  uint8_t return_address;
+  int16_t ra_offset;
+  // 0 if the register is not saved
+  int16_t fp_offset;
+  int16_t fp2_offset;
+
+  bool SameRule(const UnwindRow &other) const;
+};
+
+// Rows of a module sorted by pc, immutable once built
+class UnwindTable {
+ public:
+  // Build from the loaded image of a module, read by program headers so
+  // modules mapped from an apk work too. Null if it has no unwind info.
+  static std::unique_ptr<UnwindTable> Build(uintptr_t load_bias,
+                                            const ElfW(Phdr) *phdrs,
+                                            size_t num_phdrs);
+
+  const UnwindRow *Find(uintptr_t pc) const;
+  size_t Bytes() const {
+    return rows_.size() * sizeof(UnwindRow) +
+           blocks_.size() * sizeof(uint32_t);
+  }
+
+ private:
+  // Lookups only search the rows of the block of the pc, like ORC
+  static const int kBlockShift = 8;
+
+  std::vector<UnwindRow> rows_;
+  // Index of the row covering the start of every block from the first row
+  std::vector<uint32_t> blocks_;
+};
+
+struct UnwindRegs {
+  uintptr_t pc;
+  uintptr_t sp;
+  uintptr_t fp;
+  uintptr_t fp2;
+  uintptr_t lr;
+};
+
+// Unwinds with the tables of the modules on the stack, and by frame pointer
+// through modules without one. Tables are built lazily on a background
+// thread for the modules unwinds ran into, and shared by build-id, so the
+// first unwinds through a module fall back to frame pointers.
+class TableUnwinder {
+ public:
+  struct Stats {
+    uint64_t table_steps;
+    uint64_t fp_steps;
+    size_t num_modules;
+    size_t num_tables;
+    size_t table_bytes;
+  };
+
+  static TableUnwinder &GetInstance();
+
+  // Start the thread building tables, once
+  void Start();
+  // Refresh the loaded modules and build the tables unwinds asked for, on
+  // the calling thread
+  void Update();
+  // Async-signal-safe, store at most |max_frames| return addresses of the
+  // callers of the frame |regs| describe
+  size_t Unwind(const UnwindRegs &regs, uintptr_t *frames, size_t max_frames);
+  Stats GetStats();
+
+ private:
+  struct Module {
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t load_bias;
+    // Build-id, or path without one
+    std::string key;
+    std::atomic<const UnwindTable *> table;
+    // Set by unwinds which need its table, cleared once tried
+    std::atomic<bool> wanted;
+    bool tried;
+  };
+
+  // Executable modules sorted by start
+  struct ModuleList {
+    std::vector<Module *> modules;
+    const Module *Find(uintptr_t pc) const;
+  };
+
+  enum StepKind { kStepNone, kStepTable, kStepFp };
+
+  TableUnwinder() = default;
+  // Row of the pc if its module has a table, asks for it otherwise
+  const UnwindRow *FindRow(const ModuleList *modules, uintptr_t pc);
+  StepKind Step(const ModuleList *modules, bool innermost,
+                uintptr_t stack_start, uintptr_t stack_end, UnwindRegs *regs,
+                bool *sp_exact);
+  // Async-signal-safe, wake the build thread if it sleeps
+  void RequestUpdate();
+  void BuildLoop();
+
+  std::atomic<const ModuleList *> modules_{nullptr};
+  // Futex word the build thread sleeps on while it is 0
+  std::atomic<uint32_t> update_needed_{1};
+  std::atomic<bool> started_{false};
+  std::atomic<uint64_t> table_steps_{0};
+  std::atomic<uint64_t> fp_steps_{0};
+
+  std::mutex update_mutex_;
+  // Modules and lists are never freed, unwinds may still read them. A list
+  // is only added when the loaded modules change.
+  std::deque<Module> all_modules_;
+  std::vector<std::unique_ptr<ModuleList>> module_lists_;
+  // Tables by build-id, or by path without one
+  std::unordered_map<std::string, std::unique_ptr<UnwindTable>> tables_;
+};
+}  // namespace unwind
+}  // namespace kwai
@@ -30,6 +30,7 @@
 #include <unwindstack/ElfInterface.h>
 #include <unwindstack/Log.h>
 #include <unwindstack/Regs.h>
+#include <unwindstack/SymbolIndex.h>
 
 #include "DwarfDebugFrame.h"
 #include "DwarfEhFrame.h"
@@ -477,7 +478,40 @@ bool ElfInterface::GetFunctionNameWithTemplate(uint64_t addr, std::string* name,
     return false;
   }
 
+  // Tables are searched in order, the first function at an address wins.
+  if (symbol_index_ == nullptr) {
+    std::string key = GetBuildID();
+    if (!key.empty()) {
+      for (const auto symbol : symbols_) {
+        symbol->AppendKey(&key);
+      }
+    }
+    symbol_index_ = SymbolIndex::Get(key, [this](std::vector<SymbolIndex::Func>* funcs) {
+      bool complete = true;
+      for (const auto symbol : symbols_) {
+        if (!symbol->ReadFuncs<SymType>(memory_, funcs)) {
+          complete = false;
+        }
+      }
+      return complete;
+    });
+  }
+  if (symbol_index_ != nullptr) {
+    if (symbol_index_->GetName(addr, name, func_offset)) {
+      return true;
+    }
+    if (symbol_index_->Complete()) {
+      return false;
+    }
+  }
+
+  // The index lacks what it couldn't read, e.g. of a truncated table. Only
+  // the tables not known to be fully indexed are searched the old way, an
+  // index shared with or loaded for another ELF leaves all of them unknown.
   for (const auto symbol : symbols_) {
+    if (symbol_index_ != nullptr && symbol->Indexed()) {
+      continue;
+    }
     if (symbol->GetName<SymType>(addr, memory_, name, func_offset)) {
       return true;
     }
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <kwai_util/kwai_macros.h>
+#include <unwindstack/SymbolIndex.h>
+
+namespace unwindstack {
+
+static constexpr uint32_t kIndexMagic = 0x4959534b;  // "KSYI"
+static constexpr uint32_t kIndexVersion = 3;
+
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t names_size;
+  uint32_t key_size;
+  uint32_t flags;
+};
+
+// All symbol tables were read completely
+static constexpr uint32_t kIndexComplete = 1;
+
+static size_t Align8(size_t size) {
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+// Sizes of the parts after the header, 0 if they overflow
+static size_t IndexSize(size_t count, size_t names_size, size_t key_size) {
+  size_t entries = (count + 1) * (sizeof(uint64_t) + 2 * sizeof(uint32_t));
+  if (count >= UINT32_MAX || names_size > UINT32_MAX || key_size > UINT32_MAX) {
+    return 0;
+  }
+  return sizeof(IndexHeader) + Align8(key_size) + entries + names_size;
+}
+
+SymbolIndex::~SymbolIndex() {
+  if (mapping_ != nullptr) {
+    munmap(mapping_, size_);
+  }
+}
+
+std::unique_ptr<SymbolIndex> SymbolIndex::Create(std::vector<Func>* funcs,
+                                                 const std::string& key, bool complete) {
+  funcs->erase(std::remove_if(funcs->begin(), funcs->end(),
+                              [](const Func& func) { return func.size == 0; }),
+               funcs->end());
+  std::stable_sort(funcs->begin(), funcs->end(),
+                   [](const Func& a, const Func& b) { return a.addr < b.addr; });
+  funcs->erase(std::unique(funcs->begin(), funcs->end(),
+                           [](const Func& a, const Func& b) { return a.addr == b.addr; }),
+               funcs->end());
+
+  size_t names_size = 0;
+  for (const auto& func : *funcs) {
+    names_size += func.name.size() + 1;
+  }
+  size_t size = IndexSize(funcs->size(), names_size, key.size());
+  if (size == 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<SymbolIndex> index(new SymbolIndex());
+  index->buffer_.resize(Align8(size) / sizeof(uint64_t));
+  auto* data = reinterpret_cast<uint8_t*>(index->buffer_.data());
+  IndexHeader header = {kIndexMagic, kIndexVersion, static_cast<uint32_t>(funcs->size()),
+                        static_cast<uint32_t>(names_size),
+                        static_cast<uint32_t>(key.size()), complete ? kIndexComplete : 0};
+  memcpy(data, &header, sizeof(header));
+  memcpy(data + sizeof(header), key.data(), key.size());
+
+  auto* addrs = reinterpret_cast<uint64_t*>(data + sizeof(header) + Align8(key.size()));
+  auto* infos = reinterpret_cast<FuncInfo*>(addrs + funcs->size() + 1);
+  auto* names = reinterpret_cast<char*>(infos + funcs->size() + 1);
+  std::vector<uint32_t> name_offsets;
+  name_offsets.reserve(funcs->size());
+  uint32_t name_offset = 0;
+  for (const auto& func : *funcs) {
+    name_offsets.push_back(name_offset);
+    memcpy(names + name_offset, func.name.c_str(), func.name.size() + 1);
+    name_offset += func.name.size() + 1;
+  }
+
+  // Node k has children 2k and 2k + 1, an in-order walk visits the sorted
+  // functions in turn
+  size_t next = 0;
+  std::function<void(size_t)> fill = [&](size_t k) {
+    if (k > funcs->size()) {
+      return;
+    }
+    fill(2 * k);
+    addrs[k] = (*funcs)[next].addr;
+    infos[k] = {(*funcs)[next].size, name_offsets[next]};
+    next++;
+    fill(2 * k + 1);
+  };
+  fill(1);
+
+  index->data_ = data;
+  index->size_ = size;
+  if (!index->Parse(key)) {
+    return nullptr;
+  }
+  return index;
+}
+
+// Check the layout before any lookup, the file may be truncated or stale
+bool SymbolIndex::Parse(const std::string& key) {
+  IndexHeader header;
+  if (size_ < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data_, sizeof(header));
+  if (header.magic != kIndexMagic || header.version != kIndexVersion ||
+      header.key_size != key.size() || memcmp(data_ + sizeof(header), key.data(), key.size()) != 0 ||
+      IndexSize(header.count, header.names_size, header.key_size) != size_) {
+    return false;
+  }
+
+  addrs_ = reinterpret_cast<const uint64_t*>(data_ + sizeof(header) + Align8(key.size()));
+  infos_ = reinterpret_cast<const FuncInfo*>(addrs_ + header.count + 1);
+  names_ = reinterpret_cast<const char*>(infos_ + header.count + 1);
+  count_ = header.count;
+  names_size_ = header.names_size;
+  complete_ = (header.flags & kIndexComplete) != 0;
+  if (count_ != 0 && (names_size_ == 0 || names_[names_size_ - 1] != '\0')) {
+    return false;
+  }
+  for (size_t k = 1; k <= count_; k++) {
+    if (infos_[k].name >= names_size_) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::unique_ptr<SymbolIndex> SymbolIndex::Load(const std::string& path,
+                                               const std::string& key) {
+  int fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd == -1) {
+    return nullptr;
+  }
+  struct stat st;
+  void* mapping = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::unique_ptr<SymbolIndex> index(new SymbolIndex());
+  index->mapping_ = mapping;
+  index->data_ = static_cast<const uint8_t*>(mapping);
+  index->size_ = st.st_size;
+  if (!index->Parse(key)) {
+    return nullptr;
+  }
+  return index;
+}
+
+// Written aside and renamed, a process reading the index never sees half of it
+bool SymbolIndex::Save(const std::string& path) const {
+  std::string temp_path = path + "." + std::to_string(getpid()) + ".tmp";
+  int fd = TEMP_FAILURE_RETRY(
+      open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+  if (fd == -1) {
+    return false;
+  }
+  size_t written = 0;
+  while (written < size_) {
+    ssize_t bytes = TEMP_FAILURE_RETRY(write(fd, data_ + written, size_ - written));
+    if (bytes <= 0) {
+      break;
+    }
+    written += bytes;
+  }
+  close(fd);
+  if (written != size_ || rename(temp_path.c_str(), path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool SymbolIndex::GetName(uint64_t addr, std::string* name, uint64_t* func_offset) const {
+  // Go right past every address not above |addr|, the last of them is the
+  // node of the last right turn: drop the trailing left turns and it
+  size_t k = 1;
+  while (k <= count_) {
+    // The 8 nodes three levels down are adjacent, fetch them ahead. A
+    // prefetch past the end never faults.
+    uintptr_t ahead = reinterpret_cast<uintptr_t>(addrs_) + (k << 6);
+    __builtin_prefetch(reinterpret_cast<const void*>(ahead));
+    k = 2 * k + (addrs_[k] <= addr);
+  }
+  k >>= __builtin_ffsll(k);
+  if (k == 0 || addr - addrs_[k] >= infos_[k].size) {
+    return false;
+  }
+  *name = names_ + infos_[k].name;
+  *func_offset = addr - addrs_[k];
+  return true;
+}
+
+static std::mutex* g_indices_lock = new std::mutex;
+static std::unordered_map<std::string, std::shared_ptr<const SymbolIndex>>* g_indices =
+    new std::unordered_map<std::string, std::shared_ptr<const SymbolIndex>>;
+static std::string* g_cache_dir = new std::string;
+
+static std::string IndexPath(const std::string& dir, const std::string& key) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string path = dir + "/";
+  for (unsigned char c : key) {
+    path += kHexDigits[c >> 4];
+    path += kHexDigits[c & 0xf];
+  }
+  return path + ".symidx";
+}
+
+std::shared_ptr<const SymbolIndex> SymbolIndex::Get(
+    const std::string& key, const std::function<bool(std::vector<Func>*)>& read_funcs) {
+  std::vector<Func> funcs;
+  if (key.empty()) {
+    bool complete = read_funcs(&funcs);
+    return Create(&funcs, key, complete);
+  }
+
+  std::string cache_dir;
+  {
+    std::lock_guard<std::mutex> guard(*g_indices_lock);
+    auto it = g_indices->find(key);
+    if (it != g_indices->end()) {
+      return it->second;
+    }
+    cache_dir = *g_cache_dir;
+  }
+
+  // Built without the lock, threads racing on a new key build it twice
+  std::shared_ptr<const SymbolIndex> index;
+  if (!cache_dir.empty()) {
+    index = Load(IndexPath(cache_dir, key), key);
+  }
+  if (index == nullptr) {
+    bool complete = read_funcs(&funcs);
+    std::unique_ptr<SymbolIndex> created = Create(&funcs, key, complete);
+    if (created != nullptr && !cache_dir.empty()) {
+      created->Save(IndexPath(cache_dir, key));
+    }
+    index = std::move(created);
+  }
+  if (index == nullptr) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> guard(*g_indices_lock);
+  return g_indices->emplace(key, index).first->second;
+}
+
+KWAI_EXPORT void SymbolIndex::SetCacheDir(const std::string& dir) {
+  std::lock_guard<std::mutex> guard(*g_indices_lock);
+  *g_cache_dir = dir;
+}
+
+}  // namespace unwindstack
@@ -36,6 +36,11 @@ Symbols::Symbols(uint64_t offset, uint64_t size, uint64_t entry_size, uint64_t s
       str_offset_(str_offset),
       str_end_(str_offset_ + str_size) {}
 
+void Symbols::AppendKey(std::string* key) const {
+  const uint64_t fields[] = {offset_, count_, entry_size_, str_offset_, str_end_};
+  key->append(reinterpret_cast<const char*>(fields), sizeof(fields));
+}
+
 template <typename SymType>
 static bool IsFunc(const SymType* entry) {
   return entry->st_shndx != SHN_UNDEF && ELF32_ST_TYPE(entry->st_info) == STT_FUNC;
@@ -169,10 +174,46 @@ bool Symbols::GetGlobal(Memory* elf_memory, const std::string& name, uint64_t* m
   return false;
 }
 
+template <typename SymType>
+bool Symbols::ReadFuncs(Memory* elf_memory, std::vector<SymbolIndex::Func>* funcs) {
+  bool complete = true;
+  for (size_t symbol_idx = 0; symbol_idx < count_;) {
+    // Read in batches like BuildRemapTable, bypassing the cache.
+    uint8_t buffer[1024];
+    size_t read = std::min<size_t>(sizeof(buffer), (count_ - symbol_idx) * entry_size_);
+    size_t size = elf_memory->Read(offset_ + symbol_idx * entry_size_, buffer, read);
+    if (size < read) {
+      complete = false;
+    }
+    if (size < sizeof(SymType)) {
+      break;  // Stop processing, something looks like it is corrupted.
+    }
+    for (size_t offset = 0; offset + sizeof(SymType) <= size; offset += entry_size_, symbol_idx++) {
+      SymType sym;
+      memcpy(&sym, &buffer[offset], sizeof(SymType));  // Copy to ensure alignment.
+      uint64_t str = str_offset_ + sym.st_name;
+      if (!IsFunc(&sym) || sym.st_size == 0 || str >= str_end_) {
+        continue;
+      }
+      SymbolIndex::Func func{};
+      func.addr = sym.st_value;
+      func.size = static_cast<uint32_t>(sym.st_size);
+      if (elf_memory->ReadString(str, &func.name, str_end_ - str)) {
+        funcs->push_back(std::move(func));
+      }
+    }
+  }
+  indexed_ = complete;
+  return complete;
+}
+
 // Instantiate all of the needed template functions.
 template bool Symbols::GetName<Elf32_Sym>(uint64_t, Memory*, std::string*, uint64_t*);
 template bool Symbols::GetName<Elf64_Sym>(uint64_t, Memory*, std::string*, uint64_t*);
 
 template bool Symbols::GetGlobal<Elf32_Sym>(Memory*, const std::string&, uint64_t*);
 template bool Symbols::GetGlobal<Elf64_Sym>(Memory*, const std::string&, uint64_t*);
+
+template bool Symbols::ReadFuncs<Elf32_Sym>(Memory*, std::vector<SymbolIndex::Func>*);
+template bool Symbols::ReadFuncs<Elf64_Sym>(Memory*, std::vector<SymbolIndex::Func>*);
 }  // namespace unwindstack
@@ -22,6 +22,9 @@
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
+
+#include <unwindstack/SymbolIndex.h>
 
 namespace unwindstack {
 
@@ -46,6 +49,19 @@ class Symbols {
   template <typename SymType>
   bool GetGlobal(Memory* elf_memory, const std::string& name, uint64_t* memory_address);
 
+  // Append all function symbols with their names, for a SymbolIndex. Return
+  // false if the table could not be read completely, e.g. it is truncated.
+  template <typename SymType>
+  bool ReadFuncs(Memory* elf_memory, std::vector<SymbolIndex::Func>* funcs);
+
+  // Whether ReadFuncs read the whole table, a miss in its index is final then.
+  bool Indexed() const { return indexed_; }
+
+  // Append where the table and its strings are in the ELF, for the key of a
+  // SymbolIndex. It tells apart ELFs sharing a build-id, like a stripped and
+  // an unstripped copy, or the .gnu_debugdata of an ELF and the ELF itself.
+  void AppendKey(std::string* key) const;
+
   void ClearCache() {
     symbols_.clear();
     remap_.reset();
@@ -66,6 +82,7 @@ class Symbols {
   const uint64_t entry_size_;
   const uint64_t str_offset_;
   const uint64_t str_end_;
+  bool indexed_ = false;
 
   std::unordered_map<uint32_t, Info> symbols_;  // Cache of read symbols (keyed by symbol index).
   std::optional<std::vector<uint32_t>> remap_;  // Indices of function symbols sorted by address.
@@ -33,6 +33,7 @@ namespace unwindstack {
 // Forward declarations.
 class Memory;
 class Regs;
+class SymbolIndex;
 class Symbols;
 
 struct LoadInfo {
@@ -181,6 +182,8 @@ class ElfInterface {
   ElfInterface* gnu_debugdata_interface_ = nullptr;
 
   std::vector<Symbols*> symbols_;
+  // Function symbols of all of symbols_, read on the first lookup.
+  std::shared_ptr<const SymbolIndex> symbol_index_;
   std::vector<std::pair<uint64_t, uint64_t>> strtabs_;
 };
 
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#ifndef _LIBUNWINDSTACK_SYMBOL_INDEX_H
+#define _LIBUNWINDSTACK_SYMBOL_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace unwindstack {
+
+// Function symbols of an ELF, read once from its symbol tables. Addresses are
+// kept in Eytzinger (breadth first) order, so a lookup walks down one cache
+// friendly array and never reads the ELF again. Indices are shared by all Elf
+// objects with the same key, the build-id and where the symbol tables are, and
+// can be saved to a cache directory and mapped on the next start instead of
+// reading the symbol tables again.
+class SymbolIndex {
+ public:
+  struct Func {
+    uint64_t addr;
+    uint32_t size;
+    std::string name;
+  };
+
+  ~SymbolIndex();
+
+  // Entries with the same address keep the first function, zero sized ones
+  // are dropped, like Symbols never matches them. |complete| tells whether
+  // |funcs| are all the functions of the ELF.
+  static std::unique_ptr<SymbolIndex> Create(std::vector<Func>* funcs, const std::string& key,
+                                             bool complete);
+  // Null if the file is not an index of |key|.
+  static std::unique_ptr<SymbolIndex> Load(const std::string& path, const std::string& key);
+  bool Save(const std::string& path) const;
+
+  bool GetName(uint64_t addr, std::string* name, uint64_t* func_offset) const;
+
+  size_t NumFuncs() const { return count_; }
+  // A miss is final, no symbol table was cut short while read
+  bool Complete() const { return complete_; }
+  size_t Bytes() const { return size_; }
+
+  // Index of |key| shared by the process, built with |read_funcs| the first
+  // time, or loaded from the cache directory. An empty key, of an ELF without
+  // build-id, gets an index of its own. |read_funcs| returns whether it read
+  // all functions.
+  static std::shared_ptr<const SymbolIndex> Get(
+      const std::string& key, const std::function<bool(std::vector<Func>*)>& read_funcs);
+  // Directory indices are saved to and loaded from, empty to disable.
+  static void SetCacheDir(const std::string& dir);
+
+ private:
+  struct FuncInfo {
+    uint32_t size;
+    uint32_t name;
+  };
+
+  SymbolIndex() = default;
+  bool Parse(const std::string& key);
+
+  // The file layout, also in memory: header, key, addresses and infos
+  // in Eytzinger order from index 1, then the names.
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  std::vector<uint64_t> buffer_;
+  void* mapping_ = nullptr;
+
+  const uint64_t* addrs_ = nullptr;
+  const FuncInfo* infos_ = nullptr;
+  const char* names_ = nullptr;
+  uint32_t count_ = 0;
+  uint32_t names_size_ = 0;
+  bool complete_ = false;
+};
+
+}  // namespace unwindstack
+
+#endif  // _LIBUNWINDSTACK_SYMBOL_INDEX_H
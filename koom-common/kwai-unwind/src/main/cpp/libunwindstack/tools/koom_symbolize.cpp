@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+// Host batch symbolizer for native leak reports recorded with offline symbolic:
+// every frame line carries "pc <rel_pc>" and "(BuildId: <hex>)". Unstripped
+// libraries under LIB_DIR are indexed by build-id, then frames are grouped by
+// library and resolved by parallel workers, one library per worker at a time,
+// each distinct rel_pc once.
+
+#include <cxxabi.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <unwindstack/Elf.h>
+#include <unwindstack/Memory.h>
+
+struct Frame {
+  size_t line;
+  uint64_t rel_pc;
+  std::string build_id;
+};
+
+static std::string ToHex(const std::string& bytes) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(bytes.size() * 2);
+  for (unsigned char c : bytes) {
+    hex += kHexDigits[c >> 4];
+    hex += kHexDigits[c & 0xf];
+  }
+  return hex;
+}
+
+static void ListFiles(const std::string& dir, std::vector<std::string>* files) {
+  DIR* d = opendir(dir.c_str());
+  if (d == nullptr) {
+    return;
+  }
+  while (dirent* entry = readdir(d)) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+      continue;
+    }
+    std::string path = dir + "/" + entry->d_name;
+    struct stat st;
+    if (lstat(path.c_str(), &st) == -1) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      ListFiles(path, files);
+    } else if (S_ISREG(st.st_mode) && st.st_size > 0) {
+      files->push_back(path);
+    }
+  }
+  closedir(d);
+}
+
+// Run |work(index)| for index in [0, count) on |num_workers| threads.
+template <typename W>
+static void ParallelFor(size_t count, size_t num_workers, W work) {
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next.fetch_add(1)) < count;) {
+      work(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_workers; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// Parse "pc <hex>" and "(BuildId: <hex>)" out of a frame line.
+static bool ParseFrame(const std::string& line, Frame* frame) {
+  size_t pc = line.find(" pc ");
+  size_t build_id = line.find("(BuildId: ");
+  if (pc == std::string::npos || build_id == std::string::npos) {
+    return false;
+  }
+  char* end;
+  frame->rel_pc = strtoull(line.c_str() + pc + 4, &end, 16);
+  if (end == line.c_str() + pc + 4) {
+    return false;
+  }
+  size_t start = build_id + strlen("(BuildId: ");
+  size_t close = line.find(')', start);
+  if (close == std::string::npos || close == start) {
+    return false;
+  }
+  frame->build_id = line.substr(start, close - start);
+  return true;
+}
+
+static std::string FormatFunction(const std::string& name, uint64_t offset) {
+  char* demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, nullptr);
+  std::string result = demangled != nullptr ? demangled : name;
+  free(demangled);
+  if (offset != 0) {
+    result += "+" + std::to_string(offset);
+  }
+  return result;
+}
+
+int main(int argc, char** argv) {
+  size_t num_workers = std::max(1U, std::thread::hardware_concurrency());
+  int opt;
+  while ((opt = getopt(argc, argv, "j:")) != -1) {
+    if (opt != 'j' || (num_workers = strtoul(optarg, nullptr, 10)) == 0) {
+      optind = argc + 1;
+      break;
+    }
+  }
+  if (optind != argc - 1 && optind != argc - 2) {
+    printf("Usage: koom_symbolize [-j WORKERS] <LIB_DIR> [<REPORT>]\n");
+    printf("  Symbolize the frames of a native leak report read from REPORT or stdin\n");
+    printf("  against the unstripped libraries under LIB_DIR, matched by build-id.\n");
+    printf("  Resolved frames get \" (function+offset)\" appended, other lines are\n");
+    printf("  copied unchanged.\n");
+    return 1;
+  }
+  auto begin = std::chrono::steady_clock::now();
+
+  // Index libraries by build-id.
+  std::vector<std::string> files;
+  ListFiles(argv[optind], &files);
+  std::vector<std::string> build_ids(files.size());
+  ParallelFor(files.size(), num_workers, [&](size_t i) {
+    unwindstack::Elf elf(unwindstack::Memory::CreateFileMemory(files[i], 0).release());
+    if (elf.Init() && elf.valid()) {
+      build_ids[i] = ToHex(elf.GetBuildID());
+    }
+  });
+  std::unordered_map<std::string, std::string> libraries;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (!build_ids[i].empty()) {
+      libraries.emplace(build_ids[i], files[i]);
+    }
+  }
+
+  // Read the report and collect the frames.
+  std::ifstream file;
+  if (optind == argc - 2) {
+    file.open(argv[argc - 1]);
+    if (!file) {
+      printf("Cannot open %s\n", argv[argc - 1]);
+      return 1;
+    }
+  }
+  std::istream& input = optind == argc - 2 ? file : std::cin;
+  std::vector<std::string> lines;
+  std::vector<Frame> frames;
+  for (std::string line; std::getline(input, line);) {
+    Frame frame;
+    if (ParseFrame(line, &frame) && libraries.count(frame.build_id)) {
+      frame.line = lines.size();
+      frames.push_back(std::move(frame));
+    }
+    lines.push_back(std::move(line));
+  }
+
+  // Group by library, sorted by rel_pc so repeated pcs are adjacent.
+  std::sort(frames.begin(), frames.end(), [](const Frame& a, const Frame& b) {
+    return a.build_id != b.build_id ? a.build_id < b.build_id : a.rel_pc < b.rel_pc;
+  });
+  std::vector<size_t> groups;
+  for (size_t i = 0; i < frames.size(); i++) {
+    if (i == 0 || frames[i].build_id != frames[i - 1].build_id) {
+      groups.push_back(i);
+    }
+  }
+  groups.push_back(frames.size());
+
+  std::vector<std::string> symbols(lines.size());
+  std::atomic<size_t> num_lookups(0);
+  ParallelFor(groups.size() - 1, num_workers, [&](size_t group) {
+    size_t start = groups[group];
+    size_t end = groups[group + 1];
+    const std::string& path = libraries.at(frames[start].build_id);
+    unwindstack::Elf elf(unwindstack::Memory::CreateFileMemory(path, 0).release());
+    if (!elf.Init() || !elf.valid()) {
+      return;
+    }
+    std::string symbol;
+    for (size_t i = start; i < end; i++) {
+      if (i == start || frames[i].rel_pc != frames[i - 1].rel_pc) {
+        std::string name;
+        uint64_t offset;
+        symbol = elf.GetFunctionName(frames[i].rel_pc, &name, &offset)
+                     ? FormatFunction(name, offset)
+                     : "";
+        num_lookups++;
+      }
+      symbols[frames[i].line] = symbol;
+    }
+  });
+
+  for (size_t i = 0; i < lines.size(); i++) {
+    if (symbols[i].empty()) {
+      printf("%s\n", lines[i].c_str());
+    } else {
+      printf("%s (%s)\n", lines[i].c_str(), symbols[i].c_str());
+    }
+  }
+
+  auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin);
+  fprintf(stderr, "%zu libraries indexed, %zu frames, %zu lookups, %.1f ms\n", libraries.size(),
+          frames.size(), num_lookups.load(), elapsed.count());
+  return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+package com.kwai.koom.nativeoom.leakmonitor
+
+import androidx.annotation.Keep
+
+/**
+ * Call site among the ones allocating the most native bytes since LeakMonitor
+ * started. Counts are estimated from sampled allocations above the monitor
+ * threshold.
+ *
+ * @param allocatedBytes Bytes allocated, over estimated by at most [error]
+ * @param liveBytes Bytes allocated and not freed yet, never under estimated
+ */
+@Keep
+class HeavyHitter(val allocatedBytes: Long,
+  val error: Long,
+  val liveBytes: Long,
+  val frames: Array<FrameInfo>) {
+  override fun toString(): String = StringBuilder().apply {
+    append("AllocatedSize: $allocatedBytes Byte (error $error)\n")
+    append("LiveSize: $liveBytes Byte\n")
+    append("Backtrace:\n")
+
+    for ((index, line) in frames.withIndex()) {
+      append("#$index pc $line\n")
+    }
+  }.toString()
+}
@@ -52,16 +52,68 @@ object LeakMonitor : LoopMonitor<LeakMonitorConfig>() {
   @JvmStatic
   private external fun nativeSetMonitorThreshold(size: Int)
 
+  @JvmStatic
+  private external fun nativeSetMonitorSampleInterval(interval: Int)
+
+  @JvmStatic
+  private external fun nativeSetMonitorAsyncRecord(enable: Boolean)
+
+  @JvmStatic
+  private external fun nativeSetMonitorOfflineSymbolic(enable: Boolean)
+
+  @JvmStatic
+  private external fun nativeSetMonitorScanMode(mode: Int)
+
+  @JvmStatic
+  private external fun nativeSetMonitorCallerFilter(patterns: Array<String>,
+    include: Boolean): Boolean
+
+  @JvmStatic
+  private external fun nativeSetMonitorIncrementalScan(ageScans: Int, agedScanInterval: Int)
+
+  @JvmStatic
+  private external fun nativeSetMonitorUnwindCache(depth: Int)
+
+  @JvmStatic
+  private external fun nativeGetScanStats(): LongArray
+
+  @JvmStatic
+  private external fun nativeSetMonitorMemoryBudget(budget: Long, policy: Int)
+
+  @JvmStatic
+  private external fun nativeGetTrackerMemory(): LongArray
+
+  @JvmStatic
+  private external fun nativeSetMonitorJournal(path: String, intervalMs: Int,
+    largeAllocThreshold: Long): Boolean
+
+  @JvmStatic
+  private external fun nativeFormatJournal(path: String): String?
+
   @JvmStatic
   private external fun nativeGetAllocIndex(): Long
 
   @JvmStatic
   private external fun nativeGetLeakAllocs(leakRecordMap: Map<String, LeakRecord>)
 
+  @JvmStatic
+  private external fun nativeGetLeakReport(): ByteArray?
+
+  @JvmStatic
+  private external fun nativeTakeHeapSnapshot(): Long
+
+  @JvmStatic
+  private external fun nativeDumpHeapProfile(path: String, baseIndex: Long): Boolean
+
+  @JvmStatic
+  private external fun nativeGetHeavyHitters(): Array<HeavyHitter>
+
   private val mIndex = AtomicInteger()
 
   private var mIsStart = false
 
+  private var mLastSessionJournal: String? = null
+
   override fun init(commonConfig: CommonConfig, monitorConfig: LeakMonitorConfig) {
     if (Build.VERSION.SDK_INT < Build.VERSION_CODES.N || !isArm64()) {
       MonitorLog.e(TAG, "Native LeakMonitor NOT running in below Android N or Arm 32 bit app")
@@ -82,14 +134,16 @@ object LeakMonitor : LoopMonitor<LeakMonitorConfig>() {
       return LoopState.Continue
     }
 
-    mutableMapOf<String, LeakRecord>()
-      .apply { nativeGetLeakAllocs(this) }
+    getLeakRecordMap()
       .also { AllocationTagLifecycleCallbacks.bindAllocationTag(it) }
       .also { MonitorLog.i(TAG, "LeakRecordMap size: ${it.size}") }
       .also { monitorConfig.leakListener.onLeak(it.values) }
     return LoopState.Continue
   }
 
+  private fun getLeakRecordMap(): Map<String, LeakRecord> =
+    nativeGetLeakReport()?.let { LeakReport.decode(it) }?.toMap() ?: emptyMap()
+
   override fun getLoopInterval() = monitorConfig.loopInterval
 
   /**
@@ -121,6 +175,22 @@ object LeakMonitor : LoopMonitor<LeakMonitorConfig>() {
       }
 
       nativeSetMonitorThreshold(monitorConfig.monitorThreshold)
+      nativeSetMonitorSampleInterval(monitorConfig.sampleInterval)
+      nativeSetMonitorAsyncRecord(monitorConfig.enableAsyncRecord)
+      nativeSetMonitorOfflineSymbolic(monitorConfig.enableOfflineSymbolic)
+      nativeSetMonitorScanMode(monitorConfig.scanMode)
+      nativeSetMonitorIncrementalScan(monitorConfig.scanAgeThreshold,
+        monitorConfig.agedScanInterval)
+      nativeSetMonitorUnwindCache(monitorConfig.unwindCacheDepth)
+      nativeSetMonitorMemoryBudget(monitorConfig.memoryBudget, monitorConfig.evictPolicy)
+      if (monitorConfig.journalPath.isNotEmpty()) {
+        if (!nativeSetMonitorJournal(monitorConfig.journalPath, monitorConfig.journalInterval,
+              monitorConfig.journalLargeAllocThreshold)) {
+          MonitorLog.e(TAG, "Open journal ${monitorConfig.journalPath} fail")
+        }
+        mLastSessionJournal = nativeFormatJournal("${monitorConfig.journalPath}.last")
+          ?.also { MonitorLog.i(TAG, "Last session journal:\n$it") }
+      }
       AllocationTagLifecycleCallbacks.register()
 
       super.startLoop(clearQueue, postAtFront, delayMillis)
@@ -160,14 +230,82 @@ object LeakMonitor : LoopMonitor<LeakMonitorConfig>() {
         MonitorLog.e(TAG, "Please first start LeakMonitor")
         return@Runnable
       }
-      mutableMapOf<String, LeakRecord>()
-        .apply { nativeGetLeakAllocs(this) }
+      getLeakRecordMap()
         .also { AllocationTagLifecycleCallbacks.bindAllocationTag(it) }
         .also { MonitorLog.i(TAG, "LeakRecordMap size: ${it.size}") }
         .also { monitorConfig.leakListener.onLeak(it.values) }
     })
   }
 
+  /**
+   * Only monitor allocations called directly from the matched modules, or only the others if
+   * [include] is false. Unmatched allocations return before unwinding, so it is cheaper than
+   * hooking more modules than needed. Takes effect immediately, without hooking again.
+   *
+   * @param patterns Library names like "libfoo" or path prefixes like "/data/app/", empty
+   * monitors all callers
+   */
+  fun setCallerFilter(patterns: Array<String>, include: Boolean = true): Boolean {
+    if (!isInitialized || !mIsStart) return false
+    return nativeSetMonitorCallerFilter(patterns, include)
+  }
+
+  /**
+   * Keep the live native heap aggregated by call site as a base of
+   * dumpHeapProfile, the latest 4 snapshots are kept.
+   *
+   * @return Alloc index of the snapshot, -1 if LeakMonitor is not started
+   */
+  fun takeHeapSnapshot(): Long {
+    if (!isInitialized || !mIsStart) return -1
+    return nativeTakeHeapSnapshot()
+  }
+
+  /**
+   * Dump the live native heap aggregated by call site to [path] in pprof
+   * format, reachable memory included. With a [baseIndex] returned by
+   * takeHeapSnapshot() only the change since that snapshot is dumped.
+   * Note: time-consuming, usually NOT run in UI thread.
+   */
+  fun dumpHeapProfile(path: String, baseIndex: Long = -1): Boolean {
+    if (!isInitialized || !mIsStart) return false
+    return nativeDumpHeapProfile(path, baseIndex)
+  }
+
+  /**
+   * Call sites allocating the most native memory, from a bounded summary
+   * updated by the allocation hooks, no heap scan is involved. Sort by
+   * liveBytes for the call sites holding the most memory.
+   *
+   * @return Sorted by allocated bytes, descending
+   */
+  fun getHeavyHitters(): List<HeavyHitter> {
+    if (!isInitialized || !mIsStart) return emptyList()
+    return nativeGetHeavyHitters().sortedByDescending { it.allocatedBytes }
+  }
+
+  /**
+   * @return Counters of the last leak check, null if LeakMonitor is not started
+   */
+  fun getScanStats(): ScanStats? {
+    if (!isInitialized || !mIsStart) return null
+    return ScanStats.fromArray(nativeGetScanStats())
+  }
+
+  /**
+   * @return Report of the journal left by the previous session, what held native memory right
+   * before it ended, null if there is none. See LeakMonitorConfig.Builder.setJournal
+   */
+  fun getLastSessionJournal(): String? = mLastSessionJournal
+
+  /**
+   * @return Memory used by leak tracking itself, null if LeakMonitor is not started
+   */
+  fun getTrackerMemory(): TrackerMemory? {
+    if (!isInitialized || !mIsStart) return null
+    return TrackerMemory.fromArray(nativeGetTrackerMemory())
+  }
+
   /**
    * Only Leak Monitor intern using
    *
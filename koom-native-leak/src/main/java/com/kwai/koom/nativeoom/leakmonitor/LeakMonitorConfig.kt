@@ -27,11 +27,47 @@ class LeakMonitorConfig(
     val ignoredSoList: Array<String>,
     val nativeHeapAllocatedThreshold: Int,
     val monitorThreshold: Int,
+    val sampleInterval: Int,
     val loopInterval: Long,
     val enableLocalSymbolic: Boolean,
+    val enableOfflineSymbolic: Boolean,
+    val enableAsyncRecord: Boolean,
+    val scanMode: Int,
+    val scanAgeThreshold: Int,
+    val agedScanInterval: Int,
+    val unwindCacheDepth: Int,
+    val memoryBudget: Long,
+    val evictPolicy: Int,
+    val journalPath: String,
+    val journalInterval: Int,
+    val journalLargeAllocThreshold: Long,
     val leakListener: LeakListener
 ) : MonitorConfig<LeakMonitor>() {
 
+  companion object {
+    const val SCAN_MODE_LIBMEMUNREACHABLE = 0
+
+    /**
+     * Scan in the app process, other threads keep running
+     */
+    const val SCAN_MODE_BUILTIN = 1
+
+    /**
+     * Scan a forked snapshot of the app process, the app only pauses for fork
+     */
+    const val SCAN_MODE_BUILTIN_FORK = 2
+
+    /**
+     * Evict the allocations recorded first
+     */
+    const val EVICT_OLDEST = 0
+
+    /**
+     * Evict the smallest allocations
+     */
+    const val EVICT_SMALLEST = 1
+  }
+
   class Builder : MonitorConfig.Builder<LeakMonitorConfig> {
     /**
      * List of so to be monitored
@@ -48,6 +84,13 @@ class LeakMonitorConfig(
      */
     private var mMonitorThreshold = 16
 
+    /**
+     * If greater than 0, only record about one allocation every sampleInterval bytes,
+     * leak size is scaled back up in LeakRecord.estimatedSize. Cheap enough to run in
+     * all sessions, e.g. 256 * 1024. Default is 0, record every allocation.
+     */
+    private var mSampleInterval = 0
+
     /**
      * If Native Heap exceed NativeHeapAllocatedThreshold will trigger leak analysis
      */
@@ -64,6 +107,67 @@ class LeakMonitorConfig(
      */
     private var mEnableLocalSymbolic = false
 
+    /**
+     * If enable offline symbolic, every frame also carries the GNU build-id of its library, so
+     * the report can be symbolized on host with koom_symbolize against unstripped libraries.
+     */
+    private var mEnableOfflineSymbolic = false
+
+    /**
+     * If enable async record, malloc/free hooks only queue events to a per-thread buffer and
+     * a background thread updates the allocation records, app threads don't contend on them.
+     */
+    private var mEnableAsyncRecord = false
+
+    /**
+     * How unreachable native memory is found, one of SCAN_MODE_*. The builtin scanner only scans
+     * the monitored allocations and doesn't need libmemunreachable, which is unavailable on some
+     * devices; it is used instead if libmemunreachable can't be loaded.
+     */
+    private var mScanMode = SCAN_MODE_LIBMEMUNREACHABLE
+
+    /**
+     * If greater than 0, allocations which survived scanAgeThreshold leak checks without being
+     * reported are only checked again every agedScanInterval checks, new allocations are checked
+     * every time. Cuts the cost of periodic checks in long sessions, e.g. 3 and 4. Default is 0,
+     * check all allocations every time. Only applies to the builtin scanner, libmemunreachable
+     * scans the whole process on every check anyway.
+     */
+    private var mScanAgeThreshold = 0
+
+    private var mAgedScanInterval = 4
+
+    /**
+     * If greater than 0, every thread remembers the frames beyond unwindCacheDepth of its last
+     * backtraces and reuses them while the outer part of its stack is unchanged, cheaper for
+     * threads allocating from the same deep call chain, e.g. decoders and render loops. Every
+     * reuse checks all outer frames are unchanged. Default is 0, no cache.
+     */
+    private var mUnwindCacheDepth = 0
+
+    /**
+     * If greater than 0, memory used by leak tracking is kept under memoryBudget bytes, records
+     * are evicted in evictPolicy order (one of EVICT_*) beyond it. Evicted allocations are no
+     * longer checked for leaks, but still counted by call site in heap profiles. Default is 0,
+     * unlimited.
+     */
+    private var mMemoryBudget = 0L
+
+    private var mEvictPolicy = EVICT_OLDEST
+
+    /**
+     * If not empty, a memory mapped journal file is kept at journalPath, it survives native OOM
+     * and lmkd kills. Allocations of at least journalLargeAllocThreshold bytes are logged as they
+     * happen, the call sites holding the most memory every journalInterval ms. On next start the
+     * previous journal is reported by LeakMonitor.getLastSessionJournal(). Default is empty, no
+     * journal.
+     */
+    private var mJournalPath = ""
+
+    private var mJournalInterval = 10_000
+
+    private var mJournalLargeAllocThreshold = 1024 * 1024L
+
     /**
      * You can receive leaks with your custom leak listener, it run in work thread.
      */
@@ -89,6 +193,10 @@ class LeakMonitorConfig(
       mMonitorThreshold = mallocThreshold
     }
 
+    fun setSampleInterval(sampleInterval: Int) = apply {
+      mSampleInterval = sampleInterval
+    }
+
     fun setLoopInterval(loopInterval: Long) = apply {
       mLoopInterval = loopInterval
     }
@@ -101,13 +209,58 @@ class LeakMonitorConfig(
       mEnableLocalSymbolic = enableLocalSymbolic
     }
 
+    fun setEnableOfflineSymbolic(enableOfflineSymbolic: Boolean) = apply {
+      mEnableOfflineSymbolic = enableOfflineSymbolic
+    }
+
+    fun setEnableAsyncRecord(enableAsyncRecord: Boolean) = apply {
+      mEnableAsyncRecord = enableAsyncRecord
+    }
+
+    fun setScanMode(scanMode: Int) = apply {
+      mScanMode = scanMode
+    }
+
+    fun setIncrementalScan(scanAgeThreshold: Int, agedScanInterval: Int) = apply {
+      mScanAgeThreshold = scanAgeThreshold
+      mAgedScanInterval = agedScanInterval
+    }
+
+    fun setUnwindCache(unwindCacheDepth: Int) = apply {
+      mUnwindCacheDepth = unwindCacheDepth
+    }
+
+    fun setMemoryBudget(memoryBudget: Long, evictPolicy: Int = EVICT_OLDEST) = apply {
+      mMemoryBudget = memoryBudget
+      mEvictPolicy = evictPolicy
+    }
+
+    fun setJournal(journalPath: String, journalInterval: Int = 10_000,
+      journalLargeAllocThreshold: Long = 1024 * 1024L) = apply {
+      mJournalPath = journalPath
+      mJournalInterval = journalInterval
+      mJournalLargeAllocThreshold = journalLargeAllocThreshold
+    }
+
     override fun build() = LeakMonitorConfig(
         selectedSoList = mSelectedSoList,
         ignoredSoList = mIgnoredSoList,
         nativeHeapAllocatedThreshold = mNativeHeapAllocatedThreshold,
         monitorThreshold = mMonitorThreshold,
+        sampleInterval = mSampleInterval,
         loopInterval = mLoopInterval,
         enableLocalSymbolic = mEnableLocalSymbolic,
+        enableOfflineSymbolic = mEnableOfflineSymbolic,
+        enableAsyncRecord = mEnableAsyncRecord,
+        scanMode = mScanMode,
+        scanAgeThreshold = mScanAgeThreshold,
+        agedScanInterval = mAgedScanInterval,
+        unwindCacheDepth = mUnwindCacheDepth,
+        memoryBudget = mMemoryBudget,
+        evictPolicy = mEvictPolicy,
+        journalPath = mJournalPath,
+        journalInterval = mJournalInterval,
+        journalLargeAllocThreshold = mJournalLargeAllocThreshold,
         leakListener = mLeakListener
     )
   }
@@ -24,8 +24,19 @@ import androidx.annotation.Keep
 @Keep
 data class LeakRecord(var index: Long,
   var size: Int,
+  var estimatedSize: Long,
   var threadName: String,
-  var frames: Array<FrameInfo>) {
+  var frames: Array<FrameInfo>,
+  var kind: Int = ALLOC_KIND_MALLOC) {
+  companion object {
+    const val ALLOC_KIND_MALLOC = 0
+    const val ALLOC_KIND_NEW = 1
+    const val ALLOC_KIND_NEW_ARRAY = 2
+    const val ALLOC_KIND_MMAP = 3
+
+    private val KIND_NAMES = arrayOf("malloc", "new", "new[]", "mmap")
+  }
+
   @JvmField
   var tag: String? = null
 
@@ -37,8 +48,10 @@ data class LeakRecord(var index: Long,
 
     if (index != other.index) return false
     if (size != other.size) return false
+    if (estimatedSize != other.estimatedSize) return false
     if (threadName != other.threadName) return false
     if (!frames.contentEquals(other.frames)) return false
+    if (kind != other.kind) return false
     if (tag != other.tag) return false
 
     return true
@@ -47,8 +60,10 @@ data class LeakRecord(var index: Long,
   override fun hashCode(): Int {
     var result = index.hashCode()
     result = 31 * result + size
+    result = 31 * result + estimatedSize.hashCode()
     result = 31 * result + threadName.hashCode()
     result = 31 * result + frames.contentHashCode()
+    result = 31 * result + kind
     result = 31 * result + (tag?.hashCode() ?: 0)
     return result
   }
@@ -56,7 +71,9 @@ data class LeakRecord(var index: Long,
   override fun toString(): String = StringBuilder().apply {
     append("Activity: $tag\n")
     append("LeakSize: $size Byte\n")
+    if (estimatedSize != size.toLong()) append("EstimatedLeakSize: $estimatedSize Byte\n")
     append("LeakThread: $threadName\n")
+    if (kind != ALLOC_KIND_MALLOC) append("AllocKind: ${KIND_NAMES.getOrElse(kind) { "$kind" }}\n")
     append("Backtrace:\n")
 
     for ((index, line) in frames.withIndex()) {
@@ -66,6 +83,7 @@ data class LeakRecord(var index: Long,
 }
 
 @Keep
-data class FrameInfo(var relPc: Long, var soName: String) {
-  override fun toString(): String = "0x${relPc.toString(16)}  $soName"
+data class FrameInfo(var relPc: Long, var soName: String, var buildId: String? = null) {
+  override fun toString(): String =
+    "0x${relPc.toString(16)}  $soName${buildId?.let { " (BuildId: $it)" } ?: ""}"
 }
\ No newline at end of file
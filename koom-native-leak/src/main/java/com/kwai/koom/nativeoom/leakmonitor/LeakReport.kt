@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+package com.kwai.koom.nativeoom.leakmonitor
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * Leak records serialized by native in one buffer, see leak_report.h for the
+ * layout. Records and strings are decoded on first access only.
+ */
+class LeakReport private constructor(private val buffer: ByteBuffer) : AbstractList<LeakRecord>() {
+  companion object {
+    private const val MAGIC = 0x50524c4b
+    private const val VERSION = 2
+    private const val NO_STRING = 0
+
+    /**
+     * Wrap a report copied out by native, the array is owned by the report.
+     *
+     * @return null if the bytes are not a supported report
+     */
+    @JvmStatic
+    fun decode(bytes: ByteArray): LeakReport? {
+      val buffer = ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN)
+      if (buffer.remaining() < 24 || buffer.getInt(0) != MAGIC
+        || buffer.getShort(4).toInt() != VERSION) {
+        return null
+      }
+      return try {
+        LeakReport(buffer)
+      } catch (e: IndexOutOfBoundsException) {
+        null
+      }
+    }
+  }
+
+  private val stringOffsets: IntArray
+  private val strings: Array<String?>
+  private val recordOffsets: IntArray
+  private val records: Array<LeakRecord?>
+
+  init {
+    val headerSize = buffer.getShort(6).toInt()
+    stringOffsets = IntArray(buffer.getInt(8))
+    recordOffsets = IntArray(buffer.getInt(12))
+    val stringsBytes = buffer.getInt(16)
+    val recordsBytes = buffer.getInt(20)
+    if (headerSize + stringsBytes + recordsBytes > buffer.limit()) {
+      throw IndexOutOfBoundsException("Truncated leak report")
+    }
+
+    // Only index the length-prefixed entries, skipping over the payload
+    var offset = headerSize
+    for (i in stringOffsets.indices) {
+      stringOffsets[i] = offset
+      offset += 4 + buffer.getInt(offset)
+    }
+    offset = headerSize + stringsBytes
+    for (i in recordOffsets.indices) {
+      recordOffsets[i] = offset
+      offset += 4 + buffer.getInt(offset)
+    }
+    strings = arrayOfNulls(stringOffsets.size)
+    records = arrayOfNulls(recordOffsets.size)
+  }
+
+  override val size: Int
+    get() = recordOffsets.size
+
+  /**
+   * Address of the leaked memory in hex, without decoding the record. Unsigned like the "%lx"
+   * keys of nativeGetLeakAllocs, a 64-bit address may have its top bit set.
+   */
+  fun address(index: Int): String =
+    java.lang.Long.toHexString(buffer.getLong(recordOffsets[index] + 4))
+
+  override fun get(index: Int): LeakRecord = records[index] ?: decodeRecord(index)
+    .also { records[index] = it }
+
+  fun toMap(): Map<String, LeakRecord> {
+    val map = LinkedHashMap<String, LeakRecord>(size)
+    for (i in indices) map[address(i)] = get(i)
+    return map
+  }
+
+  private fun decodeRecord(index: Int): LeakRecord {
+    var offset = recordOffsets[index] + 4
+    val recordEnd = offset + buffer.getInt(offset - 4)
+    offset += 8 // address
+    val allocIndex = buffer.getLong(offset)
+    val estimatedSize = buffer.getLong(offset + 8)
+    val size = buffer.getInt(offset + 16)
+    val threadName = string(buffer.getInt(offset + 20))
+    val kind = buffer.getInt(offset + 24)
+    val numFrames = buffer.getInt(offset + 28)
+    offset += 32
+    val frames = Array(numFrames) {
+      val buildId = buffer.getInt(offset + 12)
+      FrameInfo(buffer.getLong(offset), string(buffer.getInt(offset + 8)),
+        if (buildId == NO_STRING) null else string(buildId))
+        .also { offset += 16 }
+    }
+    if (offset > recordEnd) throw IndexOutOfBoundsException("Corrupted leak record $index")
+    return LeakRecord(allocIndex, size, estimatedSize, threadName, frames, kind)
+  }
+
+  private fun string(index: Int): String = strings[index] ?: run {
+    val offset = stringOffsets[index]
+    val length = buffer.getInt(offset)
+    String(buffer.array(), buffer.arrayOffset() + offset + 4, length, Charsets.UTF_8)
+  }.also { strings[index] = it }
+}
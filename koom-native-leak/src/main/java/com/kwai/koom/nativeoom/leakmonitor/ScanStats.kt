@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+package com.kwai.koom.nativeoom.leakmonitor
+
+/**
+ * Counters of the last leak check
+ *
+ * @param scanCount Checks since LeakMonitor started
+ * @param live Monitored allocations alive
+ * @param candidates Allocations checked, aged ones are skipped by incremental checks
+ * @param leaks Leaks found
+ * @param timeUs Time spent on the check
+ * @param full True if aged allocations were checked too
+ */
+data class ScanStats(val scanCount: Long,
+  val live: Long,
+  val candidates: Long,
+  val leaks: Long,
+  val timeUs: Long,
+  val full: Boolean) {
+  companion object {
+    internal fun fromArray(values: LongArray) =
+      ScanStats(values[0], values[1], values[2], values[3], values[4], values[5] != 0L)
+  }
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+package com.kwai.koom.nativeoom.leakmonitor
+
+/**
+ * Memory used by the native leak tracking itself, in bytes unless noted
+ *
+ * @param total Sum of the parts below
+ * @param records Mapped for allocation records, liveRecords of them are in use
+ * @param liveRecords Count of monitored allocations alive
+ * @param hashMap Table indexing the records by address
+ * @param stackDepot Deduplicated backtraces, numStacks of them
+ * @param numStacks Count of distinct backtraces
+ * @param eventBuffers Per-thread buffers of async record
+ * @param counters Heavy hitters summary and counters of evicted records
+ * @param budget Limit set by LeakMonitorConfig.memoryBudget, 0 if unlimited
+ * @param evictedRecords Records evicted to stay within the budget
+ * @param evictedBytes Estimated bytes of the evicted records
+ * @param droppedRecords Allocations not recorded as eviction was busy with a leak check
+ */
+data class TrackerMemory(val total: Long,
+  val records: Long,
+  val liveRecords: Long,
+  val hashMap: Long,
+  val stackDepot: Long,
+  val numStacks: Long,
+  val eventBuffers: Long,
+  val counters: Long,
+  val budget: Long,
+  val evictedRecords: Long,
+  val evictedBytes: Long,
+  val droppedRecords: Long) {
+  companion object {
+    internal fun fromArray(values: LongArray) =
+      TrackerMemory(values[0], values[1], values[2], values[3], values[4], values[5], values[6],
+        values[7], values[8], values[9], values[10], values[11])
+  }
+}
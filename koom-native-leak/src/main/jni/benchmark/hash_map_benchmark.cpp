@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+// Compare ConcurrentHashMap with LockFreeHashMap under the malloc/free
+// pattern of the leak monitor hooks: every thread keeps a window of live
+// allocations, registers a new one and unregisters the oldest one. Like a
+// real allocator, addresses of freed blocks are handed out again.
+//
+// The second table adds what a leak scan, heap profile or eviction does
+// meanwhile: a thread dumps all records every 20 ms. ConcurrentHashMap locks
+// each bucket while walking it, LockFreeHashMap walks the table without
+// blocking the hooks.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "utils/concurrent_hash_map.h"
+#include "utils/lock_free_hash_map.h"
+
+#define CONFUSE(address) (~(address))
+
+struct Record {
+  uintptr_t address;
+};
+
+static const size_t kLiveWindow = 4096;
+static const size_t kOpsPerThread = 1 << 20;
+static const size_t kDumpThreads = 4;
+
+static inline uintptr_t MakeAddress(size_t thread, size_t sequence) {
+  return (static_cast<uintptr_t>(thread + 1) << 40) | (sequence << 4);
+}
+
+class OldMap {
+ public:
+  void Put(uintptr_t key, Record *value) { map_.Put(key, std::move(value)); }
+  void Erase(uintptr_t key) { map_.Erase(key); }
+  size_t Size() { return map_.Size(); }
+
+  template <typename Predicate>
+  void Dump(Predicate &p) {
+    auto dump_func = [&](Record *&record) { p(record); };
+    map_.Dump(dump_func);
+  }
+
+ private:
+  ConcurrentHashMap<intptr_t, Record *> map_;
+};
+
+class NewMap {
+ public:
+  void Put(uintptr_t key, Record *value) { map_.Put(key, value); }
+  void Erase(uintptr_t key) { map_.Erase(key); }
+  size_t Size() { return map_.Size(); }
+
+  template <typename Predicate>
+  void Dump(Predicate &p) {
+    map_.Dump(p);
+  }
+
+ private:
+  LockFreeHashMap<Record> map_;
+};
+
+struct Result {
+  // Million Put or Erase per second
+  double ops;
+  // Mean time of a Dump, 0 if no Dump
+  double dump_ms;
+};
+
+template <typename Map>
+static Result Run(size_t num_threads, size_t live_window, bool dump) {
+  Map map;
+  std::vector<std::vector<Record>> records(num_threads,
+                                           std::vector<Record>(live_window));
+  for (size_t t = 0; t < num_threads; t++) {
+    for (size_t i = 0; i < live_window; i++) {
+      records[t][i].address = MakeAddress(t, i);
+      map.Put(CONFUSE(records[t][i].address), &records[t][i]);
+    }
+  }
+
+  std::atomic<bool> done(false);
+  double dump_ms = 0;
+  size_t num_dumps = 0;
+  std::thread dumper;
+  if (dump) {
+    dumper = std::thread([&]() {
+      std::vector<Record *> dumped;
+      auto dump_func = [&](Record *record) { dumped.push_back(record); };
+      while (!done) {
+        dumped.clear();
+        auto begin = std::chrono::steady_clock::now();
+        map.Dump(dump_func);
+        dump_ms += std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+        num_dumps++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      }
+    });
+  }
+
+  std::vector<std::thread> threads;
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      auto &window = records[t];
+      for (size_t i = live_window; i < live_window + kOpsPerThread; i++) {
+        Record &record = window[i % live_window];
+        map.Erase(CONFUSE(record.address));
+        record.address = MakeAddress(t, i % (live_window * 4));
+        map.Put(CONFUSE(record.address), &record);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+  done = true;
+  if (dump) {
+    dumper.join();
+  }
+
+  if (map.Size() != num_threads * live_window) {
+    fprintf(stderr, "unexpected size %zu\n", map.Size());
+    abort();
+  }
+
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  // One Put and one Erase per iteration
+  return {2.0 * kOpsPerThread * num_threads / seconds / 1e6,
+          num_dumps ? dump_ms / num_dumps : 0};
+}
+
+int main() {
+  printf("%-8s %20s %20s %8s\n", "threads", "ConcurrentHashMap",
+         "LockFreeHashMap", "speedup");
+  for (size_t threads : {1, 2, 4, 8, 16}) {
+    double old_ops = Run<OldMap>(threads, kLiveWindow, false).ops;
+    double new_ops = Run<NewMap>(threads, kLiveWindow, false).ops;
+    printf("%-8zu %14.2f Mop/s %14.2f Mop/s %7.2fx\n", threads, old_ops,
+           new_ops, new_ops / old_ops);
+  }
+
+  printf("\nWith a concurrent Dump, %zu threads\n", kDumpThreads);
+  printf("%-8s %28s %28s %8s\n", "live", "ConcurrentHashMap",
+         "LockFreeHashMap", "dump");
+  for (size_t live : {1 << 14, 1 << 18, 1 << 20}) {
+    auto old_result = Run<OldMap>(kDumpThreads, live / kDumpThreads, true);
+    auto new_result = Run<NewMap>(kDumpThreads, live / kDumpThreads, true);
+    printf("%-8zu %8.2f Mop/s %8.1f ms dump %8.2f Mop/s %8.1f ms dump "
+           "%7.2fx\n",
+           live, old_result.ops, old_result.dump_ms, new_result.ops,
+           new_result.dump_ms, old_result.dump_ms / new_result.dump_ms);
+  }
+  return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+// Check LockFreeHashMap against the races of the leak monitor hooks: a
+// thread frees a block and unregisters it with EraseIf, while another thread
+// has already got the same address from the allocator and registers it with
+// Put. Both use the allocation index like LeakMonitor does, so a free never
+// ends a newer allocation and a Put never replaces a newer record.
+//
+// After all threads are done, the map must hold exactly the blocks still
+// allocated, and every record created must be either in the map or handed
+// back. The exact interleaving of a Put detached under it is rare on its
+// own, so it is also staged once: the replace check of the Put waits until
+// the EraseIf is done.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils/lock_free_hash_map.h"
+
+struct Record {
+  uintptr_t address;
+  uint64_t index;
+};
+
+static const size_t kNumThreads = 8;
+static const size_t kNumAddresses = 64;
+static const size_t kHeldPerThread = 4;
+static const size_t kOpsPerThread = 1 << 18;
+static const int kRounds = 8;
+
+// A LIFO pool of addresses, a freed address is handed out again at once
+class AddressPool {
+ public:
+  explicit AddressPool(size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      free_.push_back((i + 1) << 4);
+    }
+  }
+
+  uintptr_t Get() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      return 0;
+    }
+    uintptr_t address = free_.back();
+    free_.pop_back();
+    return address;
+  }
+
+  void Put(uintptr_t address) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(address);
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<uintptr_t> free_;
+};
+
+static bool PutWhileErased() {
+  LockFreeHashMap<Record> map;
+  const uintptr_t address = 0x1000;
+  Record freed = {address, 1};
+  Record reused = {address, 3};
+  map.Put(address, &freed);
+
+  std::atomic<bool> checking(false);
+  std::atomic<bool> erased(false);
+  std::thread eraser([&]() {
+    while (!checking) {
+      sched_yield();
+    }
+    auto older_func = [](Record *record) { return record->index < 2; };
+    map.EraseIf(address, older_func);
+    erased = true;
+  });
+  auto older_func = [&](Record *record) {
+    checking = true;
+    while (!erased) {
+      sched_yield();
+    }
+    return record->index < reused.index;
+  };
+  map.Put(address, &reused, older_func);
+  eraser.join();
+
+  if (map.Find(address) != &reused || map.Size() != 1) {
+    fprintf(stderr, "put while erased: record %s, size %zu\n",
+            map.Find(address) ? "stale" : "lost", map.Size());
+    return false;
+  }
+  return true;
+}
+
+static bool RunRound() {
+  // Small enough to be rebuilt while the threads run
+  LockFreeHashMap<Record> map(16);
+  AddressPool pool(kNumAddresses);
+  std::atomic<uint64_t> next_index(1);
+  std::atomic<size_t> created(0);
+  std::atomic<size_t> released(0);
+  std::vector<std::vector<Record>> held(kNumThreads);
+
+  auto release = [&](Record *record) {
+    if (record) {
+      delete record;
+      released++;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t]() {
+      auto &blocks = held[t];
+      for (size_t i = 0; i < kOpsPerThread; i++) {
+        if (blocks.size() == kHeldPerThread || (i & 1)) {
+          if (blocks.empty()) {
+            continue;
+          }
+          // free(): the index is taken before the block goes back
+          Record block = blocks.front();
+          blocks.erase(blocks.begin());
+          uint64_t free_index = next_index++;
+          pool.Put(block.address);
+          auto older_func = [&](Record *record) {
+            return record->index < free_index;
+          };
+          release(map.EraseIf(block.address, older_func));
+          continue;
+        }
+
+        // malloc(): the index is taken after the block is got
+        uintptr_t address = pool.Get();
+        if (!address) {
+          continue;
+        }
+        uint64_t index = next_index++;
+        blocks.push_back({address, index});
+        auto *record = new Record{address, index};
+        created++;
+        auto older_func = [&](Record *old) { return old->index < index; };
+        Record *replaced = map.Put(address, record, older_func);
+        release(replaced);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  bool ok = true;
+  size_t live = 0;
+  for (auto &blocks : held) {
+    for (auto &block : blocks) {
+      live++;
+      Record *record = map.Find(block.address);
+      if (!record || record->index != block.index) {
+        fprintf(stderr, "block %#lx index %lu: %s\n",
+                static_cast<unsigned long>(block.address),
+                static_cast<unsigned long>(block.index),
+                record ? "stale record" : "no record");
+        ok = false;
+      }
+    }
+  }
+  if (map.Size() != live) {
+    fprintf(stderr, "size %zu, %zu blocks live\n", map.Size(), live);
+    ok = false;
+  }
+  // Records which are in no slot and were never handed back are lost
+  size_t in_map = created - released;
+  if (in_map != map.Size()) {
+    fprintf(stderr, "%zu records lost\n", in_map - map.Size());
+    ok = false;
+  }
+
+  map.Clear(release);
+  return ok;
+}
+
+int main() {
+  if (!PutWhileErased()) {
+    return 1;
+  }
+  for (int round = 0; round < kRounds; round++) {
+    if (!RunRound()) {
+      fprintf(stderr, "round %d failed\n", round);
+      return 1;
+    }
+  }
+  printf("%d rounds, %zu threads on %zu addresses: ok\n", kRounds,
+         kNumThreads, kNumAddresses);
+  return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+// Run HeapScanner on a synthetic heap and check its result: a linked list
+// reachable from a global (one node only referenced by an interior pointer)
+// and leaked lists whose addresses are only kept confused, like the leak
+// monitor keeps its records. Then the same with anonymous mappings, one
+// reachable from a global and leaked ones each starting a VMA.
+//
+// No reachable node may be reported. A stale copy of a leaked address (dead
+// stack, malloc metadata) legally keeps a leaked chain alive, so missed leaks
+// are only printed and must stay a minority.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "heap_scanner.h"
+
+#define CONFUSE(address) (~(address))
+
+using kwai::leak_monitor::HeapScanner;
+
+struct Node {
+  Node *next;
+  char payload[56];
+};
+
+static const size_t kLeakChainLength = 10;
+static const size_t kNumMappingLeaks = 64;
+static const size_t kPageSize = 4096;
+
+static Node *g_reachable_head;
+static void *g_reachable_mapping;
+
+static Node *NewNode(Node *next) {
+  auto *node = static_cast<Node *>(calloc(1, sizeof(Node)));
+  node->next = next;
+  return node;
+}
+
+// Leaked chains, only the confused address of every node is kept
+static void MakeLeaks(size_t num_leaks, std::vector<uintptr_t> *leaks) {
+  Node *next = nullptr;
+  for (size_t i = 0; i < num_leaks; i++) {
+    if (i % kLeakChainLength == 0) {
+      next = nullptr;
+    }
+    next = NewNode(next);
+    leaks->push_back(CONFUSE(reinterpret_cast<uintptr_t>(next)));
+  }
+}
+
+// Stale copies of node addresses left on the stack would be roots
+static __attribute__((noinline)) void ClobberStack() {
+  volatile char stack[64 * 1024];
+  for (size_t i = 0; i < sizeof(stack); i++) {
+    stack[i] = 0;
+  }
+}
+
+// A PROT_NONE page after each mapping keeps the kernel from merging them
+static void *NewMapping() {
+  auto *mapping =
+      static_cast<char *>(mmap(nullptr, 2 * kPageSize, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (mapping == MAP_FAILED) {
+    abort();
+  }
+  mprotect(mapping + kPageSize, kPageSize, PROT_NONE);
+  return mapping;
+}
+
+static void MakeMappingLeaks(std::vector<uintptr_t> *leaks) {
+  for (size_t i = 0; i < kNumMappingLeaks; i++) {
+    leaks->push_back(CONFUSE(reinterpret_cast<uintptr_t>(NewMapping())));
+  }
+}
+
+static void MakeReachable(size_t num_reachable) {
+  Node *head = nullptr;
+  for (size_t i = 0; i < num_reachable; i++) {
+    head = NewNode(head);
+  }
+  // Refer the last node through a pointer into its payload
+  if (head) {
+    Node *tail = head;
+    while (tail->next->next) {
+      tail = tail->next;
+    }
+    tail->next = reinterpret_cast<Node *>(tail->next->payload);
+  }
+  g_reachable_head = head;
+}
+
+// Not inlined, so ClobberStack in the caller clears the dead copies of
+// addresses the previous run left in this frame
+static __attribute__((noinline)) bool RunScan(
+    const char *kind, bool fork_mode, const std::vector<uintptr_t> &leaks,
+    size_t leak_size) {
+  size_t num_reachable = 0;
+  for (Node *node = g_reachable_head; node; num_reachable++) {
+    node = node->next;
+  }
+  HeapScanner scanner;
+  if (!scanner.Reserve(num_reachable + 1 + leaks.size())) {
+    return false;
+  }
+  for (Node *node = g_reachable_head; node;) {
+    auto *next = node->next;
+    scanner.AddBlock(reinterpret_cast<uintptr_t>(node), sizeof(Node));
+    // Undo the interior pointer
+    if (next && !next->next &&
+        reinterpret_cast<uintptr_t>(next) % alignof(Node)) {
+      next = reinterpret_cast<Node *>(reinterpret_cast<char *>(next) -
+                                      offsetof(Node, payload));
+    }
+    node = next;
+  }
+  if (g_reachable_mapping) {
+    scanner.AddBlock(reinterpret_cast<uintptr_t>(g_reachable_mapping),
+                     kPageSize);
+    num_reachable++;
+  }
+  for (auto leak : leaks) {
+    scanner.AddBlock(CONFUSE(leak), leak_size);
+  }
+
+  // Reserved, buffers freed by growth would keep raw addresses
+  std::vector<std::pair<uintptr_t, size_t>> unreachable;
+  unreachable.reserve(leaks.size());
+  auto begin = std::chrono::steady_clock::now();
+  if (!scanner.Scan(fork_mode, &unreachable)) {
+    fprintf(stderr, "scan fail\n");
+    return false;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  std::vector<uintptr_t> leaked;
+  leaked.reserve(leaks.size());
+  for (auto leak : leaks) {
+    leaked.push_back(CONFUSE(leak));
+  }
+  std::sort(leaked.begin(), leaked.end());
+  bool false_positive = false;
+  for (auto &block : unreachable) {
+    if (!std::binary_search(leaked.begin(), leaked.end(), block.first)) {
+      fprintf(stderr, "reachable block %p reported\n",
+              reinterpret_cast<void *>(block.first));
+      false_positive = true;
+    }
+  }
+  size_t found = unreachable.size();
+  // Raw addresses left in freed heap memory would be roots of the next scan
+  std::fill(leaked.begin(), leaked.end(), 0);
+  std::fill(unreachable.begin(), unreachable.end(),
+            std::pair<uintptr_t, size_t>());
+  if (false_positive) {
+    return false;
+  }
+
+  size_t missed = leaks.size() - found;
+  printf("%-8s %-8s %-10zu %-10zu %8zu %8zu %10.2f\n", kind,
+         fork_mode ? "fork" : "inline", num_reachable, leaks.size(), found,
+         missed,
+         std::chrono::duration<double, std::milli>(end - begin).count());
+  return missed * 2 < leaks.size();
+}
+
+int main() {
+  printf("%-8s %-8s %-10s %-10s %8s %8s %10s\n", "blocks", "mode",
+         "reachable", "leaked", "found", "missed", "time(ms)");
+  for (size_t num_reachable : {1000, 100000, 1000000}) {
+    std::vector<uintptr_t> leaks;
+    MakeLeaks(num_reachable / 10, &leaks);
+    MakeReachable(num_reachable);
+    for (bool fork_mode : {false, true}) {
+      ClobberStack();
+      if (!RunScan("malloc", fork_mode, leaks, sizeof(Node))) {
+        fprintf(stderr, "unexpected result\n");
+        abort();
+      }
+    }
+  }
+
+  // Every leaked mapping starts a line of /proc/self/maps, like the root
+  // bounds the scanner collects
+  std::vector<uintptr_t> leaks;
+  MakeMappingLeaks(&leaks);
+  MakeReachable(0);
+  g_reachable_mapping = NewMapping();
+  for (bool fork_mode : {false, true}) {
+    ClobberStack();
+    if (!RunScan("mmap", fork_mode, leaks, kPageSize)) {
+      fprintf(stderr, "unexpected result\n");
+      abort();
+    }
+  }
+  return 0;
+}
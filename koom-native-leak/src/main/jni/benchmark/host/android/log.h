@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+// The part of the NDK <android/log.h> the host benchmarks need, logs go to
+// stderr.
+
+#pragma once
+
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum android_LogPriority {
+  ANDROID_LOG_UNKNOWN = 0,
+  ANDROID_LOG_DEFAULT,
+  ANDROID_LOG_VERBOSE,
+  ANDROID_LOG_DEBUG,
+  ANDROID_LOG_INFO,
+  ANDROID_LOG_WARN,
+  ANDROID_LOG_ERROR,
+  ANDROID_LOG_FATAL,
+  ANDROID_LOG_SILENT,
+} android_LogPriority;
+
+typedef enum log_id {
+  LOG_ID_MIN = 0,
+  LOG_ID_MAIN = 0,
+  LOG_ID_RADIO = 1,
+  LOG_ID_EVENTS = 2,
+  LOG_ID_SYSTEM = 3,
+  LOG_ID_CRASH = 4,
+  LOG_ID_STATS = 5,
+  LOG_ID_SECURITY = 6,
+  LOG_ID_KERNEL = 7,
+  LOG_ID_MAX,
+  LOG_ID_DEFAULT = 0x7FFFFFFF
+} log_id_t;
+
+struct __android_log_message;
+typedef void (*__android_logger_function)(
+    const struct __android_log_message *log_message);
+typedef void (*__android_aborter_function)(const char *abort_message);
+
+int __android_log_write(int prio, const char *tag, const char *text);
+int __android_log_print(int prio, const char *tag, const char *fmt, ...);
+int __android_log_vprint(int prio, const char *tag, const char *fmt,
+                         va_list ap);
+void __android_log_assert(const char *cond, const char *tag, const char *fmt,
+                          ...) __attribute__((__noreturn__));
+int __android_log_buf_write(int bufID, int prio, const char *tag,
+                            const char *text);
+int __android_log_buf_print(int bufID, int prio, const char *tag,
+                            const char *fmt, ...);
+int __android_log_is_loggable(int prio, const char *tag, int default_prio);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+// Host stand-ins for the bionic and liblog functions the Android sources of
+// the benchmarks call.
+
+#include <android/api-level.h>
+#include <android/log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <string>
+
+static const char kPriorityChars[] = "??VDIWEFS";
+
+extern "C" int __android_log_vprint(int prio, const char *tag, const char *fmt,
+                                    va_list ap) {
+  if (prio < ANDROID_LOG_WARN) {
+    return 0;
+  }
+  fprintf(stderr, "%c/%s: ", kPriorityChars[prio & 7], tag ? tag : "");
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  return 1;
+}
+
+extern "C" int __android_log_print(int prio, const char *tag, const char *fmt,
+                                   ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int result = __android_log_vprint(prio, tag, fmt, ap);
+  va_end(ap);
+  return result;
+}
+
+extern "C" int __android_log_write(int prio, const char *tag,
+                                   const char *text) {
+  return __android_log_print(prio, tag, "%s", text);
+}
+
+extern "C" int __android_log_buf_write(int, int prio, const char *tag,
+                                       const char *text) {
+  return __android_log_write(prio, tag, text);
+}
+
+extern "C" int __android_log_buf_print(int, int prio, const char *tag,
+                                       const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int result = __android_log_vprint(prio, tag, fmt, ap);
+  va_end(ap);
+  return result;
+}
+
+extern "C" void __android_log_assert(const char *cond, const char *tag,
+                                     const char *fmt, ...) {
+  fprintf(stderr, "F/%s: assertion failed: %s ", tag ? tag : "",
+          cond ? cond : "");
+  if (fmt) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+  }
+  fputc('\n', stderr);
+  abort();
+}
+
+extern "C" int __android_log_is_loggable(int prio, const char *,
+                                         int default_prio) {
+  return prio >= default_prio;
+}
+
+extern "C" int android_get_device_api_level() { return __ANDROID_API_O__; }
+
+extern "C" const char *__gnu_basename(const char *path) {
+  const char *last_slash = strrchr(path, '/');
+  return last_slash ? last_slash + 1 : path;
+}
+
+extern "C" ssize_t kwai_process_vm_readv(pid_t pid, const struct iovec *lvec,
+                                         unsigned long liovcnt,
+                                         const struct iovec *rvec,
+                                         unsigned long riovcnt,
+                                         unsigned long flags) {
+  return process_vm_readv(pid, lvec, liovcnt, rvec, riovcnt, flags);
+}
+
+namespace android {
+namespace base {
+// android-base/file.cpp pulls in android-base logging
+bool ReadFileToString(const std::string &path, std::string *content,
+                      bool /* follow_symlinks */) {
+  content->clear();
+  FILE *file = fopen(path.c_str(), "re");
+  if (!file) {
+    return false;
+  }
+  char buffer[4096];
+  size_t bytes;
+  while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    content->append(buffer, bytes);
+  }
+  bool success = !ferror(file);
+  fclose(file);
+  return success;
+}
+}  // namespace base
+}  // namespace android
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+// Compare the nested loop leak matching GetLeakAllocs used before with the
+// RangeIndex lookup on synthetic heaps: live records are scattered over a
+// heap, every tenth of them is unreachable, some unreachable blocks are
+// reported with a larger size than the record.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "utils/range_index.h"
+
+struct Record {
+  uintptr_t address;
+  size_t size;
+};
+
+// The nested loop is skipped above this many record/block pairs
+static const double kMaxNestedPairs = 2e10;
+
+static void MakeHeap(size_t num_records, std::vector<Record> *records,
+                     std::vector<std::pair<uintptr_t, size_t>> *unreachable) {
+  std::mt19937_64 random(num_records);
+  uintptr_t address = 0x7000000000;
+  for (size_t i = 0; i < num_records; i++) {
+    size_t size = 16 + random() % 4096;
+    records->push_back({address, size});
+    if (i % 10 == 0) {
+      unreachable->emplace_back(address, size + (i % 20 ? 0 : 64));
+    }
+    // Keep a gap so enlarged blocks never cover the next record
+    address += size + 64 + random() % 256;
+  }
+  std::shuffle(records->begin(), records->end(), random);
+  std::shuffle(unreachable->begin(), unreachable->end(), random);
+}
+
+static size_t NestedMatch(
+    const std::vector<Record> &records,
+    const std::vector<std::pair<uintptr_t, size_t>> &unreachable) {
+  size_t leaks = 0;
+  for (auto &live : records) {
+    for (auto &block : unreachable) {
+      if (live.address == block.first ||
+          (live.address >= block.first &&
+           live.address + live.size <= block.first + block.second)) {
+        leaks++;
+        break;
+      }
+    }
+  }
+  return leaks;
+}
+
+static size_t IndexMatch(
+    const std::vector<Record> &records,
+    std::vector<std::pair<uintptr_t, size_t>> *unreachable) {
+  size_t leaks = 0;
+  RangeIndex index(unreachable);
+  for (auto &live : records) {
+    if (index.Match(live.address, live.size)) {
+      leaks++;
+    }
+  }
+  return leaks;
+}
+
+template <typename F>
+static double TimeMs(F func, size_t *result) {
+  auto begin = std::chrono::steady_clock::now();
+  *result = func();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+int main() {
+  printf("%-10s %-10s %14s %14s %8s\n", "records", "unreachable", "nested(ms)",
+         "index(ms)", "leaks");
+  for (size_t num_records : {1000, 10000, 100000, 1000000}) {
+    std::vector<Record> records;
+    std::vector<std::pair<uintptr_t, size_t>> unreachable;
+    MakeHeap(num_records, &records, &unreachable);
+    size_t num_unreachable = unreachable.size();
+
+    size_t nested_leaks = 0;
+    double nested_ms = -1;
+    if (static_cast<double>(num_records) * num_unreachable <= kMaxNestedPairs) {
+      nested_ms = TimeMs([&]() { return NestedMatch(records, unreachable); },
+                         &nested_leaks);
+    }
+    size_t index_leaks = 0;
+    double index_ms =
+        TimeMs([&]() { return IndexMatch(records, &unreachable); },
+               &index_leaks);
+
+    if (index_leaks != num_unreachable ||
+        (nested_ms >= 0 && nested_leaks != index_leaks)) {
+      fprintf(stderr, "leak count mismatch %zu %zu %zu\n", num_unreachable,
+              nested_leaks, index_leaks);
+      abort();
+    }
+    if (nested_ms >= 0) {
+      printf("%-10zu %-10zu %14.2f %14.2f %8zu\n", num_records,
+             num_unreachable, nested_ms, index_ms, index_leaks);
+    } else {
+      printf("%-10zu %-10zu %14s %14.2f %8zu\n", num_records, num_unreachable,
+             "skipped", index_ms, index_leaks);
+    }
+  }
+  return 0;
+}
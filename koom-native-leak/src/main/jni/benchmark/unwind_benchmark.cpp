@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+// Cost of every unwinder KOOM ships, unwinding from the leaf of a call chain
+// of 8 to 256 frames: frame_pointer_unwind and StackTrace::FastUnwind walk
+// frame records, table_unwind the unwind tables of kwai-unwind (built before
+// timing), LocalUnwinder is libunwindstack with function names, and
+// _Unwind_Backtrace the compiler runtime's DWARF unwinder. Every thread of a
+// run unwinds its own chain at once. Unwinds run straight from the leaf, or
+// from a signal handler raised there, on the thread stack or on a
+// sigaltstack: the unwinders bounded by the stack they start on stop at the
+// signal frame there, frames tells. Results are JSON on stdout, one entry per
+// unwinder, context, depth and thread count, with the mean time and frames
+// of an unwind.
+//
+//   unwind_benchmark [MIN_MS_PER_RUN] > unwind.json
+//
+// Build with -fno-omit-frame-pointer, see CMakeLists.txt.
+
+#include <fast_unwind/fast_unwind.h>
+#include <fast_unwind/unwind_table.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unwind.h>
+#include <unwindstack/LocalUnwinder.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "utils/stack_trace.h"
+
+static const size_t kMaxFrames = 512;
+// Unwinds between clock reads
+static const int kUnwindsPerBatch = 16;
+static const size_t kAltStackSize = 256 * 1024;
+static const int kDepths[] = {8, 16, 32, 64, 128, 256};
+
+enum Unwinder {
+  kFramePointerUnwind,
+  kFastUnwind,
+  kTableUnwind,
+  kLocalUnwinder,
+  kUnwindBacktrace,
+  kNumUnwinders
+};
+
+static const char *kUnwinderNames[] = {
+    "frame_pointer_unwind", "StackTrace::FastUnwind", "table_unwind",
+    "LocalUnwinder",        "_Unwind_Backtrace",
+};
+
+enum Context { kDirect, kSignal, kSigaltstack, kNumContexts };
+
+static const char *kContextNames[] = {"direct", "signal", "sigaltstack"};
+
+struct Result {
+  uint64_t num_unwinds;
+  uint64_t num_frames;
+  std::chrono::steady_clock::duration time;
+};
+
+static Unwinder unwinder;
+static std::chrono::milliseconds min_time(50);
+static unwindstack::LocalUnwinder *local_unwinder;
+static thread_local Result result;
+
+struct BacktraceState {
+  uintptr_t *frames;
+  size_t num_frames;
+};
+
+static _Unwind_Reason_Code BacktraceCallback(_Unwind_Context *context,
+                                             void *arg) {
+  auto *state = static_cast<BacktraceState *>(arg);
+  if (state->num_frames == kMaxFrames) {
+    return _URC_END_OF_STACK;
+  }
+  state->frames[state->num_frames++] = _Unwind_GetIP(context);
+  return _URC_NO_REASON;
+}
+
+__attribute__((noinline)) static size_t Unwind(uintptr_t *frames) {
+  switch (unwinder) {
+    case kFramePointerUnwind:
+      return frame_pointer_unwind(frames, kMaxFrames);
+    case kFastUnwind:
+      return StackTrace::FastUnwind(frames, kMaxFrames);
+    case kTableUnwind:
+      return table_unwind(frames, kMaxFrames);
+    case kLocalUnwinder: {
+      std::vector<unwindstack::LocalFrameData> frame_data;
+      local_unwinder->Unwind(&frame_data, kMaxFrames);
+      return frame_data.size();
+    }
+    case kUnwindBacktrace: {
+      BacktraceState state = {frames, 0};
+      _Unwind_Backtrace(BacktraceCallback, &state);
+      return state.num_frames;
+    }
+    default:
+      return 0;
+  }
+}
+
+// Unwind in batches until the run is long enough
+__attribute__((noinline)) static void UnwindLoop() {
+  uintptr_t frames[kMaxFrames];
+  result = Result();
+  while (result.time < min_time) {
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < kUnwindsPerBatch; i++) {
+      result.num_frames += Unwind(frames);
+      asm volatile("" ::: "memory");
+    }
+    result.time += std::chrono::steady_clock::now() - begin;
+    result.num_unwinds += kUnwindsPerBatch;
+  }
+}
+
+static void SignalHandler(int) { UnwindLoop(); }
+
+__attribute__((noinline)) static void Leaf(Context context) {
+  if (context == kDirect) {
+    UnwindLoop();
+  } else {
+    pthread_kill(pthread_self(), SIGUSR2);
+  }
+  asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) static void Recurse(int depth, Context context) {
+  if (depth <= 1) {
+    Leaf(context);
+  } else {
+    Recurse(depth - 1, context);
+  }
+  asm volatile("" ::: "memory");
+}
+
+static void RunThread(Context context, int depth, std::atomic<int> *ready,
+                      int num_threads, Result *thread_result) {
+  std::unique_ptr<char[]> alt_stack;
+  if (context == kSigaltstack) {
+    alt_stack.reset(new char[kAltStackSize]);
+    stack_t stack = {};
+    stack.ss_sp = alt_stack.get();
+    stack.ss_size = kAltStackSize;
+    sigaltstack(&stack, nullptr);
+  }
+  // All threads unwind at once
+  ready->fetch_add(1);
+  while (ready->load() < num_threads) {
+  }
+  // Frames of the recursion, less the thread entry frames
+  Recurse(depth, context);
+  *thread_result = result;
+  if (context == kSigaltstack) {
+    stack_t stack = {};
+    stack.ss_flags = SS_DISABLE;
+    sigaltstack(&stack, nullptr);
+  }
+}
+
+static Result Run(Context context, int depth, int num_threads) {
+  std::vector<Result> results(num_threads);
+  std::vector<std::thread> threads;
+  std::atomic<int> ready(0);
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back(RunThread, context, depth, &ready, num_threads,
+                         &results[i]);
+  }
+  Result total = {};
+  for (int i = 0; i < num_threads; i++) {
+    threads[i].join();
+    total.num_unwinds += results[i].num_unwinds;
+    total.num_frames += results[i].num_frames;
+    total.time += results[i].time;
+  }
+  return total;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    min_time = std::chrono::milliseconds(atoi(argv[1]));
+  }
+  struct sigaction action = {};
+  action.sa_handler = SignalHandler;
+  action.sa_flags = SA_ONSTACK;
+  sigaction(SIGUSR2, &action, nullptr);
+
+  local_unwinder = new unwindstack::LocalUnwinder();
+  if (!local_unwinder->Init()) {
+    fprintf(stderr, "LocalUnwinder init failed\n");
+    return 1;
+  }
+  // Build the tables of the modules on the stacks before timing
+  table_unwind_start();
+  unwinder = kTableUnwind;
+  auto warm_up = min_time;
+  min_time = std::chrono::milliseconds(1);
+  for (int i = 0; i < 2; i++) {
+    for (int context = 0; context < kNumContexts; context++) {
+      Run(static_cast<Context>(context), kDepths[0], 1);
+    }
+    kwai::unwind::TableUnwinder::GetInstance().Update();
+  }
+  min_time = warm_up;
+
+  std::vector<int> thread_counts = {1};
+  int num_cpus = std::max(1U, std::thread::hardware_concurrency());
+  for (int count = 4; count < num_cpus; count *= 4) {
+    thread_counts.push_back(count);
+  }
+  if (num_cpus > 1) {
+    thread_counts.push_back(num_cpus);
+  }
+
+  printf("{\n  \"cpus\": %d,\n  \"max_frames\": %zu,\n  \"results\": [",
+         num_cpus, kMaxFrames);
+  const char *separator = "\n";
+  for (int i = 0; i < kNumUnwinders; i++) {
+    unwinder = static_cast<Unwinder>(i);
+    for (int context = 0; context < kNumContexts; context++) {
+      for (int depth : kDepths) {
+        for (int num_threads : thread_counts) {
+          Result total = Run(static_cast<Context>(context), depth, num_threads);
+          double ns =
+              std::chrono::duration<double, std::nano>(total.time).count();
+          double frames =
+              static_cast<double>(total.num_frames) / total.num_unwinds;
+          printf(
+              "%s    {\"unwinder\": \"%s\", \"context\": \"%s\", "
+              "\"depth\": %d, \"threads\": %d, \"unwinds\": %lu, "
+              "\"ns_per_unwind\": %.1f, \"frames\": %.1f, "
+              "\"ns_per_frame\": %.2f}",
+              separator, kUnwinderNames[i], kContextNames[context], depth,
+              num_threads, static_cast<unsigned long>(total.num_unwinds),
+              ns / total.num_unwinds, frames,
+              frames ? ns / total.num_frames : 0.0);
+          separator = ",\n";
+          fflush(stdout);
+        }
+      }
+    }
+  }
+  printf("\n  ]\n}\n");
+  return 0;
+}
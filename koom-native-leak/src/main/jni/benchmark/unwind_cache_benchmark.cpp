@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+// Compare the frame pointer unwind StackTrace::FastUnwind does with the
+// prefix cached one at realistic recursion depths: a thread allocates again
+// and again from the leaf of a call chain of the given depth, the inner
+// frames alternate between two leaves. In the swapped scenario the outermost
+// caller of the chain alternates too, under unchanged inner frames. Times
+// are per unwind, the cost of an empty call is subtracted. Cached
+// backtraces are checked against plain ones, stale is the share which
+// differs and must stay 0.
+//
+// Build with -fno-omit-frame-pointer, see CMakeLists.txt.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <initializer_list>
+
+#include <kwai_util/frame_pointer_unwind.h>
+
+static const size_t kMaxFrames = 32;
+static const int kIterations = 100000;
+// Allocations per visit of a leaf
+static const int kUnwindsPerLeaf = 16;
+// Best of as many runs, against noise
+static const int kRepeats = 7;
+static const size_t kCacheDepth = 4;
+
+enum Mode { kNone, kPlain, kCached, kCheck };
+
+static Mode mode;
+static uint64_t num_stale;
+static std::chrono::steady_clock::duration unwind_time;
+
+__attribute__((noinline)) static size_t Unwind(uintptr_t *frames,
+                                               uint32_t *hash) {
+  auto frame_address = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  if (mode == kNone) {
+    return 0;
+  }
+  if (mode == kPlain) {
+    return kwai::util::FramePointerUnwind<true>(frame_address, frames,
+                                                kMaxFrames, hash);
+  }
+  return kwai::util::FramePointerUnwindCached<true>(frame_address, frames,
+                                                    kMaxFrames, hash,
+                                                    kCacheDepth);
+}
+
+__attribute__((noinline)) static void Leaf() {
+  uintptr_t frames[kMaxFrames];
+  uint32_t hash;
+  size_t num_frames = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < kUnwindsPerLeaf; i++) {
+    num_frames = Unwind(frames, &hash);
+    asm volatile("" ::: "memory");
+  }
+  unwind_time += std::chrono::steady_clock::now() - begin;
+  if (mode == kCheck) {
+    uintptr_t expected[kMaxFrames];
+    uint32_t expected_hash;
+    // The plain unwind starts one frame further out
+    size_t num_expected = kwai::util::FramePointerUnwind<true>(
+        reinterpret_cast<uintptr_t>(__builtin_frame_address(0)), expected,
+        kMaxFrames - 1, &expected_hash);
+    if (num_frames != num_expected + 1 ||
+        memcmp(frames + 1, expected, num_expected * sizeof(uintptr_t)) ||
+        hash != kwai::util::StackHash(frames, num_frames)) {
+      num_stale++;
+    }
+  }
+  asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) static void OtherLeaf() {
+  Leaf();
+  asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) static void Recurse(int depth, int iteration) {
+  if (depth <= 1) {
+    iteration % 2 ? Leaf() : OtherLeaf();
+  } else {
+    Recurse(depth - 1, iteration);
+  }
+  asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) static void Outer(int depth, int iteration) {
+  Recurse(depth, iteration);
+  asm volatile("" ::: "memory");
+}
+
+__attribute__((noinline)) static void OtherOuter(int depth, int iteration) {
+  Recurse(depth, iteration);
+  asm volatile("" ::: "memory");
+}
+
+static double Run(Mode run_mode, int depth, bool swap_outer) {
+  mode = run_mode;
+  double best = 0;
+  for (int repeat = 0; repeat < kRepeats; repeat++) {
+    num_stale = 0;
+    unwind_time = unwind_time.zero();
+    kwai::util::GetUnwindPrefixCache() = kwai::util::UnwindPrefixCache();
+    for (int i = 0; i < kIterations; i++) {
+      // Both leaves see both outer callers
+      swap_outer && i / 2 % 2 ? OtherOuter(depth, i) : Outer(depth, i);
+    }
+    double time = std::chrono::duration<double, std::nano>(unwind_time).count() /
+                  kIterations / kUnwindsPerLeaf;
+    best = repeat && best < time ? best : time;
+  }
+  return best;
+}
+
+int main() {
+  printf("cache depth %zu, max %zu frames, best of %d runs of %d leaf visits, "
+         "%d unwinds each\n\n",
+         kCacheDepth, kMaxFrames, kRepeats, kIterations, kUnwindsPerLeaf);
+  printf("%-8s %-6s %9s %10s %8s %8s\n", "scenario", "depth", "plain ns",
+         "cached ns", "hits", "stale");
+  const int kDepths[] = {4, 8, 16, 32, 64};
+  for (bool swap_outer : {false, true}) {
+    for (int depth : kDepths) {
+      double calls = Run(kNone, depth, swap_outer);
+      double plain = Run(kPlain, depth, swap_outer) - calls;
+      double cached = Run(kCached, depth, swap_outer) - calls;
+      uint64_t hits = kwai::util::GetUnwindPrefixCache().hits;
+      Run(kCheck, depth, swap_outer);
+      printf("%-8s %-6d %9.1f %10.1f %7.1f%% %7.2f%%\n",
+             swap_outer ? "swapped" : "stable", depth, plain, cached,
+             100.0 * hits / kIterations / kUnwindsPerLeaf,
+             100.0 * num_stale / kIterations);
+    }
+  }
+  return 0;
+}
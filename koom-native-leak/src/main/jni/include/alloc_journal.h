@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#ifndef KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_ALLOC_JOURNAL_H_
+#define KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_ALLOC_JOURNAL_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "constants.h"
+
+namespace kwai {
+namespace leak_monitor {
+// Call site summarized by a journal snapshot
+struct JournalStack {
+  int64_t live_bytes;
+  int64_t alloc_bytes;
+  const uintptr_t *frames;
+  uint32_t num_frames;
+};
+
+// File backed, mmap-ed log which survives the process: a ring of the most
+// recent large allocations and periodic snapshots of the call sites holding
+// the most memory. The page cache keeps what was stored when the process is
+// killed, so the next session can tell what dominated memory before death.
+//
+// RecordLarge claims a ring slot by an atomic add and writes it with plain
+// stores, it makes no syscall and is async-signal-safe. A slot carries its
+// sequence number once complete, half written slots are skipped by Format.
+// Snapshots alternate between two slots, a crash while writing one leaves
+// the other. Frames are absolute pcs, every snapshot also stores the loaded
+// modules to resolve them with.
+class AllocJournal {
+ public:
+  AllocJournal() : journal_(nullptr) {}
+  ~AllocJournal() { Close(); }
+  // Map |path| as the journal of this session, an existing file is renamed
+  // to |path| + kJournalLastSuffix first. A journal opened before is only
+  // unmapped by Close.
+  bool Open(const std::string &path);
+  // Only after hooks are removed, hooks write without lock
+  void Close();
+
+  bool IsOpen() const {
+    return journal_.load(std::memory_order_relaxed) != nullptr;
+  }
+
+  void RecordLarge(uint64_t index, uint64_t size, uint32_t kind,
+                   const uintptr_t *frames, uint32_t num_frames);
+  // Not thread safe with itself, one snapshot writer at a time
+  void WriteSnapshot(uint64_t alloc_index,
+                     const std::vector<JournalStack> &stacks);
+
+  // Format a journal file left by a session, false if it is not one
+  static bool Format(const std::string &path, std::string *report);
+
+ private:
+  struct Journal;
+
+  std::atomic<Journal *> journal_;
+  std::vector<Journal *> retired_journals_;
+};
+}  // namespace leak_monitor
+}  // namespace kwai
+#endif  // KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_ALLOC_JOURNAL_H_
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#ifndef KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_CALLER_FILTER_H_
+#define KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_CALLER_FILTER_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+// Classify an allocation by the module of its immediate caller before any
+// unwinding. Executable mappings of the modules matching the patterns are
+// kept in a sorted range table: in include mode only callers inside them are
+// monitored, in exclude mode callers inside them are skipped.
+//
+// A pattern containing '/' is a path prefix, otherwise it is a library name
+// with or without ".so". The table is rebuilt after every dlopen. Hooks read
+// the current table without lock, counted in the reader stripes of an epoch
+// which is still current after they counted themselves; a replaced table is
+// freed once the readers of the epoch it was replaced in have left.
+class CallerFilter {
+ public:
+  CallerFilter() : table_(nullptr), epoch_(0), callback_added_(false) {}
+  ~CallerFilter() { Clear(); }
+  // Empty |patterns| accepts every caller
+  bool Update(const std::vector<std::string> &patterns, bool include);
+  void Clear();
+
+  bool Accept(uintptr_t pc) {
+    static std::atomic<size_t> next_stripe(0);
+    static thread_local size_t stripe_index =
+        next_stripe.fetch_add(1, std::memory_order_relaxed) % kNumStripes;
+    auto &stripe = stripes_[stripe_index];
+    std::atomic<uint32_t> *readers;
+    // The epoch may flip before the reader is counted, then the flip's
+    // writer may not wait for it, count again in the new epoch
+    for (;;) {
+      uint32_t epoch = epoch_.load();
+      readers = &stripe.readers[epoch & 1];
+      readers->fetch_add(1);
+      if (epoch_.load() == epoch) {
+        break;
+      }
+      readers->fetch_sub(1, std::memory_order_release);
+    }
+    auto *table = table_.load();
+    bool accept = true;
+    if (table) {
+      auto end = table->starts.end();
+      auto it = std::upper_bound(table->starts.begin(), end, pc);
+      bool hit = it != table->starts.begin() &&
+                 pc < table->ends[it - table->starts.begin() - 1];
+      accept = hit == table->include;
+    }
+    readers->fetch_sub(1, std::memory_order_release);
+    return accept;
+  }
+
+ private:
+  static const size_t kNumStripes = 32;
+
+  struct Table {
+    bool include;
+    std::vector<uintptr_t> starts;
+    std::vector<uintptr_t> ends;
+  };
+
+  // Readers of the even and odd epochs, threads are spread over stripes so
+  // the counters are rarely shared between cores
+  struct alignas(64) Stripe {
+    std::atomic<uint32_t> readers[2];
+  };
+
+  static void OnDlopen(std::set<std::string> &, int, std::string &);
+  bool RebuildLocked();
+  void ReplaceLocked(Table *table);
+  bool Match(const char *name, size_t name_len) const;
+
+  std::mutex mutex_;
+  std::atomic<Table *> table_;
+  std::atomic<uint32_t> epoch_;
+  Stripe stripes_[kNumStripes] = {};
+  std::vector<std::string> patterns_;
+  bool include_ = true;
+  std::atomic<bool> callback_added_;
+};
+}  // namespace leak_monitor
+}  // namespace kwai
+#endif  // KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_CALLER_FILTER_H_
@@ -25,5 +25,21 @@
 const uint32_t kMaxBacktraceSize = 12;
 const uint32_t kMaxThreadNameLen = 16;
 const uint32_t kDefaultAllocThreshold = 15;
+const uint32_t kEventBufferSize = 512;
+const uint32_t kEventWakeThreshold = kEventBufferSize / 2;
+const uint32_t kAggregateIntervalMs = 1000;
+const uint32_t kNumRecentFrees = 4096;
+const uint32_t kMaxHeapSnapshots = 4;
+const uint32_t kMaxScanAge = 16;
+const uint32_t kNumEvictedStacks = 4096;
+const uint32_t kNumEvictBuckets = 256;
+const uint32_t kMinBudgetRecords = 1024;
+const uint32_t kEvictLogIntervalMs = 10000;
+const uint32_t kJournalLargeSlots = 256;
+const uint32_t kJournalLargeFrames = 8;
+const uint32_t kJournalStacks = 32;
+const uint32_t kJournalModules = 384;
+const uint32_t kJournalModuleNameLen = 104;
+const char kJournalLastSuffix[] = ".last";
 
 #endif // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_CONSTANTS_H_
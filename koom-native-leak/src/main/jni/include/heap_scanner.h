@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#ifndef KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_HEAP_SCANNER_H_
+#define KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_HEAP_SCANNER_H_
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+// Conservative mark engine over the tracked blocks, an in-tree alternative to
+// libmemunreachable. Every readable and writable mapping except the tracked
+// blocks themselves is a root: stacks, .data/.bss, untracked heap and Java
+// heap. Pointer sized words hitting a tracked block (interior pointers
+// included) mark it, marked blocks are scanned transitively.
+//
+// Other threads are NOT stopped and their registers are not read. In fork
+// mode the scan runs in a child process on a copy-on-write snapshot, so the
+// parent only pauses for fork().
+//
+// Block addresses must never be copied to the heap by the caller, the copy
+// would be found as a root; AddBlock keeps them in the scanner's own mapping.
+// So are the root bounds, mapping starts are the addresses of tracked mmaps.
+class HeapScanner {
+ public:
+  HeapScanner();
+  ~HeapScanner();
+  // Must be called before AddBlock, return false if out of memory
+  bool Reserve(size_t num_blocks);
+  void AddBlock(uintptr_t address, size_t size);
+  // Append the blocks unreachable from roots to |unreachable|
+  bool Scan(bool fork_mode,
+            std::vector<std::pair<uintptr_t, size_t>> *unreachable);
+
+ private:
+  struct Range {
+    uintptr_t start;
+    uintptr_t end;
+  };
+
+  // Bounds are untagged, |address| is the one passed to AddBlock
+  struct Block {
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t address;
+  };
+
+  bool CollectRoots(uintptr_t stack_pointer);
+  void ScanRoot(uintptr_t start, uintptr_t end);
+  void ScanRange(uintptr_t start, uintptr_t end);
+  void ScanWords(const uintptr_t *words, size_t num_words);
+  void Mark();
+  bool MarkInChild();
+  void FreeMemory();
+
+  Block *blocks_;
+  size_t num_blocks_;
+  size_t capacity_;
+  // Bitmap of reached blocks, shared with the child in fork mode
+  uint64_t *marks_;
+  uint32_t *worklist_;
+  size_t worklist_size_;
+  uintptr_t *buffer_;
+  // Complemented, the scanner itself may be on a scanned stack
+  uintptr_t confused_min_address_;
+  uintptr_t confused_max_address_;
+  Range *roots_;
+  size_t num_roots_;
+  // Mappings owned by the scanner hold block addresses, never scan them
+  Range owned_[5];
+  size_t num_owned_;
+};
+}  // namespace leak_monitor
+}  // namespace kwai
+#endif  // KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_HEAP_SCANNER_H_
@@ -21,26 +21,138 @@
 #define KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_LEAK_MONITOR_H_
 
 #include <linux/prctl.h>
+#include <pthread.h>
 #include <sys/prctl.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
+#include "alloc_journal.h"
+#include "caller_filter.h"
 #include "constants.h"
 #include "memory_analyzer.h"
-#include "utils/concurrent_hash_map.h"
+#include "utils/heavy_hitters.h"
+#include "utils/lock_free_hash_map.h"
+#include "utils/slab_allocator.h"
+#include "utils/spsc_ring.h"
+#include "utils/stack_depot.h"
 
 #define CONFUSE(address) (~(address))
 
 namespace kwai {
 namespace leak_monitor {
+// Which allocator a record comes from
+enum AllocKind : uint8_t {
+  kAllocMalloc = 0,
+  kAllocNew = 1,
+  kAllocNewArray = 2,
+  kAllocMmap = 3,
+};
+
 struct AllocRecord {
   uint64_t index;
-  uint32_t size;
+  uint64_t size;
+  // Bytes this record stands for, larger than size if it is sampled
+  uint64_t estimated_size;
   intptr_t address;
-  uint32_t num_backtraces;
-  uintptr_t backtrace[kMaxBacktraceSize];
+  // Backtrace interned in the stack depot, see LeakMonitor::GetBacktrace
+  uint32_t stack_id;
+  AllocKind kind;
+  char thread_name[kMaxThreadNameLen];
+  // Link of retired records waiting for GetLeakAllocs finish
+  AllocRecord *retired_next;
+};
+
+// Malloc/free seen by a hook in async record mode, size 0 means free
+struct AllocEvent {
+  // Confused like AllocRecord::address, queued events are not scan roots
+  uintptr_t address;
+  // Alloc index of the allocation, or for free the alloc index before the
+  // memory was freed, see LeakMonitor::FreeIndex
+  uint64_t index;
+  uint64_t estimated_size;
+  uint64_t size;
+  uint32_t stack_id;
+  AllocKind kind;
+};
+
+// Events of one thread, drained by the aggregator thread
+struct EventBuffer {
+  SpscRing<AllocEvent, kEventBufferSize> ring;
   char thread_name[kMaxThreadNameLen];
+  // Set when the thread exits, the buffer is freed once drained
+  std::atomic<bool> exited;
+  EventBuffer *next;
+};
+
+// How GetLeakAllocs finds unreachable memory, see HeapScanner
+enum ScanMode {
+  kScanLibMemUnreachable = 0,
+  kScanBuiltin = 1,
+  kScanBuiltinFork = 2,
+};
+
+// Live records of one stack, counts and bytes are estimated if sampled
+struct HeapProfileEntry {
+  uint32_t stack_id;
+  int64_t count;
+  int64_t bytes;
+};
+
+// Live heap aggregated by stack at alloc index |alloc_index|, entries are
+// sorted by stack id
+struct HeapProfile {
+  uint64_t alloc_index = 0;
+  std::vector<HeapProfileEntry> entries;
+
+  // Change per stack from |base| to this, negative if the stack shrinks
+  HeapProfile Diff(const HeapProfile &base) const;
+};
+
+// Counters of the last GetLeakAllocs
+struct ScanStats {
+  // Scans since install, the last one included
+  uint64_t scan_count = 0;
+  uint64_t live = 0;
+  // Live records checked, aged ones are skipped unless it is a full scan
+  uint64_t candidates = 0;
+  uint64_t leaks = 0;
+  uint64_t time_us = 0;
+  bool full = true;
+};
+
+// Which records go first when the tracking memory is over budget
+enum EvictPolicy {
+  kEvictOldest = 0,
+  kEvictSmallest = 1,
+};
+
+// Memory used by the monitor itself, in bytes unless noted
+struct TrackerMemory {
+  // Mapped for records, live_records of them are in use
+  uint64_t records = 0;
+  uint64_t live_records = 0;
+  uint64_t hash_map = 0;
+  uint64_t stack_depot = 0;
+  uint64_t num_stacks = 0;
+  uint64_t event_buffers = 0;
+  // Heavy hitters summary and evicted stack counters
+  uint64_t counters = 0;
+  // 0 if unlimited
+  uint64_t budget = 0;
+  // Records evicted to stay in budget, or dropped if eviction was busy
+  uint64_t evicted_records = 0;
+  uint64_t evicted_bytes = 0;
+  uint64_t dropped_records = 0;
+
+  uint64_t Total() const {
+    return records + hash_map + stack_depot + event_buffers + counters;
+  }
 };
 
 struct ThreadInfo {
@@ -61,11 +173,58 @@ class LeakMonitor {
                std::vector<std::string> *ignore_list);
   void Uninstall();
   void SetMonitorThreshold(size_t threshold);
+  // Record one allocation every |interval| bytes on average, 0 records all
+  void SetSampleInterval(size_t interval);
+  // Hooks only queue events to a per-thread buffer, records are updated by a
+  // background thread, fall back to synchronous record if the buffer is full
+  void SetAsyncRecord(bool enable);
+  // One of ScanMode, builtin is used if libmemunreachable is unavailable
+  void SetScanMode(int mode);
+  // Records which survived |age_scans| scans are only checked every
+  // |aged_scan_interval| scans, new records are checked by every scan.
+  // 0 checks all records every scan. Only the builtin scanner scans
+  // incrementally, libmemunreachable scans the whole process anyway.
+  void SetIncrementalScan(uint32_t age_scans, uint32_t aged_scan_interval);
+  // Backtraces reuse the frames beyond |depth| of the last backtrace of the
+  // thread if they are unchanged, see StackTrace::SetPrefixCache. 0 disables.
+  void SetUnwindCache(uint32_t depth);
+  // Keep the tracking memory under |budget| bytes by evicting records in
+  // |policy| order, 0 is unlimited. Evicted records are no longer checked
+  // for leaks but stay counted by stack in GetHeapProfile.
+  void SetMemoryBudget(size_t budget, int policy);
+  TrackerMemory GetTrackerMemory();
+  // Keep an AllocJournal at |path|: allocations of at least |large_threshold|
+  // bytes are logged as they happen, the top call sites every |interval_ms|.
+  // Empty |path| stops it, the previous journal is kept with
+  // kJournalLastSuffix appended.
+  bool SetJournal(const std::string &path, uint32_t interval_ms,
+                  size_t large_threshold);
   std::vector<std::shared_ptr<AllocRecord>> GetLeakAllocs();
+  ScanStats GetScanStats();
+  // Aggregate live records by stack, reachable ones included
+  HeapProfile GetHeapProfile();
+  // Call sites allocating the most bytes since install, unordered
+  void GetHeavyHitters(std::vector<HeavyHitters::Entry> *heavy_hitters);
   uint64_t CurrentAllocIndex();
-  void OnMonitor(uintptr_t address, size_t size);
-  void RegisterAlloc(uintptr_t address, size_t size);
-  void UnregisterAlloc(uintptr_t address);
+  uint32_t GetBacktrace(uint32_t stack_id, const uintptr_t **backtrace);
+  // Only allocations called from the modules matching |patterns| are
+  // monitored, or only the others if |include| is false. Takes effect
+  // without hooking again, empty |patterns| monitors all callers.
+  bool SetCallerFilter(const std::vector<std::string> &patterns,
+                       bool include);
+  // |caller| is the return address of the hook
+  void OnMonitor(uintptr_t address, size_t size, uintptr_t caller,
+                 AllocKind kind = kAllocMalloc);
+  void RegisterAlloc(uintptr_t address, size_t size, uint64_t estimated_size,
+                     AllocKind kind);
+  // Taken by a free hook before it frees the memory: an allocation reusing
+  // the address gets at least this index, so the free never ends it
+  uint64_t FreeIndex();
+  // Only a record older than |free_index| is ended
+  void UnregisterAlloc(uintptr_t address, uint64_t free_index);
+  // Like UnregisterAlloc, but return whether a record was ended. Queued
+  // events are applied first, so a record still queued is found too.
+  bool UnregisterTrackedAlloc(uintptr_t address, uint64_t free_index);
 
  private:
   LeakMonitor()
@@ -73,15 +232,127 @@ class LeakMonitor {
         has_install_monitor_(false),
         live_alloc_records_(),
         alloc_threshold_(kDefaultAllocThreshold),
-        memory_analyzer_() {}
+        sample_interval_(0),
+        memory_analyzer_(),
+        collecting_(false),
+        retired_records_(nullptr),
+        async_record_(false),
+        events_pending_(false),
+        push_stripes_(),
+        aggregate_pending_(false),
+        scan_mode_(kScanLibMemUnreachable),
+        age_scans_(0),
+        aged_scan_interval_(1),
+        scan_alloc_indices_(),
+        memory_budget_(0),
+        evict_policy_(kEvictOldest),
+        evict_log_ms_(0),
+        max_records_(0),
+        evicted_records_(0),
+        evicted_bytes_(0),
+        dropped_records_(0),
+        evicted_stacks_(),
+        journal_threshold_(SIZE_MAX),
+        journal_running_(false),
+        event_buffer_key_created_(false),
+        event_buffers_(nullptr),
+        num_event_buffers_(0),
+        recent_frees_() {}
   ~LeakMonitor() = default;
   LeakMonitor(const LeakMonitor &);
   LeakMonitor &operator=(const LeakMonitor &);
+  void ReleaseRecord(AllocRecord *record);
+  void ReleaseFreedRecord(AllocRecord *record);
+  std::vector<std::pair<uintptr_t, size_t>> ScanUnreachable(
+      const std::vector<AllocRecord *> &live_allocs);
+  void FreeRetiredRecords();
+  size_t MaxRecordsInBudget();
+  bool EvictRecords();
+  void CountEvicted(uint32_t stack_id, int64_t count, int64_t bytes);
+  void StopJournal();
+  void JournalLoop(uint32_t interval_ms);
+  bool PushEvent(const AllocEvent &event);
+  bool PushToBuffer(const AllocEvent &event);
+  EventBuffer *GetEventBuffer();
+  size_t DrainEventsLocked();
+  void ApplyEventLocked(const AllocEvent &event, const char *thread_name);
+  void AddRecord(const AllocEvent &event, const char *thread_name);
+  void AggregateLoop();
+  void WakeAggregator();
+  static void OnThreadExit(void *buffer);
   std::unique_ptr<MemoryAnalyzer> memory_analyzer_;
-  ConcurrentHashMap<intptr_t, std::shared_ptr<AllocRecord>> live_alloc_records_;
+  SlabAllocator<AllocRecord> record_allocator_;
+  StackDepot stack_depot_;
+  HeavyHitters heavy_hitters_;
+  CallerFilter caller_filter_;
+  LockFreeHashMap<AllocRecord> live_alloc_records_;
   std::atomic<uint64_t> alloc_index_;
   std::atomic<bool> has_install_monitor_;
   std::atomic<size_t> alloc_threshold_;
+  std::atomic<size_t> sample_interval_;
+  // Records are read without lock while collecting, so release is deferred
+  std::mutex collect_mutex_;
+  std::atomic<bool> collecting_;
+  std::atomic<AllocRecord *> retired_records_;
+  std::mutex async_mutex_;
+  std::atomic<bool> async_record_;
+  // Events may be queued: set before async record is on, cleared by the
+  // final drain after it is off
+  std::atomic<bool> events_pending_;
+  // Hooks pushing an event, threads are spread over stripes so the counters
+  // are rarely shared between cores
+  static const size_t kNumPushStripes = 32;
+  struct alignas(64) PushStripe {
+    std::atomic<uint32_t> pushing;
+  } push_stripes_[kNumPushStripes];
+  std::thread aggregator_;
+  // Guard aggregate_pending_, wake the aggregator once a buffer fills up
+  std::mutex aggregate_mutex_;
+  std::condition_variable aggregate_cond_;
+  bool aggregate_pending_;
+  std::atomic<int> scan_mode_;
+  // Guarded by collect_mutex_
+  uint32_t age_scans_;
+  uint32_t aged_scan_interval_;
+  // Alloc index at the start of each of the last scans, indexed by scan count
+  uint64_t scan_alloc_indices_[kMaxScanAge];
+  ScanStats scan_stats_;
+  // Guarded by collect_mutex_
+  size_t memory_budget_;
+  int evict_policy_;
+  // Monotonic time of the last eviction log, guarded by collect_mutex_
+  uint64_t evict_log_ms_;
+  // Record count allowed by the budget, 0 if unlimited
+  std::atomic<size_t> max_records_;
+  std::atomic<uint64_t> evicted_records_;
+  std::atomic<uint64_t> evicted_bytes_;
+  std::atomic<uint64_t> dropped_records_;
+  // Estimated counts and bytes of evicted records by stack, slots are
+  // claimed by CAS on stack_id, stacks over the capacity share slot 0
+  struct EvictedStack {
+    std::atomic<uint32_t> stack_id;
+    std::atomic<int64_t> count;
+    std::atomic<int64_t> bytes;
+  } evicted_stacks_[kNumEvictedStacks];
+  pthread_key_t event_buffer_key_;
+  bool event_buffer_key_created_;
+  AllocJournal journal_;
+  std::atomic<size_t> journal_threshold_;
+  std::thread journal_thread_;
+  // Guard journal_running_, wake the journal thread to stop
+  std::mutex journal_mutex_;
+  std::condition_variable journal_cond_;
+  bool journal_running_;
+  std::atomic<EventBuffer *> event_buffers_;
+  std::atomic<size_t> num_event_buffers_;
+  // Serialize consumers of event buffers, guard recent_frees_
+  std::mutex drain_mutex_;
+  // Frees applied before their allocation, the allocation may still be queued
+  // in another thread's buffer
+  struct RecentFree {
+    uintptr_t address;
+    uint64_t index;
+  } recent_frees_[kNumRecentFrees];
 };
 }  // namespace leak_monitor
 }  // namespace kwai
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#ifndef KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_LEAK_REPORT_H_
+#define KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_LEAK_REPORT_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kwai {
+namespace leak_monitor {
+// Binary leak report handed to Java in one byte array, decoded by
+// LeakReport.kt. All integers are little-endian, every section and record is
+// length prefixed so a reader skips the fields it doesn't know.
+//
+//   header   u32 magic, u16 version, u16 header size, u32 string count,
+//            u32 record count, u32 strings bytes, u32 records bytes
+//   strings  u32 length, UTF-8 bytes; string 0 is the empty string
+//   record   u32 length, u64 address, u64 index, u64 estimated size,
+//            u32 size, u32 thread name, u32 alloc kind, u32 frame count,
+//            frames
+//   frame    u64 rel pc, u32 so name, u32 build-id (0 if none)
+//
+// Size saturates at INT32_MAX, the estimated size is exact.
+//
+// Module names, build-ids and thread names repeat a lot, records only refer
+// to them by their index in the string table.
+static const uint32_t kLeakReportMagic = 0x50524c4b;  // "KLRP"
+static const uint16_t kLeakReportVersion = 2;
+
+class LeakReportWriter {
+ public:
+  LeakReportWriter();
+  void Reset();
+  void AddRecord(uintptr_t address, uint64_t index, uint32_t size,
+                 uint64_t estimated_size, const char *thread_name,
+                 uint32_t kind, uint32_t num_frames);
+  // Exactly |num_frames| of the last record must follow it
+  void AddFrame(uint64_t rel_pc, const std::string &so_name,
+                const std::string &build_id);
+  // Valid until the next Reset
+  const std::vector<uint8_t> &Finish();
+
+ private:
+  uint32_t Intern(const std::string &str);
+  template <typename T>
+  static void Append(std::vector<uint8_t> *buffer, T value);
+
+  std::unordered_map<std::string, uint32_t> string_index_;
+  std::vector<uint8_t> strings_;
+  std::vector<uint8_t> records_;
+  std::vector<uint8_t> report_;
+  uint32_t num_records_;
+};
+}  // namespace leak_monitor
+}  // namespace kwai
+#endif  // KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_LEAK_REPORT_H_
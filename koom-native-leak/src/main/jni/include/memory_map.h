@@ -29,38 +29,32 @@
 #ifndef KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_MEMORY_MAP_H_
 #define KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_MEMORY_MAP_H_
 
+#include <stdint.h>
 #include <sys/cdefs.h>
+#include <kwai_util/pc_cache.h>
+#include <sys/types.h>
 
-#include <mutex>
-#include <set>
+#include <atomic>
 #include <string>
+#include <vector>
 
 #define LIB_ART "libart.so"
 #define OAT_SUFFEX ".oat"
 #define ODEX_SUFFEX ".odex"
 #define DEX_SUFFEX ".dex"
 
+// Formatted symbols of hot pcs, leak stacks repeat the same frames
+static const size_t kSymbolCacheBytes = 1024 * 1024;
+
+// Unknown pcs read the maps again at most this often
+static const uint64_t kMissRefreshIntervalMs = 1000;
+
 struct MapEntry {
   MapEntry(uintptr_t start, uintptr_t end, uintptr_t offset, const char *name,
-           size_t name_len, int flags)
-      : start(start),
-        end(end),
-        offset(offset),
-        name(name, name_len),
-        flags(flags) {}
-
-  explicit MapEntry(uintptr_t pc) : start(pc), end(pc) {}
+           size_t name_len, int flags);
 
-  bool NeedIgnore() {
-    auto ends_with = [](std::string &target,
-                        const std::string &suffix) -> bool {
-      return target.size() >= suffix.size() &&
-             target.substr(target.size() - suffix.size(), suffix.size()) ==
-                 suffix;
-    };
-    return ends_with(name, LIB_ART) || ends_with(name, OAT_SUFFEX) ||
-           ends_with(name, ODEX_SUFFEX) || ends_with(name, DEX_SUFFEX);
-  }
+  bool NeedIgnore() const { return ignore; }
+  const char *BaseName() const { return name.c_str() + basename_pos; }
 
   uintptr_t start;
   uintptr_t end;
@@ -68,30 +62,54 @@ struct MapEntry {
   uintptr_t load_bias;
   uintptr_t elf_start_offset = 0;
   std::string name;
+  // GNU build-id in hex, empty if the ELF has none
+  std::string build_id;
   int flags;
+  // Cached when parsed, looked up for every frame
+  size_t basename_pos;
+  bool ignore;
   bool init = false;
   bool valid = false;
 };
 
-// Ordering comparator that returns equivalence for overlapping entries
-struct MapEntryCompare {
-  bool operator()(const MapEntry *a, const MapEntry *b) const {
-    return a->end <= b->start;
-  }
-};
-
+// Mappings sorted by start address in a flat array. Maps are read again when
+// a library was loaded since the last read. Libraries DlopenCb doesn't report,
+// e.g. loaded from /vendor or by an unhooked caller, are found by reading
+// again on an unknown pc, at most every kMissRefreshIntervalMs as JIT code
+// never has a file mapping. Returned entries are valid until the next
+// CalculateRelPc.
 class MemoryMap {
  public:
-  MemoryMap() = default;
+  MemoryMap()
+      : generation_(0),
+        miss_refresh_ms_(0),
+        callback_added_(false),
+        symbol_cache_(kSymbolCacheBytes) {}
   ~MemoryMap();
 
   MapEntry *CalculateRelPc(uintptr_t pc, uintptr_t *rel_pc = nullptr);
   std::string FormatSymbol(MapEntry *entry, uintptr_t pc);
+  void Clear();
+  uint64_t SymbolCacheHits() const { return symbol_cache_.Hits(); }
+  uint64_t SymbolCacheMisses() const { return symbol_cache_.Misses(); }
 
  private:
   bool ReadMaps();
+  // Read maps again for an unknown pc unless done recently
+  bool RefreshOnMiss();
+  // Index of the entry containing |pc|, -1 if none
+  ssize_t Find(uintptr_t pc) const;
 
-  std::set<MapEntry *, MapEntryCompare> entries_;
+  std::vector<MapEntry> entries_;
+  // entries_[i].start, searched without touching the entries
+  std::vector<uintptr_t> starts_;
+  // Value of the dlopen generation when maps were read
+  uint32_t generation_;
+  // Monotonic time maps were last read for an unknown pc, 0 if never
+  uint64_t miss_refresh_ms_;
+  bool callback_added_;
+  // Cleared when maps change, a pc may belong to another library then
+  kwai::util::PcCache<std::string> symbol_cache_;
 };
 
 #endif  // KOOM_KOOM_NATIVE_SRC_MAIN_JNI_INCLUDE_MEMORY_MAP_H_
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#ifndef KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_HEAVY_HITTERS_H_
+#define KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_HEAVY_HITTERS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Space-Saving summary of the |kCapacity| heaviest keys: a key not monitored
+// takes over the counter of the lightest one and inherits its count as
+// error. Every key heavier than total / kCapacity is monitored, a count
+// overestimates the key by at most its error. Counters are kept in a
+// min-heap, an update costs O(log kCapacity).
+template <size_t kCapacity>
+class SpaceSaving {
+  static_assert(kCapacity < UINT16_MAX / 2, "kCapacity is too large");
+
+ public:
+  struct Counter {
+    uint32_t key;
+    uint32_t heap_pos;
+    uint64_t count;
+    uint64_t error;
+  };
+
+  SpaceSaving() { Clear(); }
+
+  void Add(uint32_t key, uint64_t weight) {
+    uint32_t index = Lookup(key);
+    if (index == kNone) {
+      if (size_ < kCapacity) {
+        index = size_++;
+        counters_[index] = {key, index, 0, 0};
+        heap_[index] = index;
+        SiftUp(index);
+      } else {
+        index = heap_[0];
+        RemoveSlot(counters_[index].key);
+        counters_[index].key = key;
+        counters_[index].error = counters_[index].count;
+      }
+      InsertSlot(key, index);
+    }
+    counters_[index].count += weight;
+    SiftDown(counters_[index].heap_pos);
+  }
+
+  size_t Size() const { return size_; }
+  const Counter &Get(size_t index) const { return counters_[index]; }
+
+  void Clear() {
+    size_ = 0;
+    memset(slots_, 0, sizeof(slots_));
+  }
+
+ private:
+  static const uint32_t kNone = UINT32_MAX;
+
+  static constexpr size_t RoundUpPowerOf2(size_t n) {
+    return n <= 1 ? 1 : 2 * RoundUpPowerOf2((n + 1) / 2);
+  }
+
+  // Load factor below 1/2 keeps linear probing short
+  static const size_t kNumSlots = RoundUpPowerOf2(kCapacity * 2);
+
+  static size_t Hash(uint32_t key) {
+    return (key * 0x9E3779B1U) & (kNumSlots - 1);
+  }
+
+  uint32_t Lookup(uint32_t key) const {
+    for (size_t slot = Hash(key); slots_[slot];
+         slot = (slot + 1) & (kNumSlots - 1)) {
+      if (counters_[slots_[slot] - 1].key == key) {
+        return slots_[slot] - 1;
+      }
+    }
+    return kNone;
+  }
+
+  void InsertSlot(uint32_t key, uint32_t index) {
+    size_t slot = Hash(key);
+    while (slots_[slot]) {
+      slot = (slot + 1) & (kNumSlots - 1);
+    }
+    slots_[slot] = index + 1;
+  }
+
+  // Backward shift deletion, no tombstone is left
+  void RemoveSlot(uint32_t key) {
+    size_t slot = Hash(key);
+    while (counters_[slots_[slot] - 1].key != key) {
+      slot = (slot + 1) & (kNumSlots - 1);
+    }
+    for (size_t next = (slot + 1) & (kNumSlots - 1); slots_[next];
+         next = (next + 1) & (kNumSlots - 1)) {
+      size_t home = Hash(counters_[slots_[next] - 1].key);
+      // Move the entry back unless its home lies in (slot, next]
+      if (((next - home) & (kNumSlots - 1)) >=
+          ((next - slot) & (kNumSlots - 1))) {
+        slots_[slot] = slots_[next];
+        slot = next;
+      }
+    }
+    slots_[slot] = 0;
+  }
+
+  void Swap(uint32_t pos, uint32_t other) {
+    std::swap(heap_[pos], heap_[other]);
+    counters_[heap_[pos]].heap_pos = pos;
+    counters_[heap_[other]].heap_pos = other;
+  }
+
+  uint64_t HeapCount(uint32_t pos) const { return counters_[heap_[pos]].count; }
+
+  void SiftUp(uint32_t pos) {
+    while (pos && HeapCount(pos) < HeapCount((pos - 1) / 2)) {
+      Swap(pos, (pos - 1) / 2);
+      pos = (pos - 1) / 2;
+    }
+  }
+
+  void SiftDown(uint32_t pos) {
+    for (;;) {
+      uint32_t min = pos;
+      for (uint32_t child = pos * 2 + 1; child <= pos * 2 + 2; child++) {
+        if (child < size_ && HeapCount(child) < HeapCount(min)) {
+          min = child;
+        }
+      }
+      if (min == pos) {
+        return;
+      }
+      Swap(pos, min);
+      pos = min;
+    }
+  }
+
+  Counter counters_[kCapacity];
+  uint32_t heap_[kCapacity];
+  // Counter index + 1, 0 is empty
+  uint16_t slots_[kNumSlots];
+  uint32_t size_;
+};
+
+// Count-Min sketch of signed counts, updates are lock-free. With only
+// non-negative totals (live bytes: frees never exceed allocations) an
+// estimate is never below the true count.
+template <size_t kDepth, size_t kWidth>
+class CountMinSketch {
+  static_assert((kWidth & (kWidth - 1)) == 0, "kWidth must be power of 2");
+
+ public:
+  CountMinSketch() { Clear(); }
+
+  void Add(uint32_t key, int64_t delta) {
+    for (size_t row = 0; row < kDepth; row++) {
+      counts_[row][Hash(key, row)].fetch_add(delta, std::memory_order_relaxed);
+    }
+  }
+
+  int64_t Estimate(uint32_t key) const {
+    int64_t estimate = INT64_MAX;
+    for (size_t row = 0; row < kDepth; row++) {
+      estimate = std::min(estimate, counts_[row][Hash(key, row)].load(
+                                        std::memory_order_relaxed));
+    }
+    return estimate;
+  }
+
+  void Clear() {
+    for (auto &row : counts_) {
+      for (auto &count : row) {
+        count.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+ private:
+  static size_t Hash(uint32_t key, size_t row) {
+    uint64_t hash = (key + row * 0x9E3779B97F4A7C15ULL) * 0xBF58476D1CE4E5B9ULL;
+    return (hash ^ (hash >> 31)) & (kWidth - 1);
+  }
+
+  std::atomic<int64_t> counts_[kDepth][kWidth];
+};
+
+// Bounded always-on summary of the call sites allocating the most bytes,
+// keyed by stack id. Allocated bytes are counted by Space-Saving, live bytes
+// (allocated minus freed) by a Count-Min sketch. Live bytes of a stack never
+// exceed its allocated bytes, so the stacks with the most live bytes are
+// among the monitored ones too.
+//
+// Keys are spread over shards with their own lock, Dump is O(K).
+class HeavyHitters {
+ public:
+  struct Entry {
+    uint32_t stack_id;
+    uint64_t alloc_bytes;
+    // alloc_bytes overestimates by at most error
+    uint64_t error;
+    int64_t live_bytes;
+  };
+
+  void OnAlloc(uint32_t stack_id, uint64_t bytes) {
+    auto &shard = shards_[stack_id & (kNumShards - 1)];
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.summary.Add(stack_id, bytes);
+    }
+    live_bytes_.Add(stack_id, bytes);
+  }
+
+  void OnFree(uint32_t stack_id, uint64_t bytes) {
+    live_bytes_.Add(stack_id, -static_cast<int64_t>(bytes));
+  }
+
+  void Dump(std::vector<Entry> *entries) {
+    for (auto &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      for (size_t i = 0; i < shard.summary.Size(); i++) {
+        auto &counter = shard.summary.Get(i);
+        entries->push_back({counter.key, counter.count, counter.error,
+                            live_bytes_.Estimate(counter.key)});
+      }
+    }
+  }
+
+  void Clear() {
+    for (auto &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.summary.Clear();
+    }
+    live_bytes_.Clear();
+  }
+
+ private:
+  static const size_t kNumShards = 4;
+  static const size_t kShardCapacity = 64;
+
+  struct Shard {
+    std::mutex mutex;
+    SpaceSaving<kShardCapacity> summary;
+  };
+
+  Shard shards_[kNumShards];
+  CountMinSketch<4, 1024> live_bytes_;
+};
+
+static_assert(sizeof(HeavyHitters) <= 64 * 1024,
+              "HeavyHitters exceeds its memory budget");
+
+#endif  // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_HEAVY_HITTERS_H_
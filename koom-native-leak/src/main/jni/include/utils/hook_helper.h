@@ -20,24 +20,47 @@
 #ifndef KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_HOOK_HELPER_H_
 #define KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_HOOK_HELPER_H_
 
+#include <regex.h>
+
 #include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+// Hook |methods| in the libraries matching a register pattern and no ignore
+// pattern, the patterns are POSIX basic regexes like xhook's. A method is not
+// hooked in the libraries matching one of its |ignore_methods| patterns,
+// given as pattern and method name. Libraries loaded later are hooked on
+// dlopen, only the new ones.
 class HookHelper {
  public:
   static bool HookMethods(
       std::vector<const std::string> &register_pattern,
       std::vector<const std::string> &ignore_pattern,
-      std::vector<std::pair<const std::string, void *const>> &methods);
+      std::vector<std::pair<const std::string, void *const>> &methods,
+      std::vector<std::pair<const std::string, const std::string>>
+          &ignore_methods);
   static void UnHookMethods();
 
  private:
   static void Callback(std::set<std::string> &, int, std::string &);
   static bool HookImpl();
+  static bool HookLibs(const std::vector<std::string> &libs);
+  static bool CompilePatterns();
+  static void FreePatterns();
+  static bool Match(const std::string &lib);
+  static bool IgnoreMethod(const std::string &lib, const std::string &method);
   static std::vector<const std::string> register_pattern_;
   static std::vector<const std::string> ignore_pattern_;
   static std::vector<std::pair<const std::string, void *const>> methods_;
+  static std::vector<std::pair<const std::string, const std::string>>
+      ignore_methods_;
+  static std::vector<regex_t> register_regex_;
+  static std::vector<regex_t> ignore_regex_;
+  // Compiled patterns of ignore_methods_, in the same order
+  static std::vector<regex_t> ignore_method_regex_;
+  // Match result by library path, only used in Callback
+  static std::unordered_map<std::string, bool> match_cache_;
 };
 #endif  // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_HOOK_HELPER_H_
@@ -0,0 +1,502 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+#ifndef KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_LOCK_FREE_HASH_MAP_H_
+#define KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_LOCK_FREE_HASH_MAP_H_
+
+#include <sched.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+// Open addressing hash map from an integer key to a value pointer. Slots are
+// claimed and released by CAS, Put/Erase never take a lock and never call the
+// system allocator (tables are mmap-ed).
+//
+// Erase leaves a tombstone which Put reuses. When claimed slots exceed the
+// load factor the table is rebuilt: tombstones are dropped and the capacity is
+// chosen by the live count, so the table grows or keeps its size. Put/Erase
+// only wait while a rebuild is in progress, which is rare.
+//
+// Keys 0, 1 and 2 are reserved. The owner of the values is responsible for
+// their lifetime, Put/Erase/Clear hand back the values they detach.
+template <typename V>
+class LockFreeHashMap {
+ public:
+  explicit LockFreeHashMap(size_t initial_capacity = kDefaultCapacity)
+      : initial_capacity_(RoundUpPowerOf2(initial_capacity)),
+        table_(nullptr),
+        rebuilding_(false),
+        dumping_(false),
+        retired_tables_(nullptr),
+        retired_bytes_(0),
+        stripes_() {}
+
+  ~LockFreeHashMap() {
+    FreeTable(table_.load());
+    FreeRetiredTables();
+  }
+
+  // Insert or replace, return the replaced value or nullptr; |value| itself
+  // is handed back if there is no room for it
+  V *Put(uintptr_t key, V *value) {
+    auto replace_func = [](V *) { return true; };
+    return Put(key, value, replace_func);
+  }
+
+  // Like Put, but an existing value is only replaced if |replace| returns
+  // true for it, otherwise |value| is handed back
+  template <typename Predicate>
+  V *Put(uintptr_t key, V *value, Predicate &replace) {
+    Stripe *stripe = Enter();
+    Table *table = table_.load();
+    if (!table && !(table = CreateFirstTable())) {
+      Leave(stripe);
+      return value;
+    }
+
+    V *replaced = nullptr;
+    bool need_rebuild = false;
+    table->Insert(key, value, replace, &replaced, &need_rebuild);
+    Leave(stripe);
+
+    if (need_rebuild) {
+      Rebuild(table);
+    }
+    return replaced;
+  }
+
+  V *Erase(uintptr_t key) {
+    Stripe *stripe = Enter();
+    Table *table = table_.load();
+    V *value = table ? table->Erase(key) : nullptr;
+    Leave(stripe);
+    return value;
+  }
+
+  // Erase only if |p| returns true for the value, a value put meanwhile is
+  // checked again and kept unless it matches too
+  template <typename Predicate>
+  V *EraseIf(uintptr_t key, Predicate &p) {
+    Stripe *stripe = Enter();
+    Table *table = table_.load();
+    V *value = table ? table->EraseIf(key, p) : nullptr;
+    Leave(stripe);
+    return value;
+  }
+
+  V *Find(uintptr_t key) {
+    Stripe *stripe = Enter();
+    Table *table = table_.load();
+    V *value = table ? table->Find(key) : nullptr;
+    Leave(stripe);
+    return value;
+  }
+
+  // Visit every value without blocking Put/Erase or a rebuild, concurrent
+  // updates may or may not be seen
+  template <typename Predicate>
+  void Dump(Predicate &p) {
+    std::lock_guard<std::mutex> lock(dump_mutex_);
+    // No other Dump, so no one can still walk a retired table
+    FreeRetiredTables();
+
+    dumping_.store(true);
+    Table *table = table_.load();
+    if (table) {
+      for (size_t i = 0; i <= table->mask; i++) {
+        if (table->slots[i].key.load() <= kDeletingKey) {
+          continue;
+        }
+        V *value = table->slots[i].value.load();
+        if (value) {
+          p(value);
+        }
+      }
+    }
+    dumping_.store(false);
+  }
+
+  // Detach all values and hand them to p, safe against concurrent Put/Erase
+  template <typename Predicate>
+  void Clear(Predicate &p) {
+    Stripe *stripe = Enter();
+    Table *table = table_.load();
+    if (table) {
+      for (size_t i = 0; i <= table->mask; i++) {
+        uintptr_t key = table->slots[i].key.load();
+        if (key <= kDeletingKey) {
+          continue;
+        }
+        V *value = table->Detach(&table->slots[i], key);
+        if (value) {
+          p(value);
+        }
+      }
+    }
+    Leave(stripe);
+  }
+
+  // Walk the whole table, NOT for the hot path
+  size_t Size() const {
+    Table *table = table_.load();
+    return table ? table->Live() : 0;
+  }
+
+  // Bytes of table memory mapped by this map, retired tables included
+  size_t Footprint() const {
+    Table *table = table_.load();
+    return (table ? TableBytes(table->mask + 1) : 0) + RetiredFootprint();
+  }
+
+  // Bytes of tables replaced by a rebuild and not freed yet
+  size_t RetiredFootprint() const {
+    return retired_bytes_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static const size_t kDefaultCapacity = 1 << 14;
+  static const size_t kNumStripes = 32;
+  static const uintptr_t kEmptyKey = 0;
+  static const uintptr_t kTombstoneKey = 1;
+  static const uintptr_t kDeletingKey = 2;
+  // Rebuild once 3/4 slots are claimed, live slots are below 1/2 after it
+  static const size_t kLoadFactorNum = 3;
+  static const size_t kLoadFactorDen = 4;
+
+  struct Slot {
+    std::atomic<uintptr_t> key;
+    std::atomic<V *> value;
+  };
+
+  struct Table {
+    size_t mask;
+    size_t max_used;
+    std::atomic<size_t> used;  // Non-empty slots, tombstones included
+    Table *retired_next;
+    Slot slots[0];
+
+    size_t Live() const {
+      size_t live = 0;
+      for (size_t i = 0; i <= mask; i++) {
+        if (slots[i].key.load(std::memory_order_relaxed) > kDeletingKey) {
+          live++;
+        }
+      }
+      return live;
+    }
+
+    // Return false if |key| already exists, its value is replaced if
+    // |replace| accepts it, or |value| is handed back in |replaced|. An
+    // existing value is only ever replaced by CAS, never a null one, so a
+    // value can't land in a slot detached meanwhile.
+    template <typename Predicate>
+    bool Insert(uintptr_t key, V *value, Predicate &replace, V **replaced,
+                bool *need_rebuild) {
+      size_t index = Hash(key) & mask;
+      Slot *tombstone = nullptr;
+      for (size_t probe = 0; probe <= mask; probe++) {
+        Slot *slot = &slots[(index + probe) & mask];
+        uintptr_t current = slot->key.load(std::memory_order_acquire);
+        if (current == key) {
+          V *old = slot->value.load(std::memory_order_acquire);
+          for (;;) {
+            if (!old) {
+              // Null while the slot is being filled or detached. A detached
+              // slot no longer holds |key|, and the key may be put again in
+              // an earlier tombstone, so probe again from the start.
+              if (slot->key.load(std::memory_order_acquire) != key) {
+                break;
+              }
+              sched_yield();
+              old = slot->value.load(std::memory_order_acquire);
+              continue;
+            }
+            if (!replace(old)) {
+              *replaced = value;
+              return false;
+            }
+            if (slot->value.compare_exchange_weak(old, value)) {
+              *replaced = old;
+              return false;
+            }
+          }
+          tombstone = nullptr;
+          probe = static_cast<size_t>(-1);
+          continue;
+        }
+        if (current == kTombstoneKey) {
+          if (!tombstone) tombstone = slot;
+          continue;
+        }
+        if (current != kEmptyKey) {
+          continue;
+        }
+
+        // End of the probe chain, prefer to reuse a tombstone
+        uintptr_t expected = tombstone ? kTombstoneKey : kEmptyKey;
+        Slot *target = tombstone ? tombstone : slot;
+        if (target->key.compare_exchange_strong(expected, key)) {
+          target->value.store(value, std::memory_order_release);
+          if (!tombstone) {
+            *need_rebuild = used.fetch_add(1) + 1 >= max_used;
+          }
+          return true;
+        }
+        // Lost the race, rescan from the current slot
+        tombstone = nullptr;
+        probe--;
+      }
+      // Can't happen while the load factor holds
+      *replaced = value;
+      return false;
+    }
+
+    V *Find(uintptr_t key) {
+      Slot *slot = Lookup(key);
+      return slot ? slot->value.load(std::memory_order_acquire) : nullptr;
+    }
+
+    V *Erase(uintptr_t key) {
+      Slot *slot = Lookup(key);
+      return slot ? Detach(slot, key) : nullptr;
+    }
+
+    template <typename Predicate>
+    V *EraseIf(uintptr_t key, Predicate &p) {
+      Slot *slot = Lookup(key);
+      if (!slot) {
+        return nullptr;
+      }
+      // Null while the value is being put or detached
+      V *value = slot->value.load(std::memory_order_acquire);
+      if (!value || !p(value)) {
+        return nullptr;
+      }
+      uintptr_t expected = key;
+      if (!slot->key.compare_exchange_strong(expected, kDeletingKey)) {
+        return nullptr;
+      }
+      V *detached;
+      while (!(detached = slot->value.exchange(nullptr))) {
+        sched_yield();
+      }
+      // A Put replaced the value after the check, the deleting state still
+      // keeps the slot to this thread, so put it back
+      if (detached != value && !p(detached)) {
+        slot->value.store(detached, std::memory_order_relaxed);
+        slot->key.store(key, std::memory_order_release);
+        return nullptr;
+      }
+      slot->key.store(kTombstoneKey, std::memory_order_release);
+      return detached;
+    }
+
+    Slot *Lookup(uintptr_t key) {
+      size_t index = Hash(key) & mask;
+      for (size_t probe = 0; probe <= mask; probe++) {
+        Slot *slot = &slots[(index + probe) & mask];
+        uintptr_t current = slot->key.load(std::memory_order_acquire);
+        if (current == key) {
+          return slot;
+        }
+        if (current == kEmptyKey) {
+          break;
+        }
+      }
+      return nullptr;
+    }
+
+    // key -> deleting -> tombstone, the deleting state keeps the slot from
+    // being reused until its value has been taken away
+    V *Detach(Slot *slot, uintptr_t key) {
+      if (!slot->key.compare_exchange_strong(key, kDeletingKey)) {
+        return nullptr;
+      }
+      V *value;
+      // Put claims the key before it stores the value
+      while (!(value = slot->value.exchange(nullptr))) {
+        sched_yield();
+      }
+      slot->key.store(kTombstoneKey, std::memory_order_release);
+      return value;
+    }
+  };
+
+  // Threads are spread over stripes so that the counter touched on every
+  // Put/Erase is rarely shared between cores
+  struct alignas(64) Stripe {
+    std::atomic<size_t> active;
+  };
+
+  // Allocator addresses share their low bits, mix all bits into them
+  static inline size_t Hash(uintptr_t key) {
+    uint64_t hash = static_cast<uint64_t>(key);
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return static_cast<size_t>(hash);
+  }
+
+  static size_t RoundUpPowerOf2(size_t value) {
+    size_t result = 1;
+    while (result < value) result <<= 1;
+    return result;
+  }
+
+  static size_t TableBytes(size_t capacity) {
+    return sizeof(Table) + capacity * sizeof(Slot);
+  }
+
+  static Table *CreateTable(size_t capacity) {
+    void *memory = mmap(nullptr, TableBytes(capacity), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      return nullptr;
+    }
+    // Anonymous memory is zero filled, all slots are empty
+    auto *table = static_cast<Table *>(memory);
+    table->mask = capacity - 1;
+    table->max_used = capacity / kLoadFactorDen * kLoadFactorNum;
+    return table;
+  }
+
+  static void FreeTable(Table *table) {
+    if (table) {
+      munmap(table, TableBytes(table->mask + 1));
+    }
+  }
+
+  Stripe *Enter() {
+    static std::atomic<size_t> next_stripe(0);
+    static thread_local size_t stripe_index =
+        next_stripe.fetch_add(1, std::memory_order_relaxed) % kNumStripes;
+    Stripe *stripe = &stripes_[stripe_index];
+    for (;;) {
+      stripe->active.fetch_add(1);
+      if (!rebuilding_.load()) {
+        return stripe;
+      }
+      stripe->active.fetch_sub(1);
+      while (rebuilding_.load(std::memory_order_relaxed)) {
+        sched_yield();
+      }
+    }
+  }
+
+  void Leave(Stripe *stripe) {
+    stripe->active.fetch_sub(1, std::memory_order_release);
+  }
+
+  Table *CreateFirstTable() {
+    Table *table = CreateTable(initial_capacity_);
+    if (!table) {
+      return nullptr;
+    }
+    Table *expected = nullptr;
+    if (!table_.compare_exchange_strong(expected, table)) {
+      FreeTable(table);
+      return expected;
+    }
+    return table;
+  }
+
+  // Wait for in-flight Put/Erase and block new ones, then move live slots to
+  // a new table. Dump is not blocked, it may keep walking the old table.
+  void Rebuild(Table *old_table) {
+    bool expected = false;
+    if (!rebuilding_.compare_exchange_strong(expected, true)) {
+      return;
+    }
+    if (table_.load() != old_table) {
+      rebuilding_.store(false);
+      return;
+    }
+    for (auto &stripe : stripes_) {
+      while (stripe.active.load()) {
+        sched_yield();
+      }
+    }
+
+    size_t capacity = RoundUpPowerOf2(old_table->Live() * 2 + 1);
+    if (capacity < initial_capacity_) {
+      capacity = initial_capacity_;
+    }
+    Table *new_table = CreateTable(capacity);
+    if (new_table) {
+      size_t used = 0;
+      for (size_t i = 0; i <= old_table->mask; i++) {
+        Slot &slot = old_table->slots[i];
+        uintptr_t key = slot.key.load(std::memory_order_relaxed);
+        if (key <= kDeletingKey) {
+          continue;
+        }
+        size_t index = Hash(key) & new_table->mask;
+        while (new_table->slots[index].key.load(std::memory_order_relaxed)) {
+          index = (index + 1) & new_table->mask;
+        }
+        new_table->slots[index].key.store(key, std::memory_order_relaxed);
+        new_table->slots[index].value.store(
+            slot.value.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+        used++;
+      }
+      new_table->used.store(used, std::memory_order_relaxed);
+      table_.store(new_table);
+      RetireTable(old_table);
+    }
+    rebuilding_.store(false);
+  }
+
+  void RetireTable(Table *table) {
+    retired_bytes_.fetch_add(TableBytes(table->mask + 1),
+                             std::memory_order_relaxed);
+    table->retired_next = retired_tables_.load(std::memory_order_relaxed);
+    while (!retired_tables_.compare_exchange_weak(table->retired_next, table)) {
+    }
+    // table_ is switched before the check, a Dump start after it never sees
+    // the retired tables
+    if (!dumping_.load()) {
+      FreeRetiredTables();
+    }
+  }
+
+  void FreeRetiredTables() {
+    Table *table = retired_tables_.exchange(nullptr);
+    while (table) {
+      Table *next = table->retired_next;
+      retired_bytes_.fetch_sub(TableBytes(table->mask + 1),
+                               std::memory_order_relaxed);
+      FreeTable(table);
+      table = next;
+    }
+  }
+
+  const size_t initial_capacity_;
+  std::atomic<Table *> table_;
+  std::atomic<bool> rebuilding_;
+  std::mutex dump_mutex_;
+  std::atomic<bool> dumping_;
+  std::atomic<Table *> retired_tables_;
+  std::atomic<size_t> retired_bytes_;
+  Stripe stripes_[kNumStripes];
+};
+#endif  // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_LOCK_FREE_HASH_MAP_H_
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#ifndef KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_PPROF_WRITER_H_
+#define KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_PPROF_WRITER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Protocol buffers wire format, only what profile.proto needs
+class ProtoWriter {
+ public:
+  explicit ProtoWriter(std::string *out) : out_(out) {}
+
+  void Varint(uint64_t value) {
+    while (value >= 0x80) {
+      out_->push_back(static_cast<char>(value | 0x80));
+      value >>= 7;
+    }
+    out_->push_back(static_cast<char>(value));
+  }
+
+  // int64 and uint64 fields, negative values take 10 bytes
+  void Int(uint32_t field, uint64_t value) {
+    if (!value) {
+      return;
+    }
+    Varint(field << 3);
+    Varint(value);
+  }
+
+  void Bytes(uint32_t field, const std::string &bytes) {
+    Varint(field << 3 | 2);
+    Varint(bytes.size());
+    out_->append(bytes);
+  }
+
+  template <typename T>
+  void Packed(uint32_t field, const std::vector<T> &values) {
+    if (values.empty()) {
+      return;
+    }
+    std::string packed;
+    ProtoWriter writer(&packed);
+    for (auto value : values) {
+      writer.Varint(static_cast<uint64_t>(value));
+    }
+    Bytes(field, packed);
+  }
+
+ private:
+  std::string *out_;
+};
+
+// Builder of a pprof profile (github.com/google/pprof/proto/profile.proto).
+// Messages are encoded as they are added, Serialize only concatenates them.
+// Ids of mappings, locations and functions start from 1.
+class PprofWriter {
+ public:
+  PprofWriter() : num_mappings_(0), num_locations_(0) { Intern(""); }
+
+  int64_t Intern(const std::string &str) {
+    auto result = string_index_.emplace(str, string_index_.size());
+    if (result.second) {
+      ProtoWriter(&strings_).Bytes(kStringTable, str);
+    }
+    return result.first->second;
+  }
+
+  void AddSampleType(const std::string &type, const std::string &unit) {
+    ProtoWriter(&header_).Bytes(kSampleType, ValueType(type, unit));
+  }
+
+  void SetPeriod(const std::string &type, const std::string &unit,
+                 int64_t period) {
+    ProtoWriter writer(&header_);
+    writer.Bytes(kPeriodType, ValueType(type, unit));
+    writer.Int(kPeriod, period);
+  }
+
+  void SetTimeNanos(int64_t time_nanos) {
+    ProtoWriter(&header_).Int(kTimeNanos, time_nanos);
+  }
+
+  uint64_t AddMapping(uint64_t start, uint64_t limit, uint64_t offset,
+                      const std::string &filename,
+                      const std::string &build_id) {
+    std::string mapping;
+    ProtoWriter writer(&mapping);
+    writer.Int(1, ++num_mappings_);
+    writer.Int(2, start);
+    writer.Int(3, limit);
+    writer.Int(4, offset);
+    writer.Int(5, Intern(filename));
+    writer.Int(6, Intern(build_id));
+    ProtoWriter(&body_).Bytes(kMapping, mapping);
+    return num_mappings_;
+  }
+
+  // |function| may be empty if the address is not symbolized
+  uint64_t AddLocation(uint64_t mapping_id, uint64_t address,
+                       const std::string &function) {
+    std::string location;
+    ProtoWriter writer(&location);
+    writer.Int(1, ++num_locations_);
+    writer.Int(2, mapping_id);
+    writer.Int(3, address);
+    if (!function.empty()) {
+      std::string line;
+      ProtoWriter(&line).Int(1, FunctionId(function));
+      writer.Bytes(4, line);
+    }
+    ProtoWriter(&body_).Bytes(kLocation, location);
+    return num_locations_;
+  }
+
+  // |locations| from leaf to root, |values| in the order of sample types
+  void AddSample(const std::vector<uint64_t> &locations,
+                 const std::vector<int64_t> &values) {
+    std::string sample;
+    ProtoWriter writer(&sample);
+    writer.Packed(1, locations);
+    writer.Packed(2, values);
+    ProtoWriter(&body_).Bytes(kSample, sample);
+  }
+
+  std::string Serialize() const { return header_ + body_ + strings_; }
+
+ private:
+  // Field numbers of Profile
+  static const uint32_t kSampleType = 1;
+  static const uint32_t kSample = 2;
+  static const uint32_t kMapping = 3;
+  static const uint32_t kLocation = 4;
+  static const uint32_t kFunction = 5;
+  static const uint32_t kStringTable = 6;
+  static const uint32_t kTimeNanos = 9;
+  static const uint32_t kPeriodType = 11;
+  static const uint32_t kPeriod = 12;
+
+  std::string ValueType(const std::string &type, const std::string &unit) {
+    std::string value_type;
+    ProtoWriter writer(&value_type);
+    writer.Int(1, Intern(type));
+    writer.Int(2, Intern(unit));
+    return value_type;
+  }
+
+  uint64_t FunctionId(const std::string &name) {
+    auto result = function_index_.emplace(name, function_index_.size() + 1);
+    if (result.second) {
+      std::string function;
+      ProtoWriter writer(&function);
+      writer.Int(1, result.first->second);
+      writer.Int(2, Intern(name));
+      ProtoWriter(&body_).Bytes(kFunction, function);
+    }
+    return result.first->second;
+  }
+
+  std::unordered_map<std::string, int64_t> string_index_;
+  std::unordered_map<std::string, uint64_t> function_index_;
+  std::string header_;
+  std::string body_;
+  std::string strings_;
+  uint64_t num_mappings_;
+  uint64_t num_locations_;
+};
+
+#endif  // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_PPROF_WRITER_H_
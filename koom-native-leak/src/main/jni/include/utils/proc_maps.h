@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+#ifndef KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_PROC_MAPS_H_
+#define KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_PROC_MAPS_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+
+// One line of /proc/self/maps, |name| points into the read content and is
+// not NUL terminated
+struct MapsLine {
+  uintptr_t start;
+  uintptr_t end;
+  uintptr_t offset;
+  char permissions[4];
+  const char *name;
+  size_t name_len;
+};
+
+// Read the whole file with a few large read() instead of stdio lines
+static inline bool ReadProcMaps(std::string *content) {
+  int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  content->clear();
+  char chunk[16 * 1024];
+  ssize_t bytes;
+  while ((bytes = TEMP_FAILURE_RETRY(read(fd, chunk, sizeof(chunk)))) > 0) {
+    content->append(chunk, bytes);
+  }
+  close(fd);
+  return bytes == 0;
+}
+
+static inline uintptr_t ParseMapsHex(const char **cursor) {
+  uintptr_t value = 0;
+  for (const char *p = *cursor;; p++) {
+    char c = *p | 0x20;
+    if (c >= '0' && c <= '9') {
+      value = (value << 4) | (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value = (value << 4) | (c - 'a' + 10);
+    } else {
+      *cursor = p;
+      return value;
+    }
+  }
+}
+
+// Parse the line at |*cursor| and move it to the next line, return false at
+// the end of content or on a malformed line.
+// 7f7a9c5000-7f7a9c6000 r-xp 00001000 fd:04 1234    /system/lib64/libc.so
+static inline bool ParseMapsLine(const char **cursor, MapsLine *line) {
+  const char *p = *cursor;
+  if (!*p) {
+    return false;
+  }
+  line->start = ParseMapsHex(&p);
+  if (*p++ != '-') {
+    return false;
+  }
+  line->end = ParseMapsHex(&p);
+  if (*p++ != ' ') {
+    return false;
+  }
+  for (int i = 0; i < 4; i++) {
+    if (!*p || *p == '\n') {
+      return false;
+    }
+    line->permissions[i] = *p++;
+  }
+  if (*p++ != ' ') {
+    return false;
+  }
+  line->offset = ParseMapsHex(&p);
+
+  // Skip device and inode
+  for (int field = 0; field < 2; field++) {
+    while (*p == ' ') {
+      p++;
+    }
+    while (*p && *p != ' ' && *p != '\n') {
+      p++;
+    }
+  }
+  while (*p == ' ') {
+    p++;
+  }
+  line->name = p;
+  while (*p && *p != '\n') {
+    p++;
+  }
+  line->name_len = p - line->name;
+  *cursor = *p ? p + 1 : p;
+  return true;
+}
+
+#endif  // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_PROC_MAPS_H_
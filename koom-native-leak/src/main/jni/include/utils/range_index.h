@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+#ifndef KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_RANGE_INDEX_H_
+#define KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_RANGE_INDEX_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Index of [start, start + size) ranges, tells in O(log n) whether a block
+// starts at the same address as a range or lies inside a range. Ranges may
+// overlap.
+class RangeIndex {
+ public:
+  // |ranges| is sorted in place and its memory is taken over
+  explicit RangeIndex(std::vector<std::pair<uintptr_t, size_t>> *ranges)
+      : ranges_(std::move(*ranges)) {
+    std::sort(ranges_.begin(), ranges_.end());
+    max_ends_.reserve(ranges_.size());
+    uintptr_t max_end = 0;
+    for (auto &range : ranges_) {
+      max_end = std::max(max_end, range.first + range.second);
+      max_ends_.push_back(max_end);
+    }
+  }
+
+  bool Match(uintptr_t start, size_t size) const {
+    // Last range starting at or below |start|
+    auto it = std::upper_bound(
+        ranges_.begin(), ranges_.end(), start,
+        [](uintptr_t value, const std::pair<uintptr_t, size_t> &range) {
+          return value < range.first;
+        });
+    if (it == ranges_.begin()) {
+      return false;
+    }
+    --it;
+    // Every range before |it| starts below too, one of them covers the block
+    // if the largest end of them reaches the block end
+    return it->first == start ||
+           max_ends_[it - ranges_.begin()] >= start + size;
+  }
+
+  size_t Size() const { return ranges_.size(); }
+
+ private:
+  std::vector<std::pair<uintptr_t, size_t>> ranges_;
+  // max_ends_[i] is the largest end of ranges_[0..i]
+  std::vector<uintptr_t> max_ends_;
+};
+
+#endif  // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_RANGE_INDEX_H_
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+#ifndef KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_SLAB_ALLOCATOR_H_
+#define KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_SLAB_ALLOCATOR_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+// Fixed-size object allocator backed by mmap-ed chunks, it never calls the
+// system allocator so it is safe inside malloc hooks.
+//
+// Every thread keeps a cache of free blocks, New/Delete only touch the cache.
+// Blocks move between the caches and a global pool in batches, the pool lock
+// is taken once per kBatchSize operations at most. Chunks are never unmapped,
+// the footprint is bounded by the peak number of live objects.
+template <typename T>
+class SlabAllocator {
+ public:
+  SlabAllocator()
+      : cache_key_created_(false),
+        free_batches_(nullptr),
+        free_caches_(nullptr),
+        chunk_cursor_(nullptr),
+        chunk_end_(nullptr),
+        mapped_bytes_(0),
+        live_objects_(0) {
+    cache_key_created_ = !pthread_key_create(&cache_key_, ReleaseCache);
+  }
+
+  ~SlabAllocator() {
+    if (cache_key_created_) {
+      pthread_key_delete(cache_key_);
+    }
+  }
+
+  // Return nullptr if out of memory
+  T *New() {
+    Cache *cache = GetCache();
+    Block *block = cache ? PopCache(cache) : AllocBatch(1);
+    if (!block) {
+      return nullptr;
+    }
+    live_objects_.fetch_add(1, std::memory_order_relaxed);
+    return new (block) T;
+  }
+
+  void Delete(T *object) {
+    if (!object) {
+      return;
+    }
+    object->~T();
+    live_objects_.fetch_sub(1, std::memory_order_relaxed);
+    auto *block = reinterpret_cast<Block *>(object);
+    auto *cache = static_cast<Cache *>(pthread_getspecific(cache_key_));
+    if (!cache) {
+      // Thread is exiting or cache creation failed
+      block->next = nullptr;
+      PushBatch(block);
+      return;
+    }
+    PushCache(cache, block);
+  }
+
+  // Bytes mapped for objects and thread caches
+  size_t Footprint() const {
+    return mapped_bytes_.load(std::memory_order_relaxed);
+  }
+
+  size_t LiveObjects() const {
+    return live_objects_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static const size_t kChunkSize = 256 * 1024;
+  static const size_t kBatchSize = 64;
+
+  // Overlay of a free block, the first word links blocks in a batch and the
+  // second links batches in the global pool
+  struct Block {
+    Block *next;
+    Block *next_batch;
+  };
+
+  union Storage {
+    Block block;
+    alignas(T) unsigned char object[sizeof(T)];
+  };
+
+  struct Cache {
+    SlabAllocator *owner;
+    Block *head;
+    size_t size;
+    Cache *next;
+  };
+
+  static_assert(sizeof(Cache) <= sizeof(Storage), "Cache is too large");
+
+  Cache *GetCache() {
+    auto *cache = static_cast<Cache *>(pthread_getspecific(cache_key_));
+    if (cache || !cache_key_created_) {
+      return cache;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex_);
+      cache = free_caches_;
+      if (cache) {
+        free_caches_ = cache->next;
+      } else {
+        cache = reinterpret_cast<Cache *>(CarveLocked());
+      }
+    }
+    if (!cache) {
+      return nullptr;
+    }
+    cache->owner = this;
+    cache->head = nullptr;
+    cache->size = 0;
+    cache->next = nullptr;
+    if (pthread_setspecific(cache_key_, cache)) {
+      RecycleCache(cache);
+      return nullptr;
+    }
+    return cache;
+  }
+
+  Block *PopCache(Cache *cache) {
+    if (!cache->head) {
+      cache->head = AllocBatch(kBatchSize);
+      cache->size = 0;
+      for (Block *block = cache->head; block; block = block->next) {
+        cache->size++;
+      }
+    }
+    Block *block = cache->head;
+    if (block) {
+      cache->head = block->next;
+      cache->size--;
+    }
+    return block;
+  }
+
+  void PushCache(Cache *cache, Block *block) {
+    block->next = cache->head;
+    cache->head = block;
+    if (++cache->size < kBatchSize * 2) {
+      return;
+    }
+
+    // Keep one batch for the following New, hand the rest to the pool
+    Block *last = cache->head;
+    for (size_t i = 1; i < kBatchSize; i++) {
+      last = last->next;
+    }
+    Block *batch = last->next;
+    last->next = nullptr;
+    cache->size = kBatchSize;
+    PushBatch(batch);
+  }
+
+  void PushBatch(Block *batch) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    batch->next_batch = free_batches_;
+    free_batches_ = batch;
+  }
+
+  // Take a freed batch from the pool, or carve up to |count| new blocks
+  Block *AllocBatch(size_t count) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    Block *batch = free_batches_;
+    if (batch) {
+      free_batches_ = batch->next_batch;
+      return batch;
+    }
+
+    Block *head = nullptr;
+    for (size_t i = 0; i < count; i++) {
+      Block *block = CarveLocked();
+      if (!block) {
+        break;
+      }
+      block->next = head;
+      head = block;
+    }
+    return head;
+  }
+
+  Block *CarveLocked() {
+    if (chunk_cursor_ + sizeof(Storage) > chunk_end_) {
+      void *chunk = mmap(nullptr, kChunkSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (chunk == MAP_FAILED) {
+        return nullptr;
+      }
+      chunk_cursor_ = static_cast<uint8_t *>(chunk);
+      chunk_end_ = chunk_cursor_ + kChunkSize;
+      mapped_bytes_.fetch_add(kChunkSize, std::memory_order_relaxed);
+    }
+    auto *block = reinterpret_cast<Block *>(chunk_cursor_);
+    chunk_cursor_ += sizeof(Storage);
+    return block;
+  }
+
+  void RecycleCache(Cache *cache) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    cache->next = free_caches_;
+    free_caches_ = cache;
+  }
+
+  // Called on thread exit, give the cached blocks back to the pool
+  static void ReleaseCache(void *value) {
+    auto *cache = static_cast<Cache *>(value);
+    SlabAllocator *owner = cache->owner;
+    if (cache->head) {
+      owner->PushBatch(cache->head);
+    }
+    owner->RecycleCache(cache);
+  }
+
+  pthread_key_t cache_key_;
+  bool cache_key_created_;
+  std::mutex pool_mutex_;
+  Block *free_batches_;
+  Cache *free_caches_;
+  uint8_t *chunk_cursor_;
+  uint8_t *chunk_end_;
+  std::atomic<size_t> mapped_bytes_;
+  std::atomic<size_t> live_objects_;
+};
+
+#endif  // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_SLAB_ALLOCATOR_H_
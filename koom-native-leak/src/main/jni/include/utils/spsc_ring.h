@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+#ifndef KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_SPSC_RING_H_
+#define KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_SPSC_RING_H_
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded single-producer single-consumer queue. Push is only called by the
+// producer thread and Consume by one consumer at a time, neither of them
+// waits for the other.
+template <typename T, size_t kCapacity>
+class SpscRing {
+  static_assert((kCapacity & (kCapacity - 1)) == 0,
+                "kCapacity must be power of 2");
+
+ public:
+  SpscRing() : head_(0), tail_(0), cached_head_(0) {}
+
+  // Return false if the ring is full
+  bool Push(const T &item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ == kCapacity) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ == kCapacity) {
+        return false;
+      }
+    }
+    items_[tail & (kCapacity - 1)] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Hand the queued items to |consumer| in order, return the count
+  template <typename C>
+  size_t Consume(C &consumer) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    for (size_t i = head; i != tail; i++) {
+      consumer(items_[i & (kCapacity - 1)]);
+    }
+    head_.store(tail, std::memory_order_release);
+    return tail - head;
+  }
+
+  // May be stale while the other side runs
+  size_t Size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  bool Empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+ private:
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+  // Producer side copy of head_, saves reading the consumer cache line
+  size_t cached_head_;
+  alignas(64) T items_[kCapacity];
+};
+
+#endif  // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_SPSC_RING_H_
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#ifndef KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_STACK_DEPOT_H_
+#define KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_STACK_DEPOT_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+// Interns stack traces: every distinct trace is stored once in an append-only
+// arena and identified by a stable 32-bit id, 0 is never a valid id.
+//
+// Lookup of an existing trace is lock-free, only the first Put of a new trace
+// takes the lock. Traces are never removed, memory is mmap-ed and the system
+// allocator is not used.
+class StackDepot {
+ public:
+  StackDepot();
+  ~StackDepot();
+  // Return 0 if out of memory
+  uint32_t Put(const uintptr_t *frames, uint32_t num_frames);
+  // |hash| must be kwai::util::StackHash of the frames, e.g. from the unwinder
+  uint32_t Put(const uintptr_t *frames, uint32_t num_frames, uint32_t hash);
+  // Return the number of frames, 0 if |id| is unknown
+  uint32_t Get(uint32_t id, const uintptr_t **frames) const;
+  uint32_t NumStacks() const;
+  // Bytes mapped: the buckets, the arena index and the arenas
+  size_t Footprint() const;
+
+ private:
+  struct Stack {
+    std::atomic<Stack *> next;
+    uint32_t hash;
+    uint32_t id;
+    uint32_t num_frames;
+    uintptr_t frames[0];
+  };
+
+  Stack *Find(Stack *head, uint32_t hash, const uintptr_t *frames,
+              uint32_t num_frames) const;
+  Stack *AllocStackLocked(uint32_t num_frames);
+
+  std::atomic<Stack *> *buckets_;
+  std::mutex insert_mutex_;
+  uint8_t **arenas_;
+  std::atomic<uint32_t> num_arenas_;
+  uint32_t arena_used_;
+  std::atomic<uint32_t> num_stacks_;
+  std::atomic<size_t> footprint_;
+};
+
+#endif  // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_STACK_DEPOT_H_
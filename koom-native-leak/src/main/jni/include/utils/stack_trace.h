@@ -28,16 +28,20 @@
 
 #include "constants.h"
 
-#define FAST_UNWIND_TLS_INITIAL_EXEC \
-  __thread __attribute__((tls_model("initial-exec")))
-
 #ifndef KWAI_EXPORT
 #define KWAI_EXPORT __attribute__((visibility("default")))
 #endif
 
 class StackTrace {
  public:
-  static size_t FastUnwind(uintptr_t *buf, size_t num_entries);
+  // Return address of every frame minus one instruction, and StackHash of
+  // them in |hash| if it is not null
+  static size_t FastUnwind(uintptr_t *buf, size_t num_entries,
+                           uint32_t *hash = nullptr);
+  // Reuse the frames beyond |depth| of the last unwinds of a thread if its
+  // outer stack didn't change, see kwai::util::FramePointerUnwindCached.
+  // 0 |depth| disables.
+  static void SetPrefixCache(size_t depth);
 };
 
 #endif  // KOOM_NATIVE_OOM_SRC_MAIN_JNI_INCLUDE_UTILS_STACK_TRACE_H_
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#define LOG_TAG "alloc_journal"
+#include "alloc_journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <link.h>
+#include <log/log.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace kwai {
+namespace leak_monitor {
+static const uint32_t kJournalMagic = 0x4c4e4a4b;  // "KJNL"
+static const uint32_t kJournalVersion = 1;
+static const uint32_t kMaxReportLarge = 64;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "Journal atomics must be lock free to live in a file mapping");
+
+struct JournalLarge {
+  // 0 while the slot is written, 1 + its ring position once complete
+  std::atomic<uint64_t> seq;
+  uint64_t index;
+  uint64_t size;
+  uint32_t kind;
+  uint32_t num_frames;
+  uintptr_t frames[kJournalLargeFrames];
+};
+
+struct JournalModule {
+  uintptr_t start;
+  uintptr_t end;
+  // Load bias, pc - bias is the address in the ELF file
+  uintptr_t bias;
+  char name[kJournalModuleNameLen];
+};
+
+struct JournalSnapshotStack {
+  int64_t live_bytes;
+  int64_t alloc_bytes;
+  uint32_t num_frames;
+  uint32_t reserved;
+  uintptr_t frames[kMaxBacktraceSize];
+};
+
+struct JournalSnapshot {
+  uint64_t seq;
+  uint64_t time_ms;
+  uint64_t alloc_index;
+  uint32_t num_stacks;
+  uint32_t num_modules;
+  JournalSnapshotStack stacks[kJournalStacks];
+  JournalModule modules[kJournalModules];
+};
+
+// File layout, in the byte order and pointer size of the writer
+struct AllocJournal::Journal {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pid;
+  uint32_t pointer_size;
+  uint64_t start_time_ms;
+  std::atomic<uint64_t> large_head;
+  // Sequence of the last complete snapshot, stored in snapshots[seq % 2]
+  std::atomic<uint64_t> snapshot_seq;
+  JournalLarge large[kJournalLargeSlots];
+  JournalSnapshot snapshots[2];
+};
+
+static uint64_t NowMs() {
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+}
+
+static void Appendf(std::string *out, const char *format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length > 0) {
+    out->append(buffer, std::min<size_t>(length, sizeof(buffer) - 1));
+  }
+}
+
+bool AllocJournal::Open(const std::string &path) {
+  std::string last_path = path + kJournalLastSuffix;
+  if (!access(path.c_str(), F_OK) &&
+      rename(path.c_str(), last_path.c_str())) {
+    ALOGW("Rename %s fail: %s", path.c_str(), strerror(errno));
+  }
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    ALOGE("Open %s fail: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  void *memory = MAP_FAILED;
+  if (!ftruncate(fd, sizeof(Journal))) {
+    memory = mmap(nullptr, sizeof(Journal), PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) {
+    ALOGE("Map %s fail: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  // The file is zero filled, magic goes last so a partial header is invalid
+  auto *journal = static_cast<Journal *>(memory);
+  journal->version = kJournalVersion;
+  journal->pid = getpid();
+  journal->pointer_size = sizeof(uintptr_t);
+  journal->start_time_ms = NowMs();
+  journal->magic = kJournalMagic;
+  auto *replaced = journal_.exchange(journal);
+  if (replaced) {
+    retired_journals_.push_back(replaced);
+  }
+  return true;
+}
+
+void AllocJournal::Close() {
+  auto *journal = journal_.exchange(nullptr);
+  if (journal) {
+    retired_journals_.push_back(journal);
+  }
+  for (auto *retired : retired_journals_) {
+    munmap(retired, sizeof(Journal));
+  }
+  retired_journals_.clear();
+}
+
+void AllocJournal::RecordLarge(uint64_t index, uint64_t size, uint32_t kind,
+                               const uintptr_t *frames, uint32_t num_frames) {
+  auto *journal = journal_.load(std::memory_order_acquire);
+  if (!journal) {
+    return;
+  }
+  uint64_t position =
+      journal->large_head.fetch_add(1, std::memory_order_relaxed);
+  auto &slot = journal->large[position % kJournalLargeSlots];
+  slot.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.index = index;
+  slot.size = size;
+  slot.kind = kind;
+  slot.num_frames = std::min(num_frames, kJournalLargeFrames);
+  for (uint32_t i = 0; i < slot.num_frames; i++) {
+    slot.frames[i] = frames[i];
+  }
+  slot.seq.store(position + 1, std::memory_order_release);
+}
+
+static int AddModule(dl_phdr_info *info, size_t, void *data) {
+  auto *snapshot = static_cast<JournalSnapshot *>(data);
+  if (snapshot->num_modules == kJournalModules) {
+    return 1;
+  }
+  if (!info->dlpi_name || !info->dlpi_name[0]) {
+    return 0;
+  }
+
+  uintptr_t start = UINTPTR_MAX;
+  uintptr_t end = 0;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    auto &phdr = info->dlpi_phdr[i];
+    if (phdr.p_type == PT_LOAD) {
+      start = std::min<uintptr_t>(start, info->dlpi_addr + phdr.p_vaddr);
+      end = std::max<uintptr_t>(end,
+                                info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz);
+    }
+  }
+  if (start >= end) {
+    return 0;
+  }
+
+  auto &module = snapshot->modules[snapshot->num_modules++];
+  module.start = start;
+  module.end = end;
+  module.bias = info->dlpi_addr;
+  // Keep the tail of a long path, the library name is at the end
+  size_t name_len = strlen(info->dlpi_name);
+  size_t skip = name_len < kJournalModuleNameLen
+                    ? 0
+                    : name_len - (kJournalModuleNameLen - 1);
+  memcpy(module.name, info->dlpi_name + skip, name_len - skip + 1);
+  return 0;
+}
+
+void AllocJournal::WriteSnapshot(uint64_t alloc_index,
+                                 const std::vector<JournalStack> &stacks) {
+  auto *journal = journal_.load(std::memory_order_acquire);
+  if (!journal) {
+    return;
+  }
+  uint64_t seq = journal->snapshot_seq.load(std::memory_order_relaxed) + 1;
+  auto &snapshot = journal->snapshots[seq % 2];
+  snapshot.seq = 0;
+  snapshot.time_ms = NowMs();
+  snapshot.alloc_index = alloc_index;
+  snapshot.num_stacks = std::min<size_t>(stacks.size(), kJournalStacks);
+  for (uint32_t i = 0; i < snapshot.num_stacks; i++) {
+    auto &stack = snapshot.stacks[i];
+    stack.live_bytes = stacks[i].live_bytes;
+    stack.alloc_bytes = stacks[i].alloc_bytes;
+    stack.num_frames = std::min(stacks[i].num_frames, kMaxBacktraceSize);
+    memcpy(stack.frames, stacks[i].frames,
+           stack.num_frames * sizeof(uintptr_t));
+  }
+  snapshot.num_modules = 0;
+  dl_iterate_phdr(AddModule, &snapshot);
+  snapshot.seq = seq;
+  journal->snapshot_seq.store(seq, std::memory_order_release);
+}
+
+static void AppendFrames(const uintptr_t *frames, uint32_t num_frames,
+                         const JournalSnapshot *snapshot, std::string *out) {
+  for (uint32_t i = 0; i < num_frames; i++) {
+    const JournalModule *module = nullptr;
+    for (uint32_t j = 0; snapshot && j < snapshot->num_modules; j++) {
+      auto &candidate = snapshot->modules[j];
+      if (frames[i] >= candidate.start && frames[i] < candidate.end) {
+        module = &candidate;
+        break;
+      }
+    }
+    if (module) {
+      Appendf(out, "    #%02u pc %016" PRIxPTR "  %.*s\n", i,
+              frames[i] - module->bias,
+              static_cast<int>(kJournalModuleNameLen), module->name);
+    } else {
+      Appendf(out, "    #%02u pc %016" PRIxPTR "  <unknown>\n", i,
+              frames[i]);
+    }
+  }
+}
+
+bool AllocJournal::Format(const std::string &path, std::string *report) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  std::vector<char> buffer;
+  struct stat st;
+  if (!fstat(fd, &st) && st.st_size == sizeof(Journal)) {
+    buffer.resize(sizeof(Journal));
+    size_t offset = 0;
+    ssize_t bytes;
+    while (offset < buffer.size() &&
+           (bytes = TEMP_FAILURE_RETRY(read(fd, buffer.data() + offset,
+                                            buffer.size() - offset))) > 0) {
+      offset += bytes;
+    }
+    buffer.resize(offset);
+  }
+  close(fd);
+  if (buffer.size() != sizeof(Journal)) {
+    return false;
+  }
+  auto *journal = reinterpret_cast<const Journal *>(buffer.data());
+  if (journal->magic != kJournalMagic || journal->version != kJournalVersion ||
+      journal->pointer_size != sizeof(uintptr_t)) {
+    return false;
+  }
+
+  report->clear();
+  Appendf(report, "Journal of pid %u, started at %" PRIu64 " ms\n",
+          journal->pid, journal->start_time_ms);
+
+  // A snapshot being written at death is incomplete, the previous one is not
+  uint64_t seq = journal->snapshot_seq.load(std::memory_order_relaxed);
+  const JournalSnapshot *snapshot = &journal->snapshots[seq % 2];
+  if (!seq || snapshot->seq != seq ||
+      snapshot->num_stacks > kJournalStacks ||
+      snapshot->num_modules > kJournalModules) {
+    snapshot = nullptr;
+    Appendf(report, "No snapshot\n");
+  } else {
+    Appendf(report,
+            "Snapshot at %" PRIu64 " ms (%" PRIu64 " ms after start), "
+            "alloc index %" PRIu64 "\n",
+            snapshot->time_ms, snapshot->time_ms - journal->start_time_ms,
+            snapshot->alloc_index);
+    Appendf(report, "Top call sites by live bytes:\n");
+    for (uint32_t i = 0; i < snapshot->num_stacks; i++) {
+      auto &stack = snapshot->stacks[i];
+      Appendf(report, "  live %" PRId64 " bytes, allocated %" PRId64
+              " bytes\n", stack.live_bytes, stack.alloc_bytes);
+      AppendFrames(stack.frames,
+                   std::min(stack.num_frames, kMaxBacktraceSize), snapshot,
+                   report);
+    }
+  }
+
+  uint64_t head = journal->large_head.load(std::memory_order_relaxed);
+  uint64_t tail = head > kJournalLargeSlots ? head - kJournalLargeSlots : 0;
+  Appendf(report, "Recent large allocations, latest first:\n");
+  uint32_t num_reported = 0;
+  for (uint64_t position = head; position > tail; position--) {
+    auto &slot = journal->large[(position - 1) % kJournalLargeSlots];
+    // Half written, or overwritten by a later wrap
+    if (slot.seq.load(std::memory_order_relaxed) != position) {
+      continue;
+    }
+    Appendf(report, "  index %" PRIu64 ", %" PRIu64 " bytes, kind %u\n",
+            slot.index, slot.size, slot.kind);
+    AppendFrames(slot.frames, std::min(slot.num_frames, kJournalLargeFrames),
+                 snapshot, report);
+    if (++num_reported == kMaxReportLarge) {
+      break;
+    }
+  }
+  return true;
+}
+}  // namespace leak_monitor
+}  // namespace kwai
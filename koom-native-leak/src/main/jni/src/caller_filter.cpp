@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#define LOG_TAG "caller_filter"
+#include "caller_filter.h"
+
+#include <dlopencb.h>
+#include <log/log.h>
+#include <sched.h>
+#include <string.h>
+
+#include "utils/proc_maps.h"
+
+namespace kwai {
+namespace leak_monitor {
+// DlopenCb only takes plain functions, there is one filter per monitor
+static CallerFilter *g_caller_filter;
+
+void CallerFilter::OnDlopen(std::set<std::string> &, int, std::string &) {
+  auto *filter = g_caller_filter;
+  if (filter) {
+    std::lock_guard<std::mutex> lock(filter->mutex_);
+    filter->RebuildLocked();
+  }
+}
+
+// DlopenCb calls back under its own lock, so it is never (un)registered
+// while mutex_ is held
+bool CallerFilter::Update(const std::vector<std::string> &patterns,
+                          bool include) {
+  if (!patterns.empty() && !callback_added_.exchange(true)) {
+    g_caller_filter = this;
+    DlopenCb::GetInstance().AddCallback(OnDlopen);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  patterns_ = patterns;
+  include_ = include;
+  if (patterns_.empty()) {
+    ReplaceLocked(nullptr);
+    return true;
+  }
+  return RebuildLocked();
+}
+
+// A reader loads the table only after it found the epoch unchanged since it
+// counted itself. One that still holds the old table therefore counted itself
+// in the epoch before the flip, and the flip waits for it; one that finds a
+// newer epoch counts itself again in that. The writers are serialized by
+// mutex_, so the epoch before a flip is the only one a reader of the old
+// table can be counted in.
+void CallerFilter::ReplaceLocked(Table *table) {
+  auto *old_table = table_.exchange(table);
+  if (!old_table) {
+    return;
+  }
+  uint32_t old_epoch = epoch_.fetch_add(1) & 1;
+  for (auto &stripe : stripes_) {
+    while (stripe.readers[old_epoch].load()) {
+      sched_yield();
+    }
+  }
+  delete old_table;
+}
+
+void CallerFilter::Clear() {
+  if (callback_added_.exchange(false)) {
+    DlopenCb::GetInstance().RemoveCallback(OnDlopen);
+    g_caller_filter = nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  ReplaceLocked(nullptr);
+  patterns_.clear();
+}
+
+bool CallerFilter::Match(const char *name, size_t name_len) const {
+  const char *base_name = static_cast<const char *>(
+      memrchr(name, '/', name_len));
+  base_name = base_name ? base_name + 1 : name;
+  size_t base_len = name + name_len - base_name;
+  for (auto &pattern : patterns_) {
+    if (pattern.find('/') != std::string::npos) {
+      if (name_len >= pattern.size() &&
+          !memcmp(name, pattern.data(), pattern.size())) {
+        return true;
+      }
+    } else if ((base_len == pattern.size() ||
+                (base_len == pattern.size() + 3 &&
+                 !memcmp(base_name + pattern.size(), ".so", 3))) &&
+               !memcmp(base_name, pattern.data(), pattern.size())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CallerFilter::RebuildLocked() {
+  if (patterns_.empty()) {
+    return true;
+  }
+  std::string maps;
+  if (!ReadProcMaps(&maps)) {
+    ALOGE("Read maps fail");
+    return false;
+  }
+
+  auto *table = new Table;
+  table->include = include_;
+  const char *cursor = maps.c_str();
+  MapsLine line;
+  while (ParseMapsLine(&cursor, &line)) {
+    if (line.permissions[2] != 'x' || !Match(line.name, line.name_len)) {
+      continue;
+    }
+    // Maps are sorted, merge adjacent ranges
+    if (!table->ends.empty() && table->ends.back() == line.start) {
+      table->ends.back() = line.end;
+    } else {
+      table->starts.push_back(line.start);
+      table->ends.push_back(line.end);
+    }
+  }
+
+  ReplaceLocked(table);
+  return true;
+}
+}  // namespace leak_monitor
+}  // namespace kwai
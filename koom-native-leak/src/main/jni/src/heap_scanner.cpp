@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#include "heap_scanner.h"
+
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include "utils/proc_maps.h"
+
+namespace kwai {
+namespace leak_monitor {
+static const size_t kBufferSize = 64 * 1024;
+static const size_t kPageSize = 4096;
+// Default vm.max_map_count, only the pages used are backed
+static const size_t kMaxRoots = 65536;
+static const int kForkScanTimeoutMs = 120 * 1000;
+static const int kForkScanPollMs = 10;
+
+// Top byte of heap pointers may carry a tag (TBI/MTE)
+static inline uintptr_t Untag(uintptr_t address) {
+#if defined(__aarch64__)
+  return address & ((1ULL << 56) - 1);
+#else
+  return address;
+#endif
+}
+
+static void *MapMemory(size_t size, bool shared) {
+  void *memory =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE,
+           (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS, -1, 0);
+  return memory == MAP_FAILED ? nullptr : memory;
+}
+
+static inline size_t MarksBytes(size_t num_blocks) {
+  return (num_blocks + 63) / 64 * sizeof(uint64_t);
+}
+
+// Mappings which are not memory or are slow to read
+static bool IgnoreMapping(const char *name, size_t name_len) {
+  auto starts_with = [&](const char *prefix) {
+    size_t prefix_len = strlen(prefix);
+    return name_len >= prefix_len && !memcmp(name, prefix, prefix_len);
+  };
+  return starts_with("[vvar]") || starts_with("[vsyscall]") ||
+         starts_with("[vectors]") ||
+         (starts_with("/dev/") && !starts_with("/dev/ashmem"));
+}
+
+HeapScanner::HeapScanner()
+    : blocks_(nullptr),
+      num_blocks_(0),
+      capacity_(0),
+      marks_(nullptr),
+      worklist_(nullptr),
+      worklist_size_(0),
+      buffer_(nullptr),
+      confused_min_address_(0),
+      confused_max_address_(UINTPTR_MAX),
+      roots_(nullptr),
+      num_roots_(0),
+      num_owned_(0) {}
+
+HeapScanner::~HeapScanner() { FreeMemory(); }
+
+bool HeapScanner::Reserve(size_t num_blocks) {
+  FreeMemory();
+  capacity_ = num_blocks ? num_blocks : 1;
+  blocks_ = static_cast<Block *>(MapMemory(capacity_ * sizeof(Block), false));
+  marks_ = static_cast<uint64_t *>(MapMemory(MarksBytes(capacity_), true));
+  worklist_ =
+      static_cast<uint32_t *>(MapMemory(capacity_ * sizeof(uint32_t), false));
+  buffer_ = static_cast<uintptr_t *>(MapMemory(kBufferSize, false));
+  roots_ = static_cast<Range *>(MapMemory(kMaxRoots * sizeof(Range), false));
+  if (!blocks_ || !marks_ || !worklist_ || !buffer_ || !roots_) {
+    FreeMemory();
+    return false;
+  }
+
+  auto own = [&](void *memory, size_t size) {
+    auto start = reinterpret_cast<uintptr_t>(memory);
+    owned_[num_owned_++] = {start, start + size};
+  };
+  own(blocks_, capacity_ * sizeof(Block));
+  own(marks_, MarksBytes(capacity_));
+  own(worklist_, capacity_ * sizeof(uint32_t));
+  own(buffer_, kBufferSize);
+  own(roots_, kMaxRoots * sizeof(Range));
+  return true;
+}
+
+void HeapScanner::AddBlock(uintptr_t address, size_t size) {
+  if (num_blocks_ == capacity_ || !size) {
+    return;
+  }
+  uintptr_t start = Untag(address);
+  blocks_[num_blocks_++] = {start, start + size, address};
+  confused_min_address_ = std::max(confused_min_address_, ~start);
+  confused_max_address_ = std::min(confused_max_address_, ~(start + size));
+}
+
+bool HeapScanner::Scan(bool fork_mode,
+                       std::vector<std::pair<uintptr_t, size_t>> *unreachable) {
+  if (!blocks_) {
+    return false;
+  }
+
+  std::sort(blocks_, blocks_ + num_blocks_,
+            [](const Block &a, const Block &b) { return a.start < b.start; });
+  // Stack below this frame is dead, but holds block copies left by sort
+  auto stack_pointer =
+      reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  if (!CollectRoots(stack_pointer)) {
+    return false;
+  }
+
+  if (fork_mode) {
+    if (!MarkInChild()) {
+      return false;
+    }
+  } else {
+    Mark();
+  }
+
+  for (size_t i = 0; i < num_blocks_; i++) {
+    if (!(marks_[i / 64] & (1ULL << (i % 64)))) {
+      unreachable->emplace_back(blocks_[i].address,
+                                blocks_[i].end - blocks_[i].start);
+    }
+  }
+  return true;
+}
+
+// Readable and writable mappings are roots, read-only ones can't hold
+// pointers to the heap. Only the live part of the current stack is a root.
+bool HeapScanner::CollectRoots(uintptr_t stack_pointer) {
+  std::string maps;
+  if (!ReadProcMaps(&maps)) {
+    return false;
+  }
+
+  num_roots_ = 0;
+  const char *cursor = maps.c_str();
+  MapsLine line;
+  while (num_roots_ < kMaxRoots && ParseMapsLine(&cursor, &line)) {
+    uintptr_t start = line.start;
+    if (stack_pointer >= start && stack_pointer < line.end) {
+      start = stack_pointer;
+    }
+    bool writable =
+        line.permissions[0] == 'r' && line.permissions[1] == 'w';
+    if (writable && start < line.end &&
+        !IgnoreMapping(line.name, line.name_len)) {
+      roots_[num_roots_++] = {start, line.end};
+    }
+  }
+  return true;
+}
+
+void HeapScanner::Mark() {
+  worklist_size_ = 0;
+  for (size_t i = 0; i < num_roots_; i++) {
+    ScanRoot(roots_[i].start, roots_[i].end);
+  }
+  while (worklist_size_) {
+    auto &block = blocks_[worklist_[--worklist_size_]];
+    ScanRange(block.start, block.end);
+  }
+}
+
+// Parent only waits, the child marks on a snapshot and only touches memory
+// mapped before fork
+bool HeapScanner::MarkInChild() {
+  pid_t pid = fork();
+  if (pid < 0) {
+    return false;
+  }
+  if (pid == 0) {
+    Mark();
+    _exit(0);
+  }
+
+  int status;
+  for (int waited = 0;; waited += kForkScanPollMs) {
+    pid_t result = TEMP_FAILURE_RETRY(waitpid(pid, &status, WNOHANG));
+    if (result == pid) {
+      return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    if (result < 0 || waited >= kForkScanTimeoutMs) {
+      kill(pid, SIGKILL);
+      TEMP_FAILURE_RETRY(waitpid(pid, &status, 0));
+      return false;
+    }
+    usleep(kForkScanPollMs * 1000);
+  }
+}
+
+// Scan the root except the tracked blocks and the scanner's own mappings
+void HeapScanner::ScanRoot(uintptr_t start, uintptr_t end) {
+  for (size_t i = 0; i < num_owned_; i++) {
+    auto &owned = owned_[i];
+    if (owned.start < end && start < owned.end) {
+      if (start < owned.start) {
+        ScanRoot(start, owned.start);
+      }
+      if (owned.end < end) {
+        ScanRoot(owned.end, end);
+      }
+      return;
+    }
+  }
+
+  auto *block = std::upper_bound(
+      blocks_, blocks_ + num_blocks_, start,
+      [](uintptr_t value, const Block &block) { return value < block.end; });
+  for (; block < blocks_ + num_blocks_ && block->start < end; block++) {
+    if (start < block->start) {
+      ScanRange(start, block->start);
+    }
+    start = std::max(start, block->end);
+  }
+  if (start < end) {
+    ScanRange(start, end);
+  }
+}
+
+// Memory is read by process_vm_readv, an unmapped page fails the read
+// instead of crashing
+void HeapScanner::ScanRange(uintptr_t start, uintptr_t end) {
+  start = (start + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
+  pid_t pid = getpid();
+  while (start + sizeof(uintptr_t) <= end) {
+    size_t length = std::min<uintptr_t>(end - start, kBufferSize);
+    iovec local = {buffer_, length};
+    iovec remote = {reinterpret_cast<void *>(start), length};
+    ssize_t bytes = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    if (bytes < 0) {
+      bytes = 0;
+    }
+    ScanWords(buffer_, bytes / sizeof(uintptr_t));
+    if (static_cast<size_t>(bytes) == length) {
+      start += length;
+    } else {
+      // Skip the page failed to read
+      start = (start + bytes + kPageSize) & ~(kPageSize - 1);
+    }
+  }
+}
+
+void HeapScanner::ScanWords(const uintptr_t *words, size_t num_words) {
+  uintptr_t min_address = ~confused_min_address_;
+  uintptr_t max_address = ~confused_max_address_;
+  for (size_t i = 0; i < num_words; i++) {
+    uintptr_t word = Untag(words[i]);
+    if (word < min_address || word >= max_address) {
+      continue;
+    }
+    auto *block = std::upper_bound(blocks_, blocks_ + num_blocks_, word,
+                                   [](uintptr_t value, const Block &block) {
+                                     return value < block.start;
+                                   });
+    if (block == blocks_ || word >= (--block)->end) {
+      continue;
+    }
+    size_t index = block - blocks_;
+    uint64_t bit = 1ULL << (index % 64);
+    if (!(marks_[index / 64] & bit)) {
+      marks_[index / 64] |= bit;
+      worklist_[worklist_size_++] = index;
+    }
+  }
+}
+
+void HeapScanner::FreeMemory() {
+  if (blocks_) {
+    munmap(blocks_, capacity_ * sizeof(Block));
+  }
+  if (marks_) {
+    munmap(marks_, MarksBytes(capacity_));
+  }
+  if (worklist_) {
+    munmap(worklist_, capacity_ * sizeof(uint32_t));
+  }
+  if (buffer_) {
+    munmap(buffer_, kBufferSize);
+  }
+  if (roots_) {
+    munmap(roots_, kMaxRoots * sizeof(Range));
+  }
+  blocks_ = nullptr;
+  marks_ = nullptr;
+  worklist_ = nullptr;
+  buffer_ = nullptr;
+  roots_ = nullptr;
+  num_blocks_ = 0;
+  num_roots_ = 0;
+  num_owned_ = 0;
+  confused_min_address_ = 0;
+  confused_max_address_ = UINTPTR_MAX;
+}
+}  // namespace leak_monitor
+}  // namespace kwai
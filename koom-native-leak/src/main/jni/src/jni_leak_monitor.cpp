@@ -18,18 +18,28 @@
  */
 
 #define LOG_TAG "jni_leak_monitor"
+#include <inttypes.h>
 #include <jni.h>
 #include <jni_util/scoped_local_ref.h>
-#include <libgen.h>
 #include <log/kcheck.h>
 #include <log/log.h>
 
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
 #include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "android/log.h"
 #include "leak_monitor.h"
+#include "leak_report.h"
 #include "memory_map.h"
+#include "utils/pprof_writer.h"
 
 namespace kwai {
 namespace leak_monitor {
@@ -53,6 +63,7 @@ struct ClassInfo {
 
 static ClassInfo g_leak_record;
 static ClassInfo g_frame_info;
+static ClassInfo g_heavy_hitter;
 
 static const char *kLeakMonitorFullyName =
     "com/kwai/koom/nativeoom/leakmonitor/LeakMonitor";
@@ -60,9 +71,25 @@ static const char *kLeakRecordFullyName =
     "com/kwai/koom/nativeoom/leakmonitor/LeakRecord";
 static const char *kFrameInfoFullyName =
     "com/kwai/koom/nativeoom/leakmonitor/FrameInfo";
+static const char *kHeavyHitterFullyName =
+    "com/kwai/koom/nativeoom/leakmonitor/HeavyHitter";
 static const uint32_t kNumDropFrame = 2;
 static MemoryMap g_memory_map;
 static bool g_enable_local_symbolic = false;
+static bool g_enable_offline_symbolic = false;
+static LeakReportWriter g_leak_report;
+// Guard g_memory_map and g_heap_snapshots, heap profile may be dumped from
+// any thread
+static std::mutex g_symbolize_mutex;
+// Oldest first, see TakeHeapSnapshot
+static std::deque<HeapProfile> g_heap_snapshots;
+
+struct Frame {
+  jlong rel_pc;
+  std::string so_name;
+  // Empty unless offline symbolic is enabled
+  std::string build_id;
+};
 
 static void Clean(JNIEnv *env) {
   if (g_leak_record.global_ref) {
@@ -73,6 +100,10 @@ static void Clean(JNIEnv *env) {
     env->DeleteGlobalRef(g_frame_info.global_ref);
     memset(&g_frame_info, 0, sizeof(g_frame_info));
   }
+  if (g_heavy_hitter.global_ref) {
+    env->DeleteGlobalRef(g_heavy_hitter.global_ref);
+    memset(&g_heavy_hitter, 0, sizeof(g_heavy_hitter));
+  }
 }
 
 template <typename T>
@@ -86,10 +117,34 @@ static inline bool CheckedClean(JNIEnv *env, T value) {
 
 static void UninstallMonitor(JNIEnv *env, jclass) {
   LeakMonitor::GetInstance().Uninstall();
-  g_memory_map.~MemoryMap();
+  std::lock_guard<std::mutex> lock(g_symbolize_mutex);
+  g_memory_map.Clear();
+  g_leak_report.Reset();
+  g_heap_snapshots.clear();
   Clean(env);
 }
 
+static std::vector<std::string> ArrayToVector(JNIEnv *env,
+                                              jobjectArray jobject_array) {
+  std::vector<std::string> ret;
+  int length = env->GetArrayLength(jobject_array);
+
+  if (length <= 0) {
+    return ret;
+  }
+
+  for (jsize i = 0; i < length; i++) {
+    auto str =
+        reinterpret_cast<jstring>(env->GetObjectArrayElement(jobject_array, i));
+    const char *data = env->GetStringUTFChars(str, nullptr);
+    ret.emplace_back(data);
+    env->ReleaseStringUTFChars(str, data);
+    env->DeleteLocalRef(str);
+  }
+
+  return ret;
+}
+
 static bool InstallMonitor(JNIEnv *env, jclass clz, jobjectArray selected_array,
                            jobjectArray ignore_array,
                            jboolean enable_local_symbolic) {
@@ -101,8 +156,8 @@ static bool InstallMonitor(JNIEnv *env, jclass clz, jobjectArray selected_array,
     return false;
   }
   GET_METHOD_ID(g_leak_record.construct_method, leak_record, "<init>",
-                "(JILjava/lang/String;[Lcom/kwai/koom/nativeoom/leakmonitor/"
-                "FrameInfo;)V");
+                "(JIJLjava/lang/String;[Lcom/kwai/koom/nativeoom/leakmonitor/"
+                "FrameInfo;I)V");
 
   jclass frame_info;
   FIND_CLASS(frame_info, kFrameInfoFullyName);
@@ -112,32 +167,22 @@ static bool InstallMonitor(JNIEnv *env, jclass clz, jobjectArray selected_array,
     return false;
   }
   GET_METHOD_ID(g_frame_info.construct_method, frame_info, "<init>",
-                "(JLjava/lang/String;)V");
-
-  g_enable_local_symbolic = enable_local_symbolic;
+                "(JLjava/lang/String;Ljava/lang/String;)V");
 
-  auto array_to_vector =
-      [](JNIEnv *env, jobjectArray jobject_array) -> std::vector<std::string> {
-    std::vector<std::string> ret;
-    int length = env->GetArrayLength(jobject_array);
-
-    if (length <= 0) {
-      return ret;
-    }
-
-    for (jsize i = 0; i < length; i++) {
-      auto str = reinterpret_cast<jstring>(
-          env->GetObjectArrayElement(jobject_array, i));
-      const char *data = env->GetStringUTFChars(str, nullptr);
-      ret.emplace_back(data);
-      env->ReleaseStringUTFChars(str, data);
-    }
+  jclass heavy_hitter;
+  FIND_CLASS(heavy_hitter, kHeavyHitterFullyName);
+  g_heavy_hitter.global_ref =
+      reinterpret_cast<jclass>(env->NewGlobalRef(heavy_hitter));
+  if (!CheckedClean(env, g_heavy_hitter.global_ref)) {
+    return false;
+  }
+  GET_METHOD_ID(g_heavy_hitter.construct_method, heavy_hitter, "<init>",
+                "(JJJ[Lcom/kwai/koom/nativeoom/leakmonitor/FrameInfo;)V");
 
-    return std::move(ret);
-  };
+  g_enable_local_symbolic = enable_local_symbolic;
 
-  std::vector<std::string> selected_so = array_to_vector(env, selected_array);
-  std::vector<std::string> ignore_so = array_to_vector(env, ignore_array);
+  std::vector<std::string> selected_so = ArrayToVector(env, selected_array);
+  std::vector<std::string> ignore_so = ArrayToVector(env, ignore_array);
   return CheckedClean(
       env, LeakMonitor::GetInstance().Install(&selected_so, &ignore_so));
 }
@@ -149,33 +194,185 @@ static void SetMonitorThreshold(JNIEnv *, jclass, jint size) {
   LeakMonitor::GetInstance().SetMonitorThreshold(size);
 }
 
+static void SetMonitorSampleInterval(JNIEnv *, jclass, jint interval) {
+  if (interval < 0) {
+    interval = 0;
+  }
+  LeakMonitor::GetInstance().SetSampleInterval(interval);
+}
+
+static void SetMonitorAsyncRecord(JNIEnv *, jclass, jboolean enable) {
+  LeakMonitor::GetInstance().SetAsyncRecord(enable);
+}
+
+static void SetMonitorOfflineSymbolic(JNIEnv *, jclass, jboolean enable) {
+  g_enable_offline_symbolic = enable;
+}
+
+static jboolean SetMonitorCallerFilter(JNIEnv *env, jclass,
+                                       jobjectArray patterns,
+                                       jboolean include) {
+  return LeakMonitor::GetInstance().SetCallerFilter(
+      ArrayToVector(env, patterns), include);
+}
+
+static void SetMonitorScanMode(JNIEnv *, jclass, jint mode) {
+  LeakMonitor::GetInstance().SetScanMode(mode);
+}
+
+static void SetMonitorIncrementalScan(JNIEnv *, jclass, jint age_scans,
+                                      jint aged_scan_interval) {
+  LeakMonitor::GetInstance().SetIncrementalScan(
+      age_scans > 0 ? age_scans : 0,
+      aged_scan_interval > 0 ? aged_scan_interval : 1);
+}
+
+static void SetMonitorUnwindCache(JNIEnv *, jclass, jint depth) {
+  LeakMonitor::GetInstance().SetUnwindCache(depth > 0 ? depth : 0);
+}
+
+// Fields in the order of ScanStats.kt
+static jlongArray GetScanStats(JNIEnv *env, jclass) {
+  ScanStats stats = LeakMonitor::GetInstance().GetScanStats();
+  jlong values[] = {static_cast<jlong>(stats.scan_count),
+                    static_cast<jlong>(stats.live),
+                    static_cast<jlong>(stats.candidates),
+                    static_cast<jlong>(stats.leaks),
+                    static_cast<jlong>(stats.time_us), stats.full};
+  jlongArray array = env->NewLongArray(sizeof(values) / sizeof(values[0]));
+  if (array) {
+    env->SetLongArrayRegion(array, 0, sizeof(values) / sizeof(values[0]),
+                            values);
+  }
+  return array;
+}
+
+static void SetMonitorMemoryBudget(JNIEnv *, jclass, jlong budget,
+                                   jint policy) {
+  LeakMonitor::GetInstance().SetMemoryBudget(budget > 0 ? budget : 0, policy);
+}
+
+// Fields in the order of TrackerMemory.kt
+static jlongArray GetTrackerMemory(JNIEnv *env, jclass) {
+  TrackerMemory memory = LeakMonitor::GetInstance().GetTrackerMemory();
+  jlong values[] = {static_cast<jlong>(memory.Total()),
+                    static_cast<jlong>(memory.records),
+                    static_cast<jlong>(memory.live_records),
+                    static_cast<jlong>(memory.hash_map),
+                    static_cast<jlong>(memory.stack_depot),
+                    static_cast<jlong>(memory.num_stacks),
+                    static_cast<jlong>(memory.event_buffers),
+                    static_cast<jlong>(memory.counters),
+                    static_cast<jlong>(memory.budget),
+                    static_cast<jlong>(memory.evicted_records),
+                    static_cast<jlong>(memory.evicted_bytes),
+                    static_cast<jlong>(memory.dropped_records)};
+  jlongArray array = env->NewLongArray(sizeof(values) / sizeof(values[0]));
+  if (array) {
+    env->SetLongArrayRegion(array, 0, sizeof(values) / sizeof(values[0]),
+                            values);
+  }
+  return array;
+}
+
+static jboolean SetMonitorJournal(JNIEnv *env, jclass, jstring path,
+                                  jint interval_ms, jlong large_threshold) {
+  const char *file_path = env->GetStringUTFChars(path, nullptr);
+  std::string journal_path(file_path ? file_path : "");
+  env->ReleaseStringUTFChars(path, file_path);
+  return LeakMonitor::GetInstance().SetJournal(
+      journal_path, interval_ms > 0 ? interval_ms : 1,
+      large_threshold > 0 ? large_threshold : 1);
+}
+
+// Report of the journal a past session left at |path|, null if there is none
+static jstring FormatJournal(JNIEnv *env, jclass, jstring path) {
+  const char *file_path = env->GetStringUTFChars(path, nullptr);
+  std::string report;
+  bool formatted = file_path && AllocJournal::Format(file_path, &report);
+  env->ReleaseStringUTFChars(path, file_path);
+  return formatted ? env->NewStringUTF(report.c_str()) : nullptr;
+}
+
 static jlong GetAllocIndex(JNIEnv *, jclass) {
   return LeakMonitor::GetInstance().CurrentAllocIndex();
 }
 
-static jobjectArray BuildFrames(
-    JNIEnv *env, std::vector<std::pair<jlong, std::string>> &frames) {
+static jobjectArray BuildFrames(JNIEnv *env, std::vector<Frame> &frames) {
   jsize index = 0;
   jobjectArray frame_array =
       env->NewObjectArray(frames.size(), g_frame_info.global_ref, nullptr);
   for (auto &frame : frames) {
     ScopedLocalRef<jstring> so_name(env,
-                                    env->NewStringUTF(frame.second.c_str()));
+                                    env->NewStringUTF(frame.so_name.c_str()));
+    ScopedLocalRef<jstring> build_id(
+        env, frame.build_id.empty()
+                 ? nullptr
+                 : env->NewStringUTF(frame.build_id.c_str()));
     ScopedLocalRef<jobject> frame_info(
         env,
         env->NewObject(g_frame_info.global_ref, g_frame_info.construct_method,
-                       frame.first, so_name.get()));
+                       frame.rel_pc, so_name.get(), build_id.get()));
     env->SetObjectArrayElement(frame_array, index++, frame_info.get());
   }
   return frame_array;
 }
 
+// LeakRecord.size is an Int, the estimated size keeps the bytes of a larger one
+static inline uint32_t JavaSize(uint64_t size) {
+  return static_cast<uint32_t>(std::min<uint64_t>(size, INT32_MAX));
+}
+
 static jobject BuildLeakRecord(JNIEnv *env, uint64_t index, uint32_t size,
-                               char *thread_name, jobjectArray frames) {
+                               uint64_t estimated_size, char *thread_name,
+                               jobjectArray frames, jint kind) {
   ScopedLocalRef<jstring> name(env, env->NewStringUTF(thread_name));
   return env->NewObject(g_leak_record.global_ref,
-                        g_leak_record.construct_method, index, size, name.get(),
-                        frames);
+                        g_leak_record.construct_method, index, size,
+                        estimated_size, name.get(), frames, kind);
+}
+
+// Frames of the stack below the monitor itself, up to the first ignored module
+static bool CollectFrames(uint32_t stack_id, std::vector<Frame> *frames) {
+  const uintptr_t *backtrace;
+  uint32_t num_backtraces =
+      LeakMonitor::GetInstance().GetBacktrace(stack_id, &backtrace);
+  if (num_backtraces <= kNumDropFrame) {
+    return false;
+  }
+
+  num_backtraces -= kNumDropFrame;
+  for (int i = 0; i < num_backtraces; i++) {
+    uintptr_t offset;
+    auto *map_entry =
+        g_memory_map.CalculateRelPc(backtrace[i + kNumDropFrame], &offset);
+
+    if (!map_entry) {
+      continue;
+    }
+
+    if (map_entry->NeedIgnore()) {
+      num_backtraces = i;
+      break;
+    }
+
+    std::string symbol_info =
+        g_enable_local_symbolic
+            ? g_memory_map.FormatSymbol(map_entry, backtrace[i + kNumDropFrame])
+            : map_entry->BaseName();
+    frames->push_back({static_cast<jlong>(offset), std::move(symbol_info),
+                       g_enable_offline_symbolic ? map_entry->build_id
+                                                 : std::string()});
+  }
+
+  return num_backtraces && !frames->empty();
+}
+
+static void LogSymbolCache() {
+  if (g_enable_local_symbolic) {
+    ALOGI("Symbol cache hit %" PRIu64 " miss %" PRIu64,
+          g_memory_map.SymbolCacheHits(), g_memory_map.SymbolCacheMisses());
+  }
 }
 
 static void GetLeakAllocs(JNIEnv *env, jclass, jobject leak_record_map) {
@@ -186,52 +383,198 @@ static void GetLeakAllocs(JNIEnv *env, jclass, jobject leak_record_map) {
   std::vector<std::shared_ptr<AllocRecord>> leak_allocs =
       LeakMonitor::GetInstance().GetLeakAllocs();
 
+  std::lock_guard<std::mutex> lock(g_symbolize_mutex);
   for (auto &leak_alloc : leak_allocs) {
-    if (leak_alloc->num_backtraces <= kNumDropFrame) {
+    std::vector<Frame> frames;
+    if (!CollectFrames(leak_alloc->stack_id, &frames)) {
       continue;
     }
 
-    leak_alloc->num_backtraces -= kNumDropFrame;
-    std::vector<std::pair<jlong, std::string>> frames;
-    for (int i = 0; i < leak_alloc->num_backtraces; i++) {
-      uintptr_t offset;
-      auto *map_entry = g_memory_map.CalculateRelPc(
-          leak_alloc->backtrace[i + kNumDropFrame], &offset);
+    char address[sizeof(uintptr_t) * 2 + 1];
+    snprintf(address, sizeof(uintptr_t) * 2 + 1, "%lx",
+             CONFUSE(leak_alloc->address));
+    ScopedLocalRef<jstring> memory_address(env, env->NewStringUTF(address));
+    ScopedLocalRef<jobjectArray> frames_ref(env, BuildFrames(env, frames));
+    ScopedLocalRef<jobject> leak_record_ref(
+        env, BuildLeakRecord(env, leak_alloc->index, JavaSize(leak_alloc->size),
+                             leak_alloc->estimated_size,
+                             leak_alloc->thread_name, frames_ref.get(),
+                             leak_alloc->kind));
+    ScopedLocalRef<jobject> no_use(
+        env,
+        env->CallObjectMethod(leak_record_map, put_method, memory_address.get(),
+                              leak_record_ref.get()));
+  }
+
+  LogSymbolCache();
+}
 
-      if (!map_entry) {
+// One JNI crossing per report. g_leak_report is reused by the next call and
+// cleared by uninstall, so it is copied into the Java array under the lock
+static jbyteArray GetLeakReport(JNIEnv *env, jclass) {
+  std::vector<std::shared_ptr<AllocRecord>> leak_allocs =
+      LeakMonitor::GetInstance().GetLeakAllocs();
+
+  std::lock_guard<std::mutex> lock(g_symbolize_mutex);
+  g_leak_report.Reset();
+  std::vector<Frame> frames;
+  for (auto &leak_alloc : leak_allocs) {
+    frames.clear();
+    if (!CollectFrames(leak_alloc->stack_id, &frames)) {
+      continue;
+    }
+
+    g_leak_report.AddRecord(CONFUSE(leak_alloc->address), leak_alloc->index,
+                            JavaSize(leak_alloc->size),
+                            leak_alloc->estimated_size,
+                            leak_alloc->thread_name, leak_alloc->kind,
+                            frames.size());
+    for (auto &frame : frames) {
+      g_leak_report.AddFrame(frame.rel_pc, frame.so_name, frame.build_id);
+    }
+  }
+
+  LogSymbolCache();
+  auto &report = g_leak_report.Finish();
+  jbyteArray result = env->NewByteArray(static_cast<jsize>(report.size()));
+  if (!result) {
+    return nullptr;
+  }
+  env->SetByteArrayRegion(result, 0, static_cast<jsize>(report.size()),
+                          reinterpret_cast<const jbyte *>(report.data()));
+  return result;
+}
+
+static jobjectArray GetHeavyHitters(JNIEnv *env, jclass) {
+  std::vector<HeavyHitters::Entry> heavy_hitters;
+  LeakMonitor::GetInstance().GetHeavyHitters(&heavy_hitters);
+
+  std::lock_guard<std::mutex> lock(g_symbolize_mutex);
+  std::vector<jobject> results;
+  std::vector<Frame> frames;
+  for (auto &heavy_hitter : heavy_hitters) {
+    frames.clear();
+    if (!CollectFrames(heavy_hitter.stack_id, &frames)) {
+      continue;
+    }
+    ScopedLocalRef<jobjectArray> frames_ref(env, BuildFrames(env, frames));
+    results.push_back(env->NewObject(
+        g_heavy_hitter.global_ref, g_heavy_hitter.construct_method,
+        static_cast<jlong>(heavy_hitter.alloc_bytes),
+        static_cast<jlong>(heavy_hitter.error),
+        static_cast<jlong>(heavy_hitter.live_bytes), frames_ref.get()));
+  }
+
+  LogSymbolCache();
+  jobjectArray result_array =
+      env->NewObjectArray(results.size(), g_heavy_hitter.global_ref, nullptr);
+  for (size_t i = 0; i < results.size(); i++) {
+    env->SetObjectArrayElement(result_array, i, results[i]);
+    env->DeleteLocalRef(results[i]);
+  }
+  return result_array;
+}
+
+// Heap profile in pprof format: sample values are inuse objects and bytes,
+// locations are absolute pcs in mappings carrying the build-id, so pprof can
+// symbolize them offline. Functions are only named with local symbolic.
+static std::string EncodeHeapProfile(const HeapProfile &profile) {
+  PprofWriter writer;
+  writer.AddSampleType("inuse_objects", "count");
+  writer.AddSampleType("inuse_space", "bytes");
+  writer.SetPeriod("space", "bytes", 1);
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  writer.SetTimeNanos(now.tv_sec * 1000000000LL + now.tv_nsec);
+
+  std::unordered_map<uintptr_t, uint64_t> mapping_ids;
+  std::unordered_map<uintptr_t, uint64_t> location_ids;
+  std::vector<uint64_t> locations;
+  for (auto &entry : profile.entries) {
+    const uintptr_t *backtrace;
+    uint32_t num_backtraces =
+        LeakMonitor::GetInstance().GetBacktrace(entry.stack_id, &backtrace);
+    locations.clear();
+    for (uint32_t i = kNumDropFrame; i < num_backtraces; i++) {
+      uintptr_t pc = backtrace[i];
+      auto location = location_ids.find(pc);
+      if (location != location_ids.end()) {
+        locations.push_back(location->second);
         continue;
       }
 
+      auto *map_entry = g_memory_map.CalculateRelPc(pc);
+      if (!map_entry) {
+        continue;
+      }
       if (map_entry->NeedIgnore()) {
-        leak_alloc->num_backtraces = i;
         break;
       }
-
-      std::string symbol_info =
-          g_enable_local_symbolic
-              ? g_memory_map.FormatSymbol(
-                    map_entry, leak_alloc->backtrace[i + kNumDropFrame])
-              : basename(map_entry->name.c_str());
-      frames.emplace_back(static_cast<jlong>(offset), symbol_info);
+      auto mapping = mapping_ids.find(map_entry->start);
+      if (mapping == mapping_ids.end()) {
+        mapping = mapping_ids
+                      .emplace(map_entry->start,
+                               writer.AddMapping(
+                                   map_entry->start, map_entry->end,
+                                   map_entry->offset, map_entry->name,
+                                   map_entry->build_id))
+                      .first;
+      }
+      uint64_t location_id = writer.AddLocation(
+          mapping->second, pc,
+          g_enable_local_symbolic ? g_memory_map.FormatSymbol(map_entry, pc)
+                                  : std::string());
+      location_ids.emplace(pc, location_id);
+      locations.push_back(location_id);
     }
+    if (!locations.empty()) {
+      writer.AddSample(locations, {entry.count, entry.bytes});
+    }
+  }
+  return writer.Serialize();
+}
 
-    if (!leak_alloc->num_backtraces || frames.empty()) {
-      continue;
+// Keep the profile to diff later profiles against, return its alloc index
+static jlong TakeHeapSnapshot(JNIEnv *, jclass) {
+  HeapProfile profile = LeakMonitor::GetInstance().GetHeapProfile();
+  jlong alloc_index = profile.alloc_index;
+  std::lock_guard<std::mutex> lock(g_symbolize_mutex);
+  if (g_heap_snapshots.size() == kMaxHeapSnapshots) {
+    g_heap_snapshots.pop_front();
+  }
+  g_heap_snapshots.push_back(std::move(profile));
+  return alloc_index;
+}
+
+// Dump the live heap profile to |path|, or its diff from the snapshot taken
+// at |base_index| if it is not negative
+static jboolean DumpHeapProfile(JNIEnv *env, jclass, jstring path,
+                                jlong base_index) {
+  HeapProfile profile = LeakMonitor::GetInstance().GetHeapProfile();
+  std::lock_guard<std::mutex> lock(g_symbolize_mutex);
+  if (base_index >= 0) {
+    auto base = std::find_if(g_heap_snapshots.begin(), g_heap_snapshots.end(),
+                             [&](const HeapProfile &snapshot) {
+                               return snapshot.alloc_index == base_index;
+                             });
+    if (base == g_heap_snapshots.end()) {
+      ALOGE("No heap snapshot at alloc index %" PRId64, base_index);
+      return false;
     }
+    profile = profile.Diff(*base);
+  }
+  std::string encoded = EncodeHeapProfile(profile);
 
-    char address[sizeof(uintptr_t) * 2 + 1];
-    snprintf(address, sizeof(uintptr_t) * 2 + 1, "%lx",
-             CONFUSE(leak_alloc->address));
-    ScopedLocalRef<jstring> memory_address(env, env->NewStringUTF(address));
-    ScopedLocalRef<jobjectArray> frames_ref(env, BuildFrames(env, frames));
-    ScopedLocalRef<jobject> leak_record_ref(
-        env, BuildLeakRecord(env, leak_alloc->index, leak_alloc->size,
-                             leak_alloc->thread_name, frames_ref.get()));
-    ScopedLocalRef<jobject> no_use(
-        env,
-        env->CallObjectMethod(leak_record_map, put_method, memory_address.get(),
-                              leak_record_ref.get()));
+  const char *file_path = env->GetStringUTFChars(path, nullptr);
+  FILE *file = fopen(file_path, "we");
+  env->ReleaseStringUTFChars(path, file_path);
+  if (!file) {
+    ALOGE("Open heap profile fail %s", strerror(errno));
+    return false;
   }
+  bool written = fwrite(encoded.data(), 1, encoded.size(), file) ==
+                 encoded.size();
+  return !fclose(file) && written;
 }
 
 static const JNINativeMethod kLeakMonitorMethods[] = {
@@ -241,9 +584,41 @@ static const JNINativeMethod kLeakMonitorMethods[] = {
      reinterpret_cast<void *>(UninstallMonitor)},
     {"nativeSetMonitorThreshold", "(I)V",
      reinterpret_cast<void *>(SetMonitorThreshold)},
+    {"nativeSetMonitorSampleInterval", "(I)V",
+     reinterpret_cast<void *>(SetMonitorSampleInterval)},
+    {"nativeSetMonitorAsyncRecord", "(Z)V",
+     reinterpret_cast<void *>(SetMonitorAsyncRecord)},
+    {"nativeSetMonitorOfflineSymbolic", "(Z)V",
+     reinterpret_cast<void *>(SetMonitorOfflineSymbolic)},
+    {"nativeSetMonitorCallerFilter", "([Ljava/lang/String;Z)Z",
+     reinterpret_cast<void *>(SetMonitorCallerFilter)},
+    {"nativeSetMonitorScanMode", "(I)V",
+     reinterpret_cast<void *>(SetMonitorScanMode)},
+    {"nativeSetMonitorIncrementalScan", "(II)V",
+     reinterpret_cast<void *>(SetMonitorIncrementalScan)},
+    {"nativeSetMonitorUnwindCache", "(I)V",
+     reinterpret_cast<void *>(SetMonitorUnwindCache)},
+    {"nativeGetScanStats", "()[J", reinterpret_cast<void *>(GetScanStats)},
+    {"nativeSetMonitorMemoryBudget", "(JI)V",
+     reinterpret_cast<void *>(SetMonitorMemoryBudget)},
+    {"nativeGetTrackerMemory", "()[J",
+     reinterpret_cast<void *>(GetTrackerMemory)},
+    {"nativeSetMonitorJournal", "(Ljava/lang/String;IJ)Z",
+     reinterpret_cast<void *>(SetMonitorJournal)},
+    {"nativeFormatJournal", "(Ljava/lang/String;)Ljava/lang/String;",
+     reinterpret_cast<void *>(FormatJournal)},
     {"nativeGetAllocIndex", "()J", reinterpret_cast<void *>(GetAllocIndex)},
     {"nativeGetLeakAllocs", "(Ljava/util/Map;)V",
-     reinterpret_cast<void *>(GetLeakAllocs)}};
+     reinterpret_cast<void *>(GetLeakAllocs)},
+    {"nativeGetLeakReport", "()[B",
+     reinterpret_cast<void *>(GetLeakReport)},
+    {"nativeTakeHeapSnapshot", "()J",
+     reinterpret_cast<void *>(TakeHeapSnapshot)},
+    {"nativeDumpHeapProfile", "(Ljava/lang/String;J)Z",
+     reinterpret_cast<void *>(DumpHeapProfile)},
+    {"nativeGetHeavyHitters",
+     "()[Lcom/kwai/koom/nativeoom/leakmonitor/HeavyHitter;",
+     reinterpret_cast<void *>(GetHeavyHitters)}};
 
 extern "C" JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *reserved) {
   JNIEnv *env;
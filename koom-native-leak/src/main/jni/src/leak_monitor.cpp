@@ -23,23 +23,36 @@
 #include <asm/mman.h>
 #include <assert.h>
 #include <dlfcn.h>
+#include <inttypes.h>
 #include <kwai_util/kwai_macros.h>
 #include <log/kcheck.h>
 #include <log/log.h>
+#include <math.h>
+#include <stdarg.h>
 #include <pthread.h>
 #include <sys/mman.h>
 #include <sys/prctl.h>
+#include <time.h>
 #include <unistd.h>
 #include <unwind.h>
 #include <utils/hook_helper.h>
 #include <utils/stack_trace.h>
 
+#include <algorithm>
 #include <functional>
+#include <new>
 #include <regex>
 #include <thread>
 
 #include "kwai_linker/kwai_dlfcn.h"
+#include "heap_scanner.h"
 #include "utils/auto_time.h"
+#include "utils/range_index.h"
+
+// libc++ only declares the sized deletes under -fsized-deallocation, which
+// clang leaves off by default; libc++_shared defines them anyway
+void operator delete(void *ptr, size_t size) noexcept;
+void operator delete[](void *ptr, size_t size) noexcept;
 
 namespace kwai {
 namespace leak_monitor {
@@ -54,47 +67,53 @@ namespace leak_monitor {
 #define WRAP(x) x##Monitor
 #define HOOK(ret_type, function, ...) \
   static ALWAYS_INLINE ret_type WRAP(function)(__VA_ARGS__)
+// Return address of the hook, in the module calling the allocator
+#define CALLER_PC() reinterpret_cast<uintptr_t>(__builtin_return_address(0))
 
 // Define allocator proxies; aligned_alloc included in API 28 and valloc/pvalloc
 // can ignore in LP64 So we can't proxy aligned_alloc/valloc/pvalloc.
+// Frees take their index before the memory is freed, another thread may
+// allocate the address again as soon as it is.
 HOOK(void, free, void *ptr) {
+  auto free_index = LeakMonitor::GetInstance().FreeIndex();
   free(ptr);
   if (ptr) {
     LeakMonitor::GetInstance().UnregisterAlloc(
-        reinterpret_cast<uintptr_t>(ptr));
+        reinterpret_cast<uintptr_t>(ptr), free_index);
   }
 }
 
 HOOK(void *, malloc, size_t size) {
   auto result = malloc(size);
   LeakMonitor::GetInstance().OnMonitor(reinterpret_cast<intptr_t>(result),
-                                       size);
+                                       size, CALLER_PC());
   CLEAR_MEMORY(result, size);
   return result;
 }
 
 HOOK(void *, realloc, void *ptr, size_t size) {
+  auto free_index = LeakMonitor::GetInstance().FreeIndex();
   auto result = realloc(ptr, size);
   if (ptr != nullptr) {
     LeakMonitor::GetInstance().UnregisterAlloc(
-        reinterpret_cast<uintptr_t>(ptr));
+        reinterpret_cast<uintptr_t>(ptr), free_index);
   }
   LeakMonitor::GetInstance().OnMonitor(reinterpret_cast<intptr_t>(result),
-                                       size);
+                                       size, CALLER_PC());
   return result;
 }
 
 HOOK(void *, calloc, size_t item_count, size_t item_size) {
   auto result = calloc(item_count, item_size);
   LeakMonitor::GetInstance().OnMonitor(reinterpret_cast<intptr_t>(result),
-                                       item_count * item_size);
+                                       item_count * item_size, CALLER_PC());
   return result;
 }
 
 HOOK(void *, memalign, size_t alignment, size_t byte_count) {
   auto result = memalign(alignment, byte_count);
   LeakMonitor::GetInstance().OnMonitor(reinterpret_cast<intptr_t>(result),
-                                       byte_count);
+                                       byte_count, CALLER_PC());
   CLEAR_MEMORY(result, byte_count);
   return result;
 }
@@ -102,11 +121,153 @@ HOOK(void *, memalign, size_t alignment, size_t byte_count) {
 HOOK(int, posix_memalign, void **memptr, size_t alignment, size_t size) {
   auto result = posix_memalign(memptr, alignment, size);
   LeakMonitor::GetInstance().OnMonitor(reinterpret_cast<intptr_t>(*memptr),
-                                       size);
+                                       size, CALLER_PC());
   CLEAR_MEMORY(*memptr, size);
   return result;
 }
 
+// C++ allocators, libraries calling operator new through their own PLT never
+// reach the malloc hook. Mangled names are of LP64, the monitor only runs in
+// arm64.
+static ALWAYS_INLINE void *MonitorNew(void *result, size_t size,
+                                      uintptr_t caller, AllocKind kind) {
+  LeakMonitor::GetInstance().OnMonitor(reinterpret_cast<intptr_t>(result),
+                                       size, caller, kind);
+  CLEAR_MEMORY(result, size);
+  return result;
+}
+
+static ALWAYS_INLINE void MonitorDelete(void *ptr, uint64_t free_index) {
+  if (ptr) {
+    LeakMonitor::GetInstance().UnregisterAlloc(
+        reinterpret_cast<uintptr_t>(ptr), free_index);
+  }
+}
+
+// operator new(size_t)
+HOOK(void *, _Znwm, size_t size) {
+  return MonitorNew(::operator new(size), size, CALLER_PC(), kAllocNew);
+}
+
+// operator new[](size_t)
+HOOK(void *, _Znam, size_t size) {
+  return MonitorNew(::operator new[](size), size, CALLER_PC(), kAllocNewArray);
+}
+
+// operator new(size_t, const std::nothrow_t &)
+HOOK(void *, _ZnwmRKSt9nothrow_t, size_t size, const std::nothrow_t &tag) {
+  return MonitorNew(::operator new(size, tag), size, CALLER_PC(), kAllocNew);
+}
+
+// operator new[](size_t, const std::nothrow_t &)
+HOOK(void *, _ZnamRKSt9nothrow_t, size_t size, const std::nothrow_t &tag) {
+  return MonitorNew(::operator new[](size, tag), size, CALLER_PC(),
+                    kAllocNewArray);
+}
+
+// operator delete(void *)
+HOOK(void, _ZdlPv, void *ptr) {
+  auto free_index = LeakMonitor::GetInstance().FreeIndex();
+  ::operator delete(ptr);
+  MonitorDelete(ptr, free_index);
+}
+
+// operator delete[](void *)
+HOOK(void, _ZdaPv, void *ptr) {
+  auto free_index = LeakMonitor::GetInstance().FreeIndex();
+  ::operator delete[](ptr);
+  MonitorDelete(ptr, free_index);
+}
+
+// operator delete(void *, size_t)
+HOOK(void, _ZdlPvm, void *ptr, size_t size) {
+  auto free_index = LeakMonitor::GetInstance().FreeIndex();
+  ::operator delete(ptr, size);
+  MonitorDelete(ptr, free_index);
+}
+
+// operator delete[](void *, size_t)
+HOOK(void, _ZdaPvm, void *ptr, size_t size) {
+  auto free_index = LeakMonitor::GetInstance().FreeIndex();
+  ::operator delete[](ptr, size);
+  MonitorDelete(ptr, free_index);
+}
+
+// operator delete(void *, const std::nothrow_t &)
+HOOK(void, _ZdlPvRKSt9nothrow_t, void *ptr, const std::nothrow_t &tag) {
+  auto free_index = LeakMonitor::GetInstance().FreeIndex();
+  ::operator delete(ptr, tag);
+  MonitorDelete(ptr, free_index);
+}
+
+// operator delete[](void *, const std::nothrow_t &)
+HOOK(void, _ZdaPvRKSt9nothrow_t, void *ptr, const std::nothrow_t &tag) {
+  auto free_index = LeakMonitor::GetInstance().FreeIndex();
+  ::operator delete[](ptr, tag);
+  MonitorDelete(ptr, free_index);
+}
+
+// Mappings are recorded by start address like heap blocks. Only an unmap
+// from the start of a recorded mapping ends it, unmapping a part of it keeps
+// the whole mapping recorded. libmemunreachable never reports mappings, the
+// builtin scanner does. File mappings and PROT_NONE reservations are not
+// memory the caller allocated, only accessible anonymous ones are recorded.
+static ALWAYS_INLINE bool IsAllocMapping(int prot, int flags) {
+  return (flags & MAP_ANONYMOUS) && (prot & (PROT_READ | PROT_WRITE));
+}
+
+HOOK(void *, mmap, void *address, size_t size, int prot, int flags, int fd,
+     off_t offset) {
+  auto result = mmap(address, size, prot, flags, fd, offset);
+  if (result != MAP_FAILED && IsAllocMapping(prot, flags)) {
+    LeakMonitor::GetInstance().OnMonitor(reinterpret_cast<intptr_t>(result),
+                                         size, CALLER_PC(), kAllocMmap);
+  }
+  return result;
+}
+
+HOOK(void *, mmap64, void *address, size_t size, int prot, int flags, int fd,
+     off64_t offset) {
+  auto result = mmap64(address, size, prot, flags, fd, offset);
+  if (result != MAP_FAILED && IsAllocMapping(prot, flags)) {
+    LeakMonitor::GetInstance().OnMonitor(reinterpret_cast<intptr_t>(result),
+                                         size, CALLER_PC(), kAllocMmap);
+  }
+  return result;
+}
+
+HOOK(int, munmap, void *address, size_t size) {
+  auto free_index = LeakMonitor::GetInstance().FreeIndex();
+  auto result = munmap(address, size);
+  if (!result) {
+    LeakMonitor::GetInstance().UnregisterAlloc(
+        reinterpret_cast<uintptr_t>(address), free_index);
+  }
+  return result;
+}
+
+HOOK(void *, mremap, void *old_address, size_t old_size, size_t new_size,
+     int flags, ...) {
+  void *new_address = nullptr;
+  if (flags & MREMAP_FIXED) {
+    va_list args;
+    va_start(args, flags);
+    new_address = va_arg(args, void *);
+    va_end(args);
+  }
+  auto free_index = LeakMonitor::GetInstance().FreeIndex();
+  auto result = mremap(old_address, old_size, new_size, flags, new_address);
+  // Only a mapping the monitor tracks is followed, like mmap it may be file
+  // backed or never have been sampled
+  if (result != MAP_FAILED &&
+      LeakMonitor::GetInstance().UnregisterTrackedAlloc(
+          reinterpret_cast<uintptr_t>(old_address), free_index)) {
+    LeakMonitor::GetInstance().OnMonitor(reinterpret_cast<intptr_t>(result),
+                                         new_size, CALLER_PC(), kAllocMmap);
+  }
+  return result;
+}
+
 LeakMonitor &LeakMonitor::GetInstance() {
   static LeakMonitor leak_monitor;
   return leak_monitor;
@@ -123,8 +284,8 @@ bool LeakMonitor::Install(std::vector<std::string> *selected_list,
 
   memory_analyzer_ = std::make_unique<MemoryAnalyzer>();
   if (!memory_analyzer_->IsValid()) {
-    ALOGE("memory_analyzer_ NOT Valid");
-    return false;
+    ALOGW("memory_analyzer_ NOT Valid, use builtin scanner");
+    memory_analyzer_.reset(nullptr);
   }
 
   std::vector<const std::string> register_pattern = {"^/data/.*\\.so$"};
@@ -150,15 +311,43 @@ bool LeakMonitor::Install(std::vector<std::string> *selected_list,
       std::make_pair("memalign", reinterpret_cast<void *>(WRAP(memalign))),
       std::make_pair("posix_memalign",
                      reinterpret_cast<void *>(WRAP(posix_memalign))),
-      std::make_pair("free", reinterpret_cast<void *>(WRAP(free)))};
+      std::make_pair("free", reinterpret_cast<void *>(WRAP(free))),
+      std::make_pair("_Znwm", reinterpret_cast<void *>(WRAP(_Znwm))),
+      std::make_pair("_Znam", reinterpret_cast<void *>(WRAP(_Znam))),
+      std::make_pair("_ZnwmRKSt9nothrow_t",
+                     reinterpret_cast<void *>(WRAP(_ZnwmRKSt9nothrow_t))),
+      std::make_pair("_ZnamRKSt9nothrow_t",
+                     reinterpret_cast<void *>(WRAP(_ZnamRKSt9nothrow_t))),
+      std::make_pair("_ZdlPv", reinterpret_cast<void *>(WRAP(_ZdlPv))),
+      std::make_pair("_ZdaPv", reinterpret_cast<void *>(WRAP(_ZdaPv))),
+      std::make_pair("_ZdlPvm", reinterpret_cast<void *>(WRAP(_ZdlPvm))),
+      std::make_pair("_ZdaPvm", reinterpret_cast<void *>(WRAP(_ZdaPvm))),
+      std::make_pair("_ZdlPvRKSt9nothrow_t",
+                     reinterpret_cast<void *>(WRAP(_ZdlPvRKSt9nothrow_t))),
+      std::make_pair("_ZdaPvRKSt9nothrow_t",
+                     reinterpret_cast<void *>(WRAP(_ZdaPvRKSt9nothrow_t))),
+      std::make_pair("mmap", reinterpret_cast<void *>(WRAP(mmap))),
+      std::make_pair("mmap64", reinterpret_cast<void *>(WRAP(mmap64))),
+      std::make_pair("munmap", reinterpret_cast<void *>(WRAP(munmap))),
+      std::make_pair("mremap", reinterpret_cast<void *>(WRAP(mremap)))};
 
-  if (HookHelper::HookMethods(register_pattern, ignore_pattern, hook_entries)) {
+  // libc++_shared's operator new/delete call malloc/free, their callers'
+  // hooks see those allocations already
+  std::vector<std::pair<const std::string, const std::string>> ignore_methods;
+  for (auto *method :
+       {"malloc", "realloc", "calloc", "memalign", "posix_memalign", "free"}) {
+    ignore_methods.emplace_back(".*/libc++_shared.so$", method);
+  }
+
+  if (HookHelper::HookMethods(register_pattern, ignore_pattern, hook_entries,
+                              ignore_methods)) {
     has_install_monitor_ = true;
     return true;
   }
 
   HookHelper::UnHookMethods();
-  live_alloc_records_.Clear();
+  auto release_func = [&](AllocRecord *record) { ReleaseRecord(record); };
+  live_alloc_records_.Clear(release_func);
   memory_analyzer_.reset(nullptr);
   ALOGE("%s Fail", __FUNCTION__);
   return false;
@@ -168,7 +357,27 @@ void LeakMonitor::Uninstall() {
   KCHECKV(has_install_monitor_)
   has_install_monitor_ = false;
   HookHelper::UnHookMethods();
-  live_alloc_records_.Clear();
+  SetAsyncRecord(false);
+  StopJournal();
+  StackTrace::SetPrefixCache(0);
+  caller_filter_.Clear();
+  auto release_func = [&](AllocRecord *record) { ReleaseRecord(record); };
+  live_alloc_records_.Clear(release_func);
+  heavy_hitters_.Clear();
+  {
+    std::lock_guard<std::mutex> lock(collect_mutex_);
+    scan_stats_ = ScanStats();
+    memory_budget_ = 0;
+    max_records_ = 0;
+  }
+  for (auto &evicted : evicted_stacks_) {
+    evicted.stack_id = 0;
+    evicted.count = 0;
+    evicted.bytes = 0;
+  }
+  evicted_records_ = 0;
+  evicted_bytes_ = 0;
+  dropped_records_ = 0;
   memory_analyzer_.reset(nullptr);
 }
 
@@ -177,92 +386,941 @@ void LeakMonitor::SetMonitorThreshold(size_t threshold) {
   alloc_threshold_ = threshold;
 }
 
+bool LeakMonitor::SetCallerFilter(const std::vector<std::string> &patterns,
+                                  bool include) {
+  KCHECK(has_install_monitor_);
+  return caller_filter_.Update(patterns, include);
+}
+
+void LeakMonitor::SetSampleInterval(size_t interval) {
+  KCHECK(has_install_monitor_);
+  sample_interval_ = interval;
+}
+
+void LeakMonitor::SetUnwindCache(uint32_t depth) {
+  KCHECK(has_install_monitor_);
+  StackTrace::SetPrefixCache(depth);
+}
+
+void LeakMonitor::SetAsyncRecord(bool enable) {
+  std::lock_guard<std::mutex> lock(async_mutex_);
+  if (enable == async_record_) {
+    return;
+  }
+
+  if (enable) {
+    if (!event_buffer_key_created_) {
+      event_buffer_key_created_ =
+          !pthread_key_create(&event_buffer_key_, OnThreadExit);
+      if (!event_buffer_key_created_) {
+        ALOGE("Create event buffer key fail");
+        return;
+      }
+    }
+    events_pending_ = true;
+    async_record_ = true;
+    aggregator_ = std::thread(&LeakMonitor::AggregateLoop, this);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> aggregate_lock(aggregate_mutex_);
+    async_record_ = false;
+  }
+  aggregate_cond_.notify_all();
+  aggregator_.join();
+  // A hook may have seen async record on just before, let its push land
+  // before the final drain
+  for (auto &stripe : push_stripes_) {
+    while (stripe.pushing.load()) {
+      sched_yield();
+    }
+  }
+  // Frees are recorded synchronously from now on, until the drain they are
+  // applied under drain_mutex_ as a queued allocation may be of their block
+  std::lock_guard<std::mutex> drain_lock(drain_mutex_);
+  DrainEventsLocked();
+  events_pending_ = false;
+}
+
+void LeakMonitor::SetScanMode(int mode) {
+  KCHECK(has_install_monitor_);
+  if (mode < kScanLibMemUnreachable || mode > kScanBuiltinFork) {
+    ALOGE("Unknown scan mode %d", mode);
+    return;
+  }
+  scan_mode_ = mode;
+}
+
+void LeakMonitor::SetIncrementalScan(uint32_t age_scans,
+                                     uint32_t aged_scan_interval) {
+  KCHECK(has_install_monitor_);
+  std::lock_guard<std::mutex> lock(collect_mutex_);
+  age_scans_ = std::min(age_scans, kMaxScanAge);
+  aged_scan_interval_ = aged_scan_interval ? aged_scan_interval : 1;
+}
+
+void LeakMonitor::SetMemoryBudget(size_t budget, int policy) {
+  KCHECK(has_install_monitor_);
+  if (policy < kEvictOldest || policy > kEvictSmallest) {
+    ALOGE("Unknown evict policy %d", policy);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(collect_mutex_);
+    memory_budget_ = budget;
+    evict_policy_ = policy;
+    max_records_ = budget ? MaxRecordsInBudget() : 0;
+  }
+  auto max_records = max_records_.load();
+  if (max_records && record_allocator_.LiveObjects() >= max_records) {
+    EvictRecords();
+  }
+}
+
+TrackerMemory LeakMonitor::GetTrackerMemory() {
+  TrackerMemory memory;
+  memory.records = record_allocator_.Footprint();
+  memory.live_records = record_allocator_.LiveObjects();
+  memory.hash_map = live_alloc_records_.Footprint();
+  memory.stack_depot = stack_depot_.Footprint();
+  memory.num_stacks = stack_depot_.NumStacks();
+  memory.event_buffers = num_event_buffers_.load() * sizeof(EventBuffer);
+  memory.counters = sizeof(heavy_hitters_) + sizeof(evicted_stacks_);
+  {
+    std::lock_guard<std::mutex> lock(collect_mutex_);
+    memory.budget = memory_budget_;
+  }
+  memory.evicted_records = evicted_records_.load(std::memory_order_relaxed);
+  memory.evicted_bytes = evicted_bytes_.load(std::memory_order_relaxed);
+  memory.dropped_records = dropped_records_.load(std::memory_order_relaxed);
+  return memory;
+}
+
+bool LeakMonitor::SetJournal(const std::string &path, uint32_t interval_ms,
+                             size_t large_threshold) {
+  KCHECK(has_install_monitor_);
+  StopJournal();
+  if (path.empty()) {
+    return true;
+  }
+  if (!journal_.Open(path)) {
+    return false;
+  }
+  journal_threshold_ = large_threshold ? large_threshold : 1;
+  journal_running_ = true;
+  journal_thread_ =
+      std::thread(&LeakMonitor::JournalLoop, this, interval_ms ? interval_ms : 1);
+  return true;
+}
+
+// Hooks may still be writing the journal, it is only closed by Uninstall
+// after unhook, a new SetJournal reopens it
+void LeakMonitor::StopJournal() {
+  {
+    std::lock_guard<std::mutex> lock(journal_mutex_);
+    if (!journal_running_) {
+      return;
+    }
+    journal_running_ = false;
+  }
+  journal_cond_.notify_all();
+  journal_thread_.join();
+  journal_threshold_ = SIZE_MAX;
+  if (!has_install_monitor_) {
+    journal_.Close();
+  }
+}
+
+// Heavy hitters keep live bytes by call site without walking the records,
+// so a snapshot is cheap enough to take often
+void LeakMonitor::JournalLoop(uint32_t interval_ms) {
+  prctl(PR_SET_NAME, "koom-leak-jnl");
+  std::vector<HeavyHitters::Entry> entries;
+  std::vector<JournalStack> stacks;
+  std::unique_lock<std::mutex> lock(journal_mutex_);
+  while (journal_running_) {
+    lock.unlock();
+    entries.clear();
+    heavy_hitters_.Dump(&entries);
+    std::sort(entries.begin(), entries.end(),
+              [](const HeavyHitters::Entry &a, const HeavyHitters::Entry &b) {
+                return a.live_bytes > b.live_bytes;
+              });
+    stacks.clear();
+    for (auto &entry : entries) {
+      if (stacks.size() == kJournalStacks || entry.live_bytes <= 0) {
+        break;
+      }
+      JournalStack stack = {entry.live_bytes,
+                            static_cast<int64_t>(entry.alloc_bytes), nullptr,
+                            0};
+      stack.num_frames = stack_depot_.Get(entry.stack_id, &stack.frames);
+      stacks.push_back(stack);
+    }
+    journal_.WriteSnapshot(alloc_index_.load(std::memory_order_relaxed),
+                           stacks);
+    lock.lock();
+    journal_cond_.wait_for(lock, std::chrono::milliseconds(interval_ms),
+                           [this] { return !journal_running_; });
+  }
+}
+
 // GetLeakAllocs方法用于获取当前存在的内存泄漏分配记录
 std::vector<std::shared_ptr<AllocRecord>> LeakMonitor::GetLeakAllocs() {
   // KCHECK宏检查监控器是否已安装，如果未安装，则抛出异常
   KCHECK(has_install_monitor_);
 
+  timespec begin;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  // 内置扫描器需要先拿到活动分配，libmemunreachable不可用时也使用内置扫描器
+  bool builtin_scan =
+      scan_mode_ != kScanLibMemUnreachable || !memory_analyzer_;
+
   // 调用MemoryAnalyzer类的CollectUnreachableMem方法来收集不可达的内存块信息
-  auto unreachable_allocs = memory_analyzer_->CollectUnreachableMem();
+  std::vector<std::pair<uintptr_t, size_t>> unreachable_allocs;
+  if (!builtin_scan) {
+    unreachable_allocs = memory_analyzer_->CollectUnreachableMem();
+  }
 
   // 创建两个vector来存储活动分配和泄漏分配的记录
-  std::vector<std::shared_ptr<AllocRecord>> live_allocs;
+  std::vector<AllocRecord *> live_allocs;
   std::vector<std::shared_ptr<AllocRecord>> leak_allocs;
 
+  // 收集期间记录无锁读取，被释放的记录先挂到retired_records_，收集结束后再释放
+  std::lock_guard<std::mutex> lock(collect_mutex_);
+  collecting_ = true;
+
+  // 异步记录模式下先处理各线程缓冲中的事件
+  {
+    std::lock_guard<std::mutex> drain_lock(drain_mutex_);
+    DrainEventsLocked();
+  }
+
+  // 增量扫描：以alloc_index_划分代，在前age_scans_次扫描开始前就已存在且未被报告的
+  // 分配视为老化，只在每aged_scan_interval_次扫描中检查一次，新分配每次都检查。
+  // 只对内置扫描器生效，libmemunreachable总是扫描整个进程，跳过老化分配省不下什么
+  uint64_t scan_count = scan_stats_.scan_count;
+  uint64_t age_cutoff = 0;
+  bool full_scan = !builtin_scan || !age_scans_ ||
+                   scan_count % aged_scan_interval_ == 0 ||
+                   scan_count < age_scans_;
+  if (!full_scan) {
+    age_cutoff = scan_alloc_indices_[(scan_count - age_scans_) % kMaxScanAge];
+  }
+  scan_alloc_indices_[scan_count % kMaxScanAge] =
+      alloc_index_.load(std::memory_order_relaxed);
+  uint64_t num_live = 0;
+
   // 定义一个lambda表达式来收集活动内存块
-  // collect_func是一个函数对象，它接受一个AllocRecord的shared_ptr并将其添加到live_allocs中
-  auto collect_func = [&](std::shared_ptr<AllocRecord> &alloc_info) -> void {
-    live_allocs.push_back(alloc_info);
+  // collect_func是一个函数对象，它接受一个AllocRecord指针并将其添加到live_allocs中
+  auto collect_func = [&](AllocRecord *alloc_info) -> void {
+    num_live++;
+    if (alloc_info->index >= age_cutoff) {
+      live_allocs.push_back(alloc_info);
+    }
   };
 
   // 使用collect_func函数对象来遍历live_alloc_records_（一个内部映射，存储所有活动的内存分配）
   live_alloc_records_.Dump(collect_func);
 
-  // 定义一个lambda表达式来判断一个活动分配是否是一个泄漏
-  // is_leak接受一个不可达内存块和一个活动分配的引用，返回一个bool值表示是否泄漏
-  auto is_leak = [&](decltype(unreachable_allocs)::value_type &unreachable,
-                     std::shared_ptr<AllocRecord> &live) -> bool {
-    // 使用CONFUSE宏来混淆地址，防止地址被优化掉
-    auto live_start = CONFUSE(live->address);
-    auto live_end = live_start + live->size;
-    auto unreachable_start = unreachable.first;
-    auto unreachable_end = unreachable_start + unreachable.second;
-    // 判断活动分配是否与不可达内存块有重叠，如果是，则认为是泄漏
-    return live_start == unreachable_start ||
-           live_start >= unreachable_start && live_end <= unreachable_end;
-  };
+  // 只扫描活动分配，结果中的地址与记录一一对应
+  if (builtin_scan) {
+    unreachable_allocs = ScanUnreachable(live_allocs);
+  }
 
-  // 遍历所有活动分配，检查它们是否与不可达内存块重叠
-  for (auto &live : live_allocs) {
-    for (auto &unreachable : unreachable_allocs) {
-      // 如果发现活动分配是泄漏的，将其添加到leak_allocs中，并从活动分配中移除
-      if (is_leak(unreachable, live)) {
-        leak_allocs.push_back(live);
-        // 移除泄漏的分配记录
-        UnregisterAlloc(CONFUSE(live->address));
-      }
+  // 不可达内存块按起始地址排序建立索引，每个活动分配二分查找，O((N+M)logM)
+  RangeIndex unreachable_index(&unreachable_allocs);
+
+  // 遍历所有活动分配，起始地址与不可达内存块相同或位于其内部则认为是泄漏
+  for (auto *live : live_allocs) {
+    // 使用CONFUSE宏来混淆地址，防止地址被优化掉
+    // 扫描期间被释放的记录不再属于泄漏
+    if (unreachable_index.Match(CONFUSE(live->address), live->size) &&
+        live_alloc_records_.Find(live->address) == live) {
+      // 将其添加到leak_allocs中，并从活动分配中移除，每个记录只处理一次
+      // 泄漏的内存仍然存活，不计入热点调用栈的释放
+      leak_allocs.push_back(std::make_shared<AllocRecord>(*live));
+      ReleaseRecord(live_alloc_records_.Erase(live->address));
     }
   }
 
+  collecting_ = false;
+  FreeRetiredRecords();
+
+  timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  scan_stats_.scan_count = scan_count + 1;
+  scan_stats_.live = num_live;
+  scan_stats_.candidates = live_allocs.size();
+  scan_stats_.leaks = leak_allocs.size();
+  scan_stats_.time_us = (end.tv_sec - begin.tv_sec) * 1000000LL +
+                        (end.tv_nsec - begin.tv_nsec) / 1000;
+  scan_stats_.full = full_scan;
+  ALOGI("Scan %" PRIu64 " %s: live %" PRIu64 " candidates %zu leaks %zu, "
+        "%" PRIu64 " us",
+        scan_stats_.scan_count, full_scan ? "full" : "incremental", num_live,
+        live_allocs.size(), leak_allocs.size(), scan_stats_.time_us);
+
   // 返回包含所有泄漏分配记录的vector
   return leak_allocs;
 }
 
+ScanStats LeakMonitor::GetScanStats() {
+  std::lock_guard<std::mutex> lock(collect_mutex_);
+  return scan_stats_;
+}
+
+// Allocations a record stands for, more than one if it is sampled
+static inline int64_t SampleCount(uint64_t estimated_size, uint64_t size) {
+  return size ? static_cast<int64_t>(estimated_size / size) : 1;
+}
+
+HeapProfile LeakMonitor::GetHeapProfile() {
+  KCHECK(has_install_monitor_);
+  HeapProfile profile;
+  std::lock_guard<std::mutex> lock(collect_mutex_);
+  collecting_ = true;
+  {
+    std::lock_guard<std::mutex> drain_lock(drain_mutex_);
+    DrainEventsLocked();
+  }
+
+  profile.alloc_index = alloc_index_.load(std::memory_order_relaxed);
+  auto collect_func = [&](AllocRecord *record) -> void {
+    profile.entries.push_back(
+        {record->stack_id,
+         SampleCount(record->estimated_size, record->size),
+         static_cast<int64_t>(record->estimated_size)});
+  };
+  live_alloc_records_.Dump(collect_func);
+
+  collecting_ = false;
+  FreeRetiredRecords();
+
+  // Evicted records are still alive as far as the monitor knows
+  for (auto &evicted : evicted_stacks_) {
+    int64_t count = evicted.count.load(std::memory_order_relaxed);
+    if (count) {
+      profile.entries.push_back(
+          {evicted.stack_id.load(std::memory_order_relaxed), count,
+           evicted.bytes.load(std::memory_order_relaxed)});
+    }
+  }
+
+  auto &entries = profile.entries;
+  std::sort(entries.begin(), entries.end(),
+            [](const HeapProfileEntry &a, const HeapProfileEntry &b) {
+              return a.stack_id < b.stack_id;
+            });
+  size_t num_stacks = 0;
+  for (auto &entry : entries) {
+    if (num_stacks && entries[num_stacks - 1].stack_id == entry.stack_id) {
+      entries[num_stacks - 1].count += entry.count;
+      entries[num_stacks - 1].bytes += entry.bytes;
+    } else {
+      entries[num_stacks++] = entry;
+    }
+  }
+  entries.resize(num_stacks);
+  return profile;
+}
+
+HeapProfile HeapProfile::Diff(const HeapProfile &base) const {
+  HeapProfile diff;
+  diff.alloc_index = alloc_index;
+  auto it = entries.begin();
+  auto base_it = base.entries.begin();
+  while (it != entries.end() || base_it != base.entries.end()) {
+    HeapProfileEntry entry;
+    if (base_it == base.entries.end() ||
+        (it != entries.end() && it->stack_id < base_it->stack_id)) {
+      entry = *it++;
+    } else if (it == entries.end() || base_it->stack_id < it->stack_id) {
+      entry = {base_it->stack_id, -base_it->count, -base_it->bytes};
+      base_it++;
+    } else {
+      entry = {it->stack_id, it->count - base_it->count,
+               it->bytes - base_it->bytes};
+      it++;
+      base_it++;
+    }
+    if (entry.count || entry.bytes) {
+      diff.entries.push_back(entry);
+    }
+  }
+  return diff;
+}
+
+void LeakMonitor::GetHeavyHitters(
+    std::vector<HeavyHitters::Entry> *heavy_hitters) {
+  KCHECK(has_install_monitor_);
+  heavy_hitters_.Dump(heavy_hitters);
+}
+
+// Record addresses are confused, the scanner only keeps the real ones in its
+// own mappings. Unreachable blocks are returned in the vector, which is
+// sized up front so no freed buffer leaves their addresses in the heap.
+std::vector<std::pair<uintptr_t, size_t>> LeakMonitor::ScanUnreachable(
+    const std::vector<AllocRecord *> &live_allocs) {
+  std::vector<std::pair<uintptr_t, size_t>> unreachable_allocs;
+  HeapScanner scanner;
+  if (!scanner.Reserve(live_allocs.size())) {
+    ALOGE("Reserve heap scanner fail");
+    return unreachable_allocs;
+  }
+  for (auto *live : live_allocs) {
+    scanner.AddBlock(CONFUSE(live->address), live->size);
+  }
+
+  unreachable_allocs.reserve(live_allocs.size());
+  if (!scanner.Scan(scan_mode_ == kScanBuiltinFork, &unreachable_allocs)) {
+    ALOGE("Heap scan fail");
+    unreachable_allocs.clear();
+  }
+  return unreachable_allocs;
+}
+
 uint64_t LeakMonitor::CurrentAllocIndex() {
   KCHECK(has_install_monitor_);
   return alloc_index_.load(std::memory_order_relaxed);
 }
 
-ALWAYS_INLINE void LeakMonitor::RegisterAlloc(uintptr_t address, size_t size) {
+uint32_t LeakMonitor::GetBacktrace(uint32_t stack_id,
+                                   const uintptr_t **backtrace) {
+  return stack_depot_.Get(stack_id, backtrace);
+}
+
+ALWAYS_INLINE void LeakMonitor::RegisterAlloc(uintptr_t address, size_t size,
+                                              uint64_t estimated_size,
+                                              AllocKind kind) {
   if (!address || !size) {
     return;
   }
 
-  auto unwind_backtrace = [](uintptr_t *frames, uint32_t *frame_count) {
-    *frame_count = StackTrace::FastUnwind(frames, kMaxBacktraceSize);
-  };
+  uintptr_t backtrace[kMaxBacktraceSize];
+  uint32_t stack_hash;
+  auto num_backtraces =
+      StackTrace::FastUnwind(backtrace, kMaxBacktraceSize, &stack_hash);
+  AllocEvent event = {CONFUSE(address), alloc_index_++, estimated_size, size,
+                      stack_depot_.Put(backtrace, num_backtraces, stack_hash),
+                      kind};
+  if (event.stack_id) {
+    heavy_hitters_.OnAlloc(event.stack_id, estimated_size);
+  }
+  if (estimated_size >= journal_threshold_.load(std::memory_order_relaxed)) {
+    journal_.RecordLarge(event.index, estimated_size, kind, backtrace,
+                         num_backtraces);
+  }
+  if (async_record_.load(std::memory_order_relaxed) && PushEvent(event)) {
+    return;
+  }
 
   thread_local ThreadInfo thread_info;
-  auto alloc_record = std::make_shared<AllocRecord>();
-  alloc_record->address = CONFUSE(address);
-  alloc_record->size = size;
-  alloc_record->index = alloc_index_++;
-  memcpy(alloc_record->thread_name, thread_info.name, kMaxThreadNameLen);
-  unwind_backtrace(alloc_record->backtrace, &(alloc_record->num_backtraces));
-  live_alloc_records_.Put(CONFUSE(address), std::move(alloc_record));
+  AddRecord(event, thread_info.name);
+}
+
+ALWAYS_INLINE void LeakMonitor::AddRecord(const AllocEvent &event,
+                                          const char *thread_name) {
+  auto max_records = max_records_.load(std::memory_order_relaxed);
+  if (max_records && record_allocator_.LiveObjects() >= max_records &&
+      !EvictRecords()) {
+    // Over budget while the records are being collected, count the record
+    // like an evicted one
+    dropped_records_.fetch_add(1, std::memory_order_relaxed);
+    CountEvicted(event.stack_id,
+                 SampleCount(event.estimated_size, event.size),
+                 event.estimated_size);
+    return;
+  }
+
+  auto *alloc_record = record_allocator_.New();
+  if (!alloc_record) {
+    return;
+  }
+  alloc_record->address = event.address;
+  alloc_record->size = event.size;
+  alloc_record->estimated_size = event.estimated_size;
+  alloc_record->index = event.index;
+  memcpy(alloc_record->thread_name, thread_name, kMaxThreadNameLen);
+  alloc_record->stack_id = event.stack_id;
+  alloc_record->kind = event.kind;
+  // Replaced record is of an address freed without being seen. A newer
+  // record means this allocation was freed before it, then this record is
+  // handed back and released.
+  auto older_func = [&](AllocRecord *record) {
+    return record->index < event.index;
+  };
+  ReleaseFreedRecord(
+      live_alloc_records_.Put(event.address, alloc_record, older_func));
+}
+
+ALWAYS_INLINE uint64_t LeakMonitor::FreeIndex() {
+  return alloc_index_.load(std::memory_order_relaxed);
+}
+
+ALWAYS_INLINE void LeakMonitor::UnregisterAlloc(uintptr_t address,
+                                                uint64_t free_index) {
+  if (async_record_.load(std::memory_order_relaxed)) {
+    AllocEvent event = {CONFUSE(address), free_index, 0, 0, 0, kAllocMalloc};
+    if (PushEvent(event)) {
+      return;
+    }
+  }
+  // The allocation may still be queued, remember the free for it then
+  if (events_pending_.load()) {
+    AllocEvent event = {CONFUSE(address), free_index, 0, 0, 0, kAllocMalloc};
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+    ApplyEventLocked(event, nullptr);
+    return;
+  }
+  auto older_func = [&](AllocRecord *record) {
+    return record->index < free_index;
+  };
+  ReleaseFreedRecord(
+      live_alloc_records_.EraseIf(CONFUSE(address), older_func));
+}
+
+// Rare, mremap only: queued allocations of every thread are applied before
+// the record is looked for.
+bool LeakMonitor::UnregisterTrackedAlloc(uintptr_t address,
+                                         uint64_t free_index) {
+  if (!has_install_monitor_) {
+    return false;
+  }
+  auto older_func = [&](AllocRecord *record) {
+    return record->index < free_index;
+  };
+  std::unique_lock<std::mutex> lock(drain_mutex_, std::defer_lock);
+  if (events_pending_.load()) {
+    lock.lock();
+    DrainEventsLocked();
+  }
+  auto *record = live_alloc_records_.EraseIf(CONFUSE(address), older_func);
+  ReleaseFreedRecord(record);
+  return record != nullptr;
+}
+
+// Return false if async record is off or the thread has no event buffer, the
+// caller records the event synchronously. The hook is counted while it
+// pushes: SetAsyncRecord(false) turns async record off, then waits for the
+// hooks which may still have seen it on.
+ALWAYS_INLINE bool LeakMonitor::PushEvent(const AllocEvent &event) {
+  static std::atomic<size_t> next_stripe(0);
+  static thread_local size_t stripe_index =
+      next_stripe.fetch_add(1, std::memory_order_relaxed) % kNumPushStripes;
+  auto &pushing = push_stripes_[stripe_index].pushing;
+  pushing.fetch_add(1);
+  bool pushed = async_record_.load() && PushToBuffer(event);
+  pushing.fetch_sub(1, std::memory_order_release);
+  return pushed;
+}
+
+ALWAYS_INLINE bool LeakMonitor::PushToBuffer(const AllocEvent &event) {
+  auto *buffer = GetEventBuffer();
+  if (!buffer) {
+    return false;
+  }
+  if (buffer->ring.Push(event)) {
+    if (buffer->ring.Size() == kEventWakeThreshold) {
+      WakeAggregator();
+    }
+    return true;
+  }
+
+  // Buffer is full, drain it here to keep the order of this thread's events
+  std::lock_guard<std::mutex> lock(drain_mutex_);
+  auto apply_func = [&](const AllocEvent &queued) {
+    ApplyEventLocked(queued, buffer->thread_name);
+  };
+  buffer->ring.Consume(apply_func);
+  ApplyEventLocked(event, buffer->thread_name);
+  return true;
+}
+
+EventBuffer *LeakMonitor::GetEventBuffer() {
+  auto *buffer =
+      static_cast<EventBuffer *>(pthread_getspecific(event_buffer_key_));
+  if (buffer) {
+    return buffer;
+  }
+
+  // Buffers are created once per thread, map them directly
+  void *memory = mmap(nullptr, sizeof(EventBuffer), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  buffer = new (memory) EventBuffer;
+  if (prctl(PR_GET_NAME, buffer->thread_name)) {
+    memcpy(buffer->thread_name, "unknown", kMaxThreadNameLen);
+  }
+  buffer->exited = false;
+  if (pthread_setspecific(event_buffer_key_, buffer)) {
+    munmap(buffer, sizeof(EventBuffer));
+    return nullptr;
+  }
+  buffer->next = event_buffers_.load(std::memory_order_relaxed);
+  while (!event_buffers_.compare_exchange_weak(buffer->next, buffer)) {
+  }
+  num_event_buffers_.fetch_add(1, std::memory_order_relaxed);
+  return buffer;
+}
+
+void LeakMonitor::OnThreadExit(void *buffer) {
+  static_cast<EventBuffer *>(buffer)->exited.store(true,
+                                                   std::memory_order_release);
+}
+
+size_t LeakMonitor::DrainEventsLocked() {
+  size_t num_events = 0;
+  EventBuffer *prev = nullptr;
+  auto *buffer = event_buffers_.load(std::memory_order_acquire);
+  while (buffer) {
+    // Load exited first, events pushed before exit are all visible then
+    bool exited = buffer->exited.load(std::memory_order_acquire);
+    auto apply_func = [&](const AllocEvent &event) {
+      ApplyEventLocked(event, buffer->thread_name);
+    };
+    num_events += buffer->ring.Consume(apply_func);
+    auto *next = buffer->next;
+    // New buffers are pushed in front of the head, so never unlink the head
+    if (exited && prev) {
+      prev->next = next;
+      munmap(buffer, sizeof(EventBuffer));
+      num_event_buffers_.fetch_sub(1, std::memory_order_relaxed);
+    } else {
+      prev = buffer;
+    }
+    buffer = next;
+  }
+  return num_events;
+}
+
+// Events of different threads are applied out of order: the free of an
+// allocation can be applied before the allocation which is still queued in
+// the allocating thread's buffer. Such frees are remembered in recent_frees_
+// and cancel the allocation if it is older than the free. A slot may be
+// overwritten by another free, then the allocation stays recorded as it
+// would in the race of synchronous mode. A free never ends a newer
+// allocation of the address, and AddRecord never replaces one by an older.
+// Synchronous frees come here too while events may still be queued.
+void LeakMonitor::ApplyEventLocked(const AllocEvent &event,
+                                   const char *thread_name) {
+  auto &recent_free =
+      recent_frees_[(event.address >> 4) & (kNumRecentFrees - 1)];
+  if (!event.size) {
+    auto older_func = [&](AllocRecord *record) {
+      return record->index < event.index;
+    };
+    auto *record = live_alloc_records_.EraseIf(event.address, older_func);
+    if (record) {
+      ReleaseFreedRecord(record);
+    } else {
+      recent_free.address = event.address;
+      recent_free.index = event.index;
+    }
+    return;
+  }
+
+  if (recent_free.address == event.address) {
+    recent_free.address = 0;
+    if (recent_free.index > event.index) {
+      if (event.stack_id) {
+        heavy_hitters_.OnFree(event.stack_id, event.estimated_size);
+      }
+      return;
+    }
+  }
+
+  AddRecord(event, thread_name);
+}
+
+// Sleeps until a buffer is half full or kAggregateIntervalMs passed, an
+// idle process is woken once a second at most. Buffers filling up before it
+// runs are drained by their own thread, see PushEvent.
+void LeakMonitor::AggregateLoop() {
+  prctl(PR_SET_NAME, "koom-leak-agg");
+  std::unique_lock<std::mutex> lock(aggregate_mutex_);
+  while (async_record_) {
+    aggregate_pending_ = false;
+    lock.unlock();
+    {
+      std::lock_guard<std::mutex> drain_lock(drain_mutex_);
+      DrainEventsLocked();
+    }
+    lock.lock();
+    aggregate_cond_.wait_for(
+        lock, std::chrono::milliseconds(kAggregateIntervalMs),
+        [this] { return aggregate_pending_ || !async_record_; });
+  }
+}
+
+void LeakMonitor::WakeAggregator() {
+  {
+    std::lock_guard<std::mutex> lock(aggregate_mutex_);
+    aggregate_pending_ = true;
+  }
+  aggregate_cond_.notify_one();
+}
+
+// GetLeakAllocs reads records without lock, so a record detached from
+// live_alloc_records_ while collecting is freed after the collection finish.
+// collecting_ is checked after the record is detached, if it is false the
+// collection will never observe the record.
+ALWAYS_INLINE void LeakMonitor::ReleaseRecord(AllocRecord *record) {
+  if (!record) {
+    return;
+  }
+
+  if (!collecting_.load()) {
+    record_allocator_.Delete(record);
+    return;
+  }
+
+  record->retired_next = retired_records_.load(std::memory_order_relaxed);
+  while (!retired_records_.compare_exchange_weak(record->retired_next,
+                                                 record)) {
+  }
+}
+
+ALWAYS_INLINE void LeakMonitor::ReleaseFreedRecord(AllocRecord *record) {
+  if (record && record->stack_id) {
+    heavy_hitters_.OnFree(record->stack_id, record->estimated_size);
+  }
+  ReleaseRecord(record);
+}
+
+void LeakMonitor::FreeRetiredRecords() {
+  auto *record = retired_records_.exchange(nullptr);
+  while (record) {
+    auto *next = record->retired_next;
+    record_allocator_.Delete(record);
+    record = next;
+  }
+}
+
+// Records get what the budget leaves to them after the other tracking memory.
+// A record takes its slab block and up to 4 hash map slots, as the map is
+// rebuilt to at least twice the live count; tables replaced by a rebuild
+// and not freed yet are counted apart. At least kMinBudgetRecords are kept
+// even if the rest outgrew the budget, fewer would only make the hooks
+// evict on every allocation.
+size_t LeakMonitor::MaxRecordsInBudget() {
+  static const size_t kRecordBytes =
+      sizeof(AllocRecord) + 4 * 2 * sizeof(uintptr_t);
+  size_t other = stack_depot_.Footprint() +
+                 live_alloc_records_.RetiredFootprint() +
+                 num_event_buffers_.load() * sizeof(EventBuffer) +
+                 sizeof(heavy_hitters_) + sizeof(evicted_stacks_);
+  size_t max_records =
+      memory_budget_ > other ? (memory_budget_ - other) / kRecordBytes : 0;
+  return std::max<size_t>(max_records, kMinBudgetRecords);
+}
+
+// Monotonic in size with 4 significant bits, so sizes spread over the evict
+// buckets whatever their range
+static inline uint64_t SizeClass(uint64_t size) {
+  uint64_t shift = size < 16 ? 0 : 60 - __builtin_clzll(size);
+  return (shift << 4) | (size >> shift);
+}
+
+// Evict down to 7/8 of the allowed records, so it runs once per many
+// allocations as they are never below kMinBudgetRecords. Records are
+// bucketed by the policy key between its min and max, buckets are evicted
+// from the first one until enough, the last one partly. It walks the table three times but allocates nothing, and may run
+// in a hook. Return false if a collection holds the records.
+bool LeakMonitor::EvictRecords() {
+  // The collecting thread itself may get here from a hooked allocation
+  if (collecting_.load() || !collect_mutex_.try_lock()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(collect_mutex_, std::adopt_lock);
+  if (!memory_budget_) {
+    return true;
+  }
+  size_t max_records = MaxRecordsInBudget();
+  max_records_ = max_records;
+  size_t num_live = record_allocator_.LiveObjects();
+  size_t num_keep = max_records - std::max<size_t>(max_records / 8, 1);
+  // Another thread has evicted
+  if (num_live < max_records) {
+    return true;
+  }
+
+  collecting_ = true;
+  bool oldest = evict_policy_ == kEvictOldest;
+  auto key_of = [oldest](const AllocRecord *record) -> uint64_t {
+    return oldest ? record->index : SizeClass(record->size);
+  };
+
+  uint64_t min_key = UINT64_MAX;
+  uint64_t max_key = 0;
+  auto range_func = [&](AllocRecord *record) {
+    uint64_t key = key_of(record);
+    min_key = std::min(min_key, key);
+    max_key = std::max(max_key, key);
+  };
+  live_alloc_records_.Dump(range_func);
+
+  uint64_t num_evicted = 0;
+  uint64_t bytes_evicted = 0;
+  if (min_key <= max_key) {
+    uint64_t width = (max_key - min_key) / kNumEvictBuckets + 1;
+    // Records added after the first walk may be out of the range
+    auto bucket_of = [&](uint64_t key) -> size_t {
+      if (key < min_key) {
+        return 0;
+      }
+      return key > max_key ? kNumEvictBuckets : (key - min_key) / width;
+    };
+    size_t counts[kNumEvictBuckets] = {};
+    auto histogram_func = [&](AllocRecord *record) {
+      size_t bucket = bucket_of(key_of(record));
+      if (bucket < kNumEvictBuckets) {
+        counts[bucket]++;
+      }
+    };
+    live_alloc_records_.Dump(histogram_func);
+
+    size_t quota = num_live - num_keep;
+    size_t cutoff = 0;
+    while (cutoff < kNumEvictBuckets - 1 && counts[cutoff] < quota) {
+      quota -= counts[cutoff++];
+    }
+    auto evict_func = [&](AllocRecord *record) {
+      size_t bucket = bucket_of(key_of(record));
+      if (bucket > cutoff || (bucket == cutoff && !quota)) {
+        return;
+      }
+      if (bucket == cutoff) {
+        quota--;
+      }
+      // Skip the record freed meanwhile, its address may be reused
+      if (live_alloc_records_.Find(record->address) != record) {
+        return;
+      }
+      auto *evicted = live_alloc_records_.Erase(record->address);
+      if (evicted) {
+        CountEvicted(evicted->stack_id,
+                     SampleCount(evicted->estimated_size, evicted->size),
+                     evicted->estimated_size);
+        num_evicted++;
+        bytes_evicted += evicted->estimated_size;
+        ReleaseRecord(evicted);
+      }
+    };
+    live_alloc_records_.Dump(evict_func);
+  }
+
+  collecting_ = false;
+  FreeRetiredRecords();
+  evicted_records_.fetch_add(num_evicted, std::memory_order_relaxed);
+  evicted_bytes_.fetch_add(bytes_evicted, std::memory_order_relaxed);
+  // Runs in the hooks of any thread, log the totals now and then
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t now_ms = now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+  if (!evict_log_ms_ || now_ms - evict_log_ms_ >= kEvictLogIntervalMs) {
+    evict_log_ms_ = now_ms;
+    ALOGI("Evicted %" PRIu64 " records %" PRIu64 " bytes in total, %s "
+          "first, live %zu max %zu",
+          evicted_records_.load(), evicted_bytes_.load(),
+          oldest ? "oldest" : "smallest", num_live, max_records);
+  }
+  return true;
 }
 
-ALWAYS_INLINE void LeakMonitor::UnregisterAlloc(uintptr_t address) {
-  live_alloc_records_.Erase(CONFUSE(address));
+// Slot 0 is of stack id 0 and of the stacks which find no free slot
+void LeakMonitor::CountEvicted(uint32_t stack_id, int64_t count,
+                               int64_t bytes) {
+  static const uint32_t kMaxProbes = 16;
+  EvictedStack *slot = &evicted_stacks_[0];
+  if (stack_id) {
+    uint32_t index = stack_id * 0x9E3779B1U;
+    for (uint32_t probe = 0; probe < kMaxProbes; probe++) {
+      auto &candidate =
+          evicted_stacks_[1 + (index + probe) % (kNumEvictedStacks - 1)];
+      uint32_t current = candidate.stack_id.load(std::memory_order_relaxed);
+      // A failed claim reloads current, the slot may be taken by this stack
+      if (!current &&
+          candidate.stack_id.compare_exchange_strong(current, stack_id)) {
+        current = stack_id;
+      }
+      if (current == stack_id) {
+        slot = &candidate;
+        break;
+      }
+    }
+  }
+  slot->count.fetch_add(count, std::memory_order_relaxed);
+  slot->bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+// Byte based sampling like tcmalloc heap profiler: every thread counts down
+// the allocated bytes, an allocation is recorded when the count reaches zero,
+// then the next count is drawn from an exponential distribution with mean
+// sample_interval_, so the probability of an allocation being recorded only
+// depends on its size.
+struct SampleState {
+  int64_t bytes_until_sample;
+  uint64_t random;
+};
+
+static uint64_t NextRandom(SampleState *state) {
+  if (!state->random) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    state->random = ((static_cast<uint64_t>(now.tv_nsec) << 16) ^
+                     reinterpret_cast<uintptr_t>(state)) | 1;
+  }
+  // xorshift64*
+  state->random ^= state->random >> 12;
+  state->random ^= state->random << 25;
+  state->random ^= state->random >> 27;
+  return state->random * 0x2545F4914F6CDD1DULL;
+}
+
+static int64_t PickNextSample(SampleState *state, size_t interval) {
+  // Uniform in (0, 1]
+  double q = ((NextRandom(state) >> 11) + 1) * (1.0 / (1ULL << 53));
+  return static_cast<int64_t>(-log(q) * interval) + 1;
+}
+
+// Scale a sampled size up by its sampling probability 1 - e^(-size/interval)
+static uint64_t EstimateSize(size_t size, size_t interval) {
+  double probability = -expm1(-static_cast<double>(size) / interval);
+  return static_cast<uint64_t>(size / probability);
 }
 
-ALWAYS_INLINE void LeakMonitor::OnMonitor(uintptr_t address, size_t size) {
+ALWAYS_INLINE void LeakMonitor::OnMonitor(uintptr_t address, size_t size,
+                                          uintptr_t caller, AllocKind kind) {
   if (!has_install_monitor_ || !address ||
-      size < alloc_threshold_.load(std::memory_order_relaxed)) {
+      size < alloc_threshold_.load(std::memory_order_relaxed) ||
+      !caller_filter_.Accept(caller)) {
     return;
   }
 
-  RegisterAlloc(address, size);
+  auto interval = sample_interval_.load(std::memory_order_relaxed);
+  if (!interval) {
+    RegisterAlloc(address, size, size, kind);
+    return;
+  }
+
+  thread_local SampleState sample_state;
+  if (!sample_state.random) {
+    // First allocation of this thread
+    sample_state.bytes_until_sample = PickNextSample(&sample_state, interval);
+  }
+  sample_state.bytes_until_sample -= size;
+  if (sample_state.bytes_until_sample > 0) {
+    return;
+  }
+  do {
+    sample_state.bytes_until_sample += PickNextSample(&sample_state, interval);
+  } while (sample_state.bytes_until_sample <= 0);
+  RegisterAlloc(address, size, EstimateSize(size, interval), kind);
 }
 }  // namespace leak_monitor
 }  // namespace kwai
\ No newline at end of file
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#include "leak_report.h"
+
+#include <string.h>
+
+namespace kwai {
+namespace leak_monitor {
+static const uint16_t kHeaderSize = 24;
+static const uint32_t kRecordSize = 40;
+static const uint32_t kFrameSize = 16;
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "Leak report is written in host byte order");
+
+LeakReportWriter::LeakReportWriter() : num_records_(0) { Reset(); }
+
+void LeakReportWriter::Reset() {
+  string_index_.clear();
+  strings_.clear();
+  records_.clear();
+  report_.clear();
+  num_records_ = 0;
+  Intern("");
+}
+
+template <typename T>
+void LeakReportWriter::Append(std::vector<uint8_t> *buffer, T value) {
+  size_t size = buffer->size();
+  buffer->resize(size + sizeof(value));
+  memcpy(buffer->data() + size, &value, sizeof(value));
+}
+
+uint32_t LeakReportWriter::Intern(const std::string &str) {
+  auto result = string_index_.emplace(str, string_index_.size());
+  if (result.second) {
+    Append<uint32_t>(&strings_, str.size());
+    strings_.insert(strings_.end(), str.begin(), str.end());
+  }
+  return result.first->second;
+}
+
+void LeakReportWriter::AddRecord(uintptr_t address, uint64_t index,
+                                 uint32_t size, uint64_t estimated_size,
+                                 const char *thread_name, uint32_t kind,
+                                 uint32_t num_frames) {
+  Append<uint32_t>(&records_, kRecordSize + num_frames * kFrameSize);
+  Append<uint64_t>(&records_, address);
+  Append<uint64_t>(&records_, index);
+  Append<uint64_t>(&records_, estimated_size);
+  Append<uint32_t>(&records_, size);
+  Append<uint32_t>(&records_, Intern(thread_name ? thread_name : ""));
+  Append<uint32_t>(&records_, kind);
+  Append<uint32_t>(&records_, num_frames);
+  num_records_++;
+}
+
+void LeakReportWriter::AddFrame(uint64_t rel_pc, const std::string &so_name,
+                                const std::string &build_id) {
+  Append<uint64_t>(&records_, rel_pc);
+  Append<uint32_t>(&records_, Intern(so_name));
+  Append<uint32_t>(&records_, Intern(build_id));
+}
+
+const std::vector<uint8_t> &LeakReportWriter::Finish() {
+  report_.clear();
+  report_.reserve(kHeaderSize + strings_.size() + records_.size());
+  Append<uint32_t>(&report_, kLeakReportMagic);
+  Append<uint16_t>(&report_, kLeakReportVersion);
+  Append<uint16_t>(&report_, kHeaderSize);
+  Append<uint32_t>(&report_, string_index_.size());
+  Append<uint32_t>(&report_, num_records_);
+  Append<uint32_t>(&report_, strings_.size());
+  Append<uint32_t>(&report_, records_.size());
+  report_.insert(report_.end(), strings_.begin(), strings_.end());
+  report_.insert(report_.end(), records_.begin(), records_.end());
+  return report_;
+}
+}  // namespace leak_monitor
+}  // namespace kwai
@@ -22,10 +22,9 @@
 
 #include <dlfcn.h>
 #include <log/log.h>
+#include <string.h>
 #include <sys/prctl.h>
 
-#include <regex>
-
 #include "kwai_linker/kwai_dlfcn.h"
 
 namespace kwai {
@@ -66,54 +65,87 @@ MemoryAnalyzer::~MemoryAnalyzer() {
 
 bool MemoryAnalyzer::IsValid() { return get_unreachable_fn_ != nullptr; }
 
-//std::vector<std::pair<uintptr_t, size_t>>
-    // MemoryAnalyzer的成员函数，用于收集不可达的内存块
-std::vector<std::pair<uintptr_t, size_t>> MemoryAnalyzer::CollectUnreachableMem() {
+// 最多输出的泄漏块数量，也是解析结果的预分配大小
+static const size_t kMaxUnreachableReport = 1024;
+
+// 单遍扫描libmemunreachable的文本输出，不使用std::regex也不拷贝子串，
+// 匹配形如“123 bytes unreachable at 71d3b1c000”的行
+static void ParseUnreachableMem(
+    const std::string &text,
+    std::vector<std::pair<uintptr_t, size_t>> *unreachable_mem) {
+  static const char kPattern[] = " bytes unreachable at ";
+  static const size_t kPatternLen = sizeof(kPattern) - 1;
+  const char *cursor = text.data();
+  const char *end = cursor + text.size();
+
+  while (cursor < end) {
+    auto *line_end = static_cast<const char *>(
+        memchr(cursor, '\n', end - cursor));
+    if (!line_end) {
+      line_end = end;
+    }
+
+    // 跳过行首空格，解析十进制的大小
+    while (cursor < line_end && *cursor == ' ') {
+      cursor++;
+    }
+    size_t size = 0;
+    const char *digits = cursor;
+    while (cursor < line_end && *cursor >= '0' && *cursor <= '9') {
+      size = size * 10 + (*cursor++ - '0');
+    }
+
+    // 匹配固定文本后解析十六进制的地址
+    if (cursor > digits &&
+        static_cast<size_t>(line_end - cursor) > kPatternLen &&
+        !memcmp(cursor, kPattern, kPatternLen)) {
+      cursor += kPatternLen;
+      uintptr_t address = 0;
+      const char *hex_digits = cursor;
+      for (; cursor < line_end; cursor++) {
+        char c = *cursor;
+        if (c >= '0' && c <= '9') {
+          address = (address << 4) | (c - '0');
+        } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+          address = (address << 4) | ((c | 0x20) - 'a' + 10);
+        } else {
+          break;
+        }
+      }
+      if (cursor > hex_digits) {
+        unreachable_mem->emplace_back(address, size);
+      }
+    }
+
+    cursor = line_end + 1;
+  }
+}
+
+// MemoryAnalyzer的成员函数，用于收集不可达的内存块
+std::vector<std::pair<uintptr_t, size_t>>
+MemoryAnalyzer::CollectUnreachableMem() {
   // 用于存储不可达内存的地址和大小
   std::vector<std::pair<uintptr_t, size_t>> unreachable_mem;
   // 检查MemoryAnalyzer对象是否有效
   if (!IsValid()) {
-    ALOGE("MemoryAnalyzer NOT valid"); // 打印错误日志
-    return std::move(unreachable_mem); // 返回空的不可达内存列表
+    ALOGE("MemoryAnalyzer NOT valid");  // 打印错误日志
+    return std::move(unreachable_mem);  // 返回空的不可达内存列表
   }
   // 获取当前进程的dumpable状态
   int origin_dumpable = prctl(PR_GET_DUMPABLE);
   // 尝试设置进程为dumpable，以允许libmemunreachable使用ptrace
   if (prctl(PR_SET_DUMPABLE, 1) == -1) {
-    ALOGE("Set process dumpable Fail"); // 如果设置失败，打印错误日志
-    return std::move(unreachable_mem); // 返回空的不可达内存列表
+    ALOGE("Set process dumpable Fail");  // 如果设置失败，打印错误日志
+    return std::move(unreachable_mem);   // 返回空的不可达内存列表
   }
   // 调用libmemunreachable获取不可达内存；这是一个耗时操作
-  std::string unreachable_memory = get_unreachable_fn_(false, 1024);
+  std::string unreachable_memory =
+      get_unreachable_fn_(false, kMaxUnreachableReport);
   // 恢复进程的dumpable状态，这是出于安全考虑
   prctl(PR_SET_DUMPABLE, origin_dumpable);
-  // 使用正则表达式匹配不可达内存块的信息
-  std::regex filter_regex("[0-9]+ bytes unreachable at [A-Za-z0-9]+");
-  // 创建一个正则表达式，用于匹配形如“123 bytes unreachable at ABC123”这样的字符串。
-  std::sregex_iterator unreachable_begin(
-      unreachable_memory.begin(), unreachable_memory.end(), filter_regex);
-  // 创建一个正则表达式迭代器`unreachable_begin`，用于在字符串`unreachable_memory`中迭代查找所有匹配`filter_regex`的子串。
-  std::sregex_iterator unreachable_end;
-  // 创建一个正则表达式迭代器`unreachable_end`，作为迭代结束标志。
-  // 遍历所有匹配的结果
-  for (; unreachable_begin != unreachable_end; ++unreachable_begin) {
-    const auto& line = unreachable_begin->str();
-    // 获取当前匹配到的字符串，例如“123 bytes unreachable at ABC123”。
-    // 解析内存块地址
-    auto address =
-        std::stoul(line.substr(line.find_last_of(' ') + 1,
-                               line.length() - line.find_last_of(' ') - 1),
-                   0, 16);
-    // 从匹配到的字符串中提取内存地址部分，并转换为无符号长整型数。
-    // 例如，如果line是"123 bytes unreachable at ABC123"，address将是0xABC123。
-    // 解析内存块大小
-    auto size = std::stoul(line.substr(0, line.find_first_of(' ')));
-    // 从匹配到的字符串中提取内存大小部分，并转换为无符号长整型数。
-    // 例如，如果line是"123 bytes unreachable at ABC123"，size将是123。
-    // 把地址和大小添加到结果中
-    unreachable_mem.emplace_back(address, size);
-    // 将解析出的地址和大小作为一个pair添加到`unreachable_mem`容器中。
-  }
+  // 输出最多kMaxUnreachableReport个泄漏块，预先分配避免解析时扩容
+  unreachable_mem.reserve(kMaxUnreachableReport);
+  ParseUnreachableMem(unreachable_memory, &unreachable_mem);
   // 返回所有找到的不可达内存块
   return std::move(unreachable_mem);
 }
@@ -32,6 +32,7 @@
 #include <ctype.h>
 #include <cxxabi.h>
 #include <dlfcn.h>
+#include <dlopencb.h>
 #include <elf.h>
 #include <inttypes.h>
 #include <link.h>
@@ -39,66 +40,70 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <time.h>
 
+#include <set>
 #include <vector>
 
+#include "utils/proc_maps.h"
+
 #if defined(__LP64__)
 #define PAD_PTR "016" PRIxPTR
 #else
 #define PAD_PTR "08" PRIxPTR
 #endif
 
-// Format of /proc/<PID>/maps:
-// 6f000000-6f01e000 rwxp 00000000 00:0c 16389419   /system/lib/libcomposer.so
-// 解析 /proc/<PID>/maps 文件的一行数据并构造 MapEntry 对象。
-// 示例行数据:
-// "7fbdac000000-7fbdac021000 r-xp 00000000 08:02 661909             /lib/x86_64-linux-gnu/libpthread-2.23.so"
-static MapEntry *ParseLine(char *line) {
-  // 地址变量的声明
-  uintptr_t start; // 段的起始地址
-  uintptr_t end; // 段的结束地址
-  uintptr_t offset; // 文件偏移
-  int flags; // 线段的权限标志
-  char permissions[5]; // 权限字符串
-  int name_pos; // 文件名在行内的位置
-  // 使用 sscanf 解析内存映射数据
-  if (sscanf(line, "%" PRIxPTR "-%" PRIxPTR " %4s %" PRIxPTR " %*x:%*x %*d %n",
-             &start, &end, permissions, &offset, &name_pos) < 2) {
-    return nullptr; // 如果解析失败，返回 nullptr
-  }
-
-  // Example after sscanf:
-  // start = 0x7fbdac000000, end = 0x7fbdac021000, permissions = "r-xp", offset = 0
-
-  const char *name = line + name_pos; // 获取文件名的位置
-  size_t name_len = strlen(name);
-  if (name_len && name[name_len - 1] == '\n') {
-    name_len -= 1; // 如果文件名末尾有换行符，去掉它
-  }
+static bool EndsWith(const char *name, size_t name_len, const char *suffix) {
+  size_t suffix_len = strlen(suffix);
+  return name_len >= suffix_len &&
+         !memcmp(name + name_len - suffix_len, suffix, suffix_len);
+}
 
-  // Example after processing the name:
-  // name = "/lib/x86_64-linux-gnu/libpthread-2.23.so", name_len = length of name without '\n'
+MapEntry::MapEntry(uintptr_t start, uintptr_t end, uintptr_t offset,
+                   const char *name, size_t name_len, int flags)
+    : start(start),
+      end(end),
+      offset(offset),
+      name(name, name_len),
+      flags(flags) {
+  // 解析时缓存basename和是否忽略，每个栈帧查找时不再创建临时字符串
+  const char *slash =
+      static_cast<const char *>(memrchr(name, '/', name_len));
+  basename_pos = slash ? slash - name + 1 : 0;
+  ignore = EndsWith(name, name_len, LIB_ART) ||
+           EndsWith(name, name_len, OAT_SUFFEX) ||
+           EndsWith(name, name_len, ODEX_SUFFEX) ||
+           EndsWith(name, name_len, DEX_SUFFEX);
+}
 
-  flags = 0;
-  if (permissions[0] == 'r') {
+// Format of /proc/<PID>/maps:
+// 6f000000-6f01e000 rwxp 00000000 00:0c 16389419   /system/lib/libcomposer.so
+// 由一行已解析的 /proc/<PID>/maps 数据构造 MapEntry 对象
+static MapEntry MakeEntry(const MapsLine &line) {
+  int flags = 0;
+  if (line.permissions[0] == 'r') {
     flags |= PROT_READ; // 如果有读权限，增加读标志
   }
-  if (permissions[2] == 'x') {
+  if (line.permissions[2] == 'x') {
     flags |= PROT_EXEC; // 如果有执行权限，增加执行标志
   }
 
-  // Example after setting the flags:
-  // Considering permissions = "r-xp", flags = PROT_READ | PROT_EXEC
-
-  // 使用解析后的数据构造 MapEntry 对象
-  MapEntry *entry = new MapEntry(start, end, offset, name, name_len, flags);
+  MapEntry entry(line.start, line.end, line.offset, line.name, line.name_len,
+                 flags);
   // 如果没有读权限，将实例设置为无效
   if (!(flags & PROT_READ)) {
-    entry->load_bias = 0; // 无法读取的映射就对偏移量做零处理
-    entry->init = true; // 标记为初始化
-    entry->valid = false; // 标记为无效
+    entry.load_bias = 0; // 无法读取的映射就对偏移量做零处理
+    entry.init = true; // 标记为初始化
+    entry.valid = false; // 标记为无效
   }
-  return entry; // 返回构造的 MapEntry 对象
+  return entry;
+}
+
+// 新增dlopen时递增，MemoryMap发现变化后才重新读取maps
+static std::atomic<uint32_t> g_maps_generation(1);
+
+static void OnDlopen(std::set<std::string> &, int, std::string &) {
+  g_maps_generation.fetch_add(1, std::memory_order_relaxed);
 }
 
 template <typename T>
@@ -188,6 +193,59 @@ static void ReadLoadbias(MapEntry *entry) {
   // 如果没有读取到任何可执行段，load_bias 仍然是0，表明没有偏移量或这个映射不代表可执行的文件
 }
 
+// ReadBuildId 从 PT_NOTE 段中查找 NT_GNU_BUILD_ID，离线符号化用它匹配未裁剪的库
+static void ReadBuildId(MapEntry *entry) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  uintptr_t addr = entry->start;
+  ElfW(Ehdr) ehdr;
+  if (!GetVal<ElfW(Half)>(entry, addr + offsetof(ElfW(Ehdr), e_phnum), &ehdr.e_phnum) ||
+      !GetVal<ElfW(Off)>(entry, addr + offsetof(ElfW(Ehdr), e_phoff), &ehdr.e_phoff)) {
+    return;
+  }
+
+  addr += ehdr.e_phoff;
+  for (size_t i = 0; i < ehdr.e_phnum; i++, addr += sizeof(ElfW(Phdr))) {
+    ElfW(Phdr) phdr;
+    if (!GetVal<ElfW(Word)>(entry, addr + offsetof(ElfW(Phdr), p_type), &phdr.p_type)) {
+      return;
+    }
+    if (phdr.p_type != PT_NOTE ||
+        !GetVal<ElfW(Off)>(entry, addr + offsetof(ElfW(Phdr), p_offset), &phdr.p_offset) ||
+        !GetVal<ElfW(Xword)>(entry, addr + offsetof(ElfW(Phdr), p_filesz), &phdr.p_filesz)) {
+      continue;
+    }
+
+    // 依次遍历note：头部之后是4字节对齐的name和desc
+    uintptr_t note = entry->start + phdr.p_offset;
+    uintptr_t note_end = note + phdr.p_filesz;
+    while (note + sizeof(ElfW(Nhdr)) <= note_end) {
+      ElfW(Nhdr) nhdr;
+      if (!GetVal<ElfW(Word)>(entry, note + offsetof(ElfW(Nhdr), n_namesz), &nhdr.n_namesz) ||
+          !GetVal<ElfW(Word)>(entry, note + offsetof(ElfW(Nhdr), n_descsz), &nhdr.n_descsz) ||
+          !GetVal<ElfW(Word)>(entry, note + offsetof(ElfW(Nhdr), n_type), &nhdr.n_type)) {
+        break;
+      }
+      uintptr_t name = note + sizeof(ElfW(Nhdr));
+      uintptr_t desc = name + ((nhdr.n_namesz + 3) & ~3);
+      uintptr_t next = desc + ((nhdr.n_descsz + 3) & ~3);
+      if (next > note_end || next > entry->end) {
+        break;
+      }
+      if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_namesz == 4 &&
+          !memcmp(reinterpret_cast<void *>(name), "GNU", 4)) {
+        auto *bytes = reinterpret_cast<const uint8_t *>(desc);
+        entry->build_id.reserve(nhdr.n_descsz * 2);
+        for (size_t j = 0; j < nhdr.n_descsz; j++) {
+          entry->build_id += kHexDigits[bytes[j] >> 4];
+          entry->build_id += kHexDigits[bytes[j] & 0xf];
+        }
+        return;
+      }
+      note = next;
+    }
+  }
+}
+
 static void inline Init(MapEntry *entry) {
   if (entry->init) {
     return;
@@ -196,63 +254,121 @@ static void inline Init(MapEntry *entry) {
   if (ValidElf(entry)) {
     entry->valid = true;
     ReadLoadbias(entry);
+    ReadBuildId(entry);
   }
 }
 
 bool MemoryMap::ReadMaps() {
-  FILE *fp = fopen("/proc/self/maps", "re");
-  if (fp == nullptr) {
+  std::string maps;
+  if (!ReadProcMaps(&maps)) {
     return false;
   }
 
-  std::vector<char> buffer(1024);
-  while (fgets(buffer.data(), buffer.size(), fp) != nullptr) {
-    MapEntry *entry = ParseLine(buffer.data());
-    if (entry == nullptr) {
-      fclose(fp);
-      return false;
+  // 增量刷新：未变化的映射沿用旧条目，保留已读取的load_bias等信息
+  std::vector<MapEntry> entries;
+  entries.reserve(entries_.size() + 16);
+  size_t old_index = 0;
+  const char *cursor = maps.c_str();
+  MapsLine line;
+  while (ParseMapsLine(&cursor, &line)) {
+    // maps按地址升序输出，与旧条目归并比较
+    while (old_index < entries_.size() &&
+           entries_[old_index].start < line.start) {
+      old_index++;
     }
-
-    auto it = entries_.find(entry);
-    if (it == entries_.end()) {
-      entries_.insert(entry);
-    } else {
-      delete entry;
+    if (old_index < entries_.size()) {
+      auto &old_entry = entries_[old_index];
+      if (old_entry.start == line.start && old_entry.end == line.end &&
+          old_entry.offset == line.offset &&
+          old_entry.name.size() == line.name_len &&
+          !memcmp(old_entry.name.data(), line.name, line.name_len)) {
+        entries.push_back(std::move(old_entry));
+        old_index++;
+        continue;
+      }
     }
+    entries.push_back(MakeEntry(line));
+  }
+
+  entries_ = std::move(entries);
+  symbol_cache_.Clear();
+  starts_.resize(entries_.size());
+  for (size_t i = 0; i < entries_.size(); i++) {
+    starts_[i] = entries_[i].start;
   }
-  fclose(fp);
   return true;
 }
 
-MemoryMap::~MemoryMap() {
-  for (auto *entry : entries_) {
-    delete entry;
+void MemoryMap::Clear() {
+  if (callback_added_) {
+    DlopenCb::GetInstance().RemoveCallback(OnDlopen);
+    callback_added_ = false;
   }
   entries_.clear();
+  starts_.clear();
+  symbol_cache_.Clear();
+  generation_ = 0;
+  miss_refresh_ms_ = 0;
+}
+
+MemoryMap::~MemoryMap() { Clear(); }
+
+// 无分支二分查找最后一个start不大于pc的条目
+ssize_t MemoryMap::Find(uintptr_t pc) const {
+  size_t size = starts_.size();
+  if (!size) {
+    return -1;
+  }
+  const uintptr_t *base = starts_.data();
+  while (size > 1) {
+    size_t half = size / 2;
+    base = base[half] <= pc ? base + half : base;
+    size -= half;
+  }
+  ssize_t index = base - starts_.data();
+  return *base <= pc && pc < entries_[index].end ? index : -1;
+}
+
+bool MemoryMap::RefreshOnMiss() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t now_ms = now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+  if (miss_refresh_ms_ && now_ms - miss_refresh_ms_ < kMissRefreshIntervalMs) {
+    return false;
+  }
+  miss_refresh_ms_ = now_ms;
+  return ReadMaps();
 }
 
 MapEntry *MemoryMap::CalculateRelPc(uintptr_t pc, uintptr_t *rel_pc) {
-  MapEntry pc_entry(pc);
+  // 先注册回调再读取，读取期间的dlopen也会触发下一次刷新
+  if (!callback_added_) {
+    DlopenCb::GetInstance().AddCallback(OnDlopen);
+    callback_added_ = true;
+  }
+  uint32_t generation = g_maps_generation.load(std::memory_order_relaxed);
+  if (generation != generation_ && ReadMaps()) {
+    generation_ = generation;
+  }
 
-  auto it = entries_.find(&pc_entry);
-  if (it == entries_.end()) {
-    ReadMaps();
+  ssize_t index = Find(pc);
+  if (index < 0 && RefreshOnMiss()) {
+    index = Find(pc);
   }
-  it = entries_.find(&pc_entry);
-  if (it == entries_.end()) {
+  if (index < 0) {
     return nullptr;
   }
 
-  MapEntry *entry = *it;
+  MapEntry *entry = &entries_[index];
   Init(entry);
 
-  // 检查当前处理的内存映射条目（entry）是否关联了一个有效的程序计数器（rel_pc）。
+// 检查当前处理的内存映射条目（entry）是否关联了一个有效的程序计数器（rel_pc）。
   if (rel_pc != nullptr) {
     // 如果当前映射是一个只读执行映射，并且前一个映射是只读的，那么需要特别处理。
     // 这里首先检查entry是否有效，如果不是有效映射，说明可能是一个新映射，需要检查前一个映射。
-    if (!entry->valid && it != entries_.begin()) {
-      // 获取前一个映射条目（prev_entry），通过迭代器it向前移动一位。
-      MapEntry *prev_entry = *--it;
+    if (!entry->valid && index > 0) {
+      // 获取前一个映射条目（prev_entry），即数组中的前一个元素。
+      MapEntry *prev_entry = &entries_[index - 1];
       // 检查前一个映射是否为只读（PROT_READ）类型，并且其偏移量小于当前映射的偏移量，
       // 同时两个映射具有相同的名称，这表明它们可能是同一个文件的不同部分。
       if (prev_entry->flags == PROT_READ &&
@@ -263,6 +379,8 @@ MapEntry *MemoryMap::CalculateRelPc(uintptr_t pc, uintptr_t *rel_pc) {
         // 如果前一个映射条目有效，设置当前映射条目的起始偏移量。
         if (prev_entry->valid) {
           entry->elf_start_offset = prev_entry->offset;
+          // ELF头部在前一个映射中，build-id也从那里读取
+          entry->build_id = prev_entry->build_id;
           // 计算并设置相对PC值，这个值是程序计数器（pc）相对于映射条目起始地址的偏移量。
           *rel_pc = pc - entry->start + entry->offset + prev_entry->load_bias;
           return entry; // 返回当前映射条目，表示处理完成。
@@ -279,6 +397,10 @@ MapEntry *MemoryMap::CalculateRelPc(uintptr_t pc, uintptr_t *rel_pc) {
 std::string MemoryMap::FormatSymbol(MapEntry *entry, uintptr_t pc) {
   // 初始化一个空字符串str，用于存储最终的格式化输出
   std::string str;
+  // 相同pc的符号直接从缓存获取，避免重复调用dladdr和__cxa_demangle
+  if (symbol_cache_.Find(pc, &str)) {
+    return str;
+  }
   // 初始化offset为0，稍后用于存储偏移量
   uintptr_t offset = 0;
   // 初始化symbol为nullptr，稍后用于存储解析出的符号名称
@@ -338,6 +460,7 @@ std::string MemoryMap::FormatSymbol(MapEntry *entry, uintptr_t pc) {
   }
   // 将格式化后的字符串添加到str中
   str += buf;
+  symbol_cache_.Put(pc, str, str.capacity());
 
   // 返回最终的格式化字符串
   return std::move(str);
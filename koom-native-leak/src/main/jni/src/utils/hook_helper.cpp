@@ -22,16 +22,27 @@
 
 #include <dlopencb.h>
 #include <log/log.h>
+#include <string.h>
 #include <xhook.h>
 
+#include <algorithm>
+
 std::vector<const std::string> HookHelper::register_pattern_;
 std::vector<const std::string> HookHelper::ignore_pattern_;
 std::vector<std::pair<const std::string, void *const>> HookHelper::methods_;
+std::vector<std::pair<const std::string, const std::string>>
+    HookHelper::ignore_methods_;
+std::vector<regex_t> HookHelper::register_regex_;
+std::vector<regex_t> HookHelper::ignore_regex_;
+std::vector<regex_t> HookHelper::ignore_method_regex_;
+std::unordered_map<std::string, bool> HookHelper::match_cache_;
 
 bool HookHelper::HookMethods(
     std::vector<const std::string> &register_pattern,
     std::vector<const std::string> &ignore_pattern,
-    std::vector<std::pair<const std::string, void *const>> &methods) {
+    std::vector<std::pair<const std::string, void *const>> &methods,
+    std::vector<std::pair<const std::string, const std::string>>
+        &ignore_methods) {
   if (register_pattern.empty() || methods.empty()) {
     ALOGE("Hook nothing");
     return false;
@@ -40,19 +51,150 @@ bool HookHelper::HookMethods(
   register_pattern_ = std::move(register_pattern);
   ignore_pattern_ = std::move(ignore_pattern);
   methods_ = std::move(methods);
+  ignore_methods_ = std::move(ignore_methods);
+  if (!CompilePatterns()) {
+    return false;
+  }
   DlopenCb::GetInstance().AddCallback(Callback);
   return HookImpl();
 }
 
 void HookHelper::UnHookMethods() {
+  // Wait for the running callback, it uses the patterns
   DlopenCb::GetInstance().RemoveCallback(Callback);
+  FreePatterns();
+  match_cache_.clear();
   register_pattern_.clear();
   ignore_pattern_.clear();
   methods_.clear();
+  ignore_methods_.clear();
+}
+
+// Hooks already made stay valid, so only the libraries added by this dlopen
+// are hooked instead of a full refresh of every library. A library DlopenCb
+// can't name by path falls back to the full refresh.
+void HookHelper::Callback(std::set<std::string> &add_libs, int,
+                          std::string &) {
+  std::vector<std::string> libs;
+  for (auto &lib : add_libs) {
+    if (lib.empty() || lib[0] != '/') {
+      HookImpl();
+      return;
+    }
+    if (Match(lib)) {
+      libs.push_back(lib);
+    }
+  }
+  if (!libs.empty()) {
+    HookLibs(libs);
+  }
+}
+
+// Same rule as xhook: a register pattern matches and no ignore pattern does
+bool HookHelper::Match(const std::string &lib) {
+  auto it = match_cache_.find(lib);
+  if (it != match_cache_.end()) {
+    return it->second;
+  }
+  auto matches = [&](const regex_t &regex) {
+    return !regexec(&regex, lib.c_str(), 0, nullptr, 0);
+  };
+  bool match =
+      std::any_of(register_regex_.begin(), register_regex_.end(), matches) &&
+      std::none_of(ignore_regex_.begin(), ignore_regex_.end(), matches);
+  match_cache_.emplace(lib, match);
+  return match;
+}
+
+bool HookHelper::IgnoreMethod(const std::string &lib,
+                              const std::string &method) {
+  for (size_t i = 0; i < ignore_methods_.size(); i++) {
+    if (ignore_methods_[i].second == method &&
+        !regexec(&ignore_method_regex_[i], lib.c_str(), 0, nullptr, 0)) {
+      return true;
+    }
+  }
+  return false;
 }
 
-void HookHelper::Callback(std::set<std::string> &, int, std::string &) {
-  HookImpl();
+bool HookHelper::CompilePatterns() {
+  FreePatterns();
+  auto compile = [](const std::vector<const std::string> &patterns,
+                    std::vector<regex_t> *regexes) {
+    for (auto &pattern : patterns) {
+      regex_t regex;
+      if (regcomp(&regex, pattern.c_str(), REG_NOSUB)) {
+        ALOGE("regcomp pattern %s fail", pattern.c_str());
+        return false;
+      }
+      regexes->push_back(regex);
+    }
+    return true;
+  };
+  std::vector<const std::string> ignore_method_patterns;
+  for (auto &ignore : ignore_methods_) {
+    ignore_method_patterns.push_back(ignore.first);
+  }
+  if (compile(register_pattern_, &register_regex_) &&
+      compile(ignore_pattern_, &ignore_regex_) &&
+      compile(ignore_method_patterns, &ignore_method_regex_)) {
+    return true;
+  }
+  FreePatterns();
+  return false;
+}
+
+void HookHelper::FreePatterns() {
+  for (auto &regex : register_regex_) {
+    regfree(&regex);
+  }
+  for (auto &regex : ignore_regex_) {
+    regfree(&regex);
+  }
+  for (auto &regex : ignore_method_regex_) {
+    regfree(&regex);
+  }
+  register_regex_.clear();
+  ignore_regex_.clear();
+  ignore_method_regex_.clear();
+}
+
+// Match exactly |lib| in basic regex
+static std::string ExactPattern(const std::string &lib) {
+  std::string pattern = "^";
+  for (char c : lib) {
+    if (strchr(".[\\*^$", c)) {
+      pattern += '\\';
+    }
+    pattern += c;
+  }
+  return pattern + "$";
+}
+
+// xhook still reads /proc/self/maps, but only the registered libraries are
+// examined and hooked
+bool HookHelper::HookLibs(const std::vector<std::string> &libs) {
+  pthread_mutex_lock(&DlopenCb::hook_mutex);
+  xhook_clear();
+  for (auto &lib : libs) {
+    std::string pattern = ExactPattern(lib);
+    for (auto &method : methods_) {
+      if (IgnoreMethod(lib, method.first)) {
+        continue;
+      }
+      if (xhook_register(pattern.c_str(), method.first.c_str(), method.second,
+                         nullptr) != EXIT_SUCCESS) {
+        ALOGE("xhook_register lib %s method %s fail", lib.c_str(),
+              method.first.c_str());
+        pthread_mutex_unlock(&DlopenCb::hook_mutex);
+        return false;
+      }
+    }
+  }
+
+  int ret = xhook_refresh(0);
+  pthread_mutex_unlock(&DlopenCb::hook_mutex);
+  return ret == 0;
 }
 
 bool HookHelper::HookImpl() {
@@ -81,6 +223,16 @@ bool HookHelper::HookImpl() {
     }
   }
 
+  for (auto &ignore : ignore_methods_) {
+    if (xhook_ignore(ignore.first.c_str(), ignore.second.c_str()) !=
+        EXIT_SUCCESS) {
+      ALOGE("xhook_ignore pattern %s method %s fail", ignore.first.c_str(),
+            ignore.second.c_str());
+      pthread_mutex_unlock(&DlopenCb::hook_mutex);
+      return false;
+    }
+  }
+
   int ret = xhook_refresh(0);
   pthread_mutex_unlock(&DlopenCb::hook_mutex);
   return ret == 0;
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2021. Kwai, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Created by lbtrace on 2021.
+ *
+ */
+
+#include "utils/stack_depot.h"
+
+#include <kwai_util/frame_pointer_unwind.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static const uint32_t kNumBuckets = 1 << 16;
+// Id = (arena index + 1) << kOffsetBits | offset in arena / kOffsetUnit
+static const uint32_t kOffsetBits = 17;
+static const uint32_t kOffsetUnit = sizeof(uintptr_t);
+static const uint32_t kArenaSize = (1 << kOffsetBits) * kOffsetUnit;
+static const uint32_t kMaxArenas = 1024;
+
+static void *MapMemory(size_t size) {
+  void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return memory == MAP_FAILED ? nullptr : memory;
+}
+
+StackDepot::StackDepot()
+    : buckets_(static_cast<std::atomic<Stack *> *>(
+          MapMemory(kNumBuckets * sizeof(std::atomic<Stack *>)))),
+      arenas_(static_cast<uint8_t **>(
+          MapMemory(kMaxArenas * sizeof(uint8_t *)))),
+      num_arenas_(0),
+      arena_used_(kArenaSize),
+      num_stacks_(0),
+      footprint_(0) {}
+
+StackDepot::~StackDepot() {
+  if (arenas_) {
+    for (uint32_t i = 0; i < num_arenas_.load(); i++) {
+      munmap(arenas_[i], kArenaSize);
+    }
+    munmap(arenas_, kMaxArenas * sizeof(uint8_t *));
+  }
+  if (buckets_) {
+    munmap(buckets_, kNumBuckets * sizeof(std::atomic<Stack *>));
+  }
+}
+
+uint32_t StackDepot::Put(const uintptr_t *frames, uint32_t num_frames) {
+  return Put(frames, num_frames, kwai::util::StackHash(frames, num_frames));
+}
+
+uint32_t StackDepot::Put(const uintptr_t *frames, uint32_t num_frames,
+                         uint32_t hash) {
+  if (!buckets_ || !arenas_) {
+    return 0;
+  }
+
+  auto &bucket = buckets_[hash & (kNumBuckets - 1)];
+  Stack *head = bucket.load(std::memory_order_acquire);
+  Stack *stack = Find(head, hash, frames, num_frames);
+  if (stack) {
+    return stack->id;
+  }
+
+  std::lock_guard<std::mutex> lock(insert_mutex_);
+  // Only traces inserted after |head| need to be checked again
+  Stack *new_head = bucket.load(std::memory_order_acquire);
+  for (stack = new_head; stack != head;
+       stack = stack->next.load(std::memory_order_relaxed)) {
+    if (stack->hash == hash && stack->num_frames == num_frames &&
+        !memcmp(stack->frames, frames, num_frames * sizeof(uintptr_t))) {
+      return stack->id;
+    }
+  }
+
+  stack = AllocStackLocked(num_frames);
+  if (!stack) {
+    return 0;
+  }
+  stack->hash = hash;
+  stack->num_frames = num_frames;
+  memcpy(stack->frames, frames, num_frames * sizeof(uintptr_t));
+  stack->next.store(new_head, std::memory_order_relaxed);
+  bucket.store(stack, std::memory_order_release);
+  num_stacks_.fetch_add(1, std::memory_order_relaxed);
+  return stack->id;
+}
+
+uint32_t StackDepot::Get(uint32_t id, const uintptr_t **frames) const {
+  uint32_t arena = (id >> kOffsetBits) - 1;
+  if (!id || arena >= num_arenas_.load(std::memory_order_acquire)) {
+    return 0;
+  }
+
+  auto *stack = reinterpret_cast<Stack *>(
+      arenas_[arena] + (id & ((1 << kOffsetBits) - 1)) * kOffsetUnit);
+  *frames = stack->frames;
+  return stack->num_frames;
+}
+
+uint32_t StackDepot::NumStacks() const {
+  return num_stacks_.load(std::memory_order_relaxed);
+}
+
+size_t StackDepot::Footprint() const {
+  size_t index_bytes =
+      (buckets_ ? kNumBuckets * sizeof(std::atomic<Stack *>) : 0) +
+      (arenas_ ? kMaxArenas * sizeof(uint8_t *) : 0);
+  return index_bytes + footprint_.load(std::memory_order_relaxed);
+}
+
+StackDepot::Stack *StackDepot::Find(Stack *head, uint32_t hash,
+                                    const uintptr_t *frames,
+                                    uint32_t num_frames) const {
+  for (Stack *stack = head; stack;
+       stack = stack->next.load(std::memory_order_acquire)) {
+    if (stack->hash == hash && stack->num_frames == num_frames &&
+        !memcmp(stack->frames, frames, num_frames * sizeof(uintptr_t))) {
+      return stack;
+    }
+  }
+  return nullptr;
+}
+
+StackDepot::Stack *StackDepot::AllocStackLocked(uint32_t num_frames) {
+  size_t size = sizeof(Stack) + num_frames * sizeof(uintptr_t);
+  size = (size + kOffsetUnit - 1) & ~static_cast<size_t>(kOffsetUnit - 1);
+  if (size > kArenaSize) {
+    return nullptr;
+  }
+
+  uint32_t num_arenas = num_arenas_.load(std::memory_order_relaxed);
+  if (arena_used_ + size > kArenaSize) {
+    if (num_arenas == kMaxArenas) {
+      return nullptr;
+    }
+    auto *arena = static_cast<uint8_t *>(MapMemory(kArenaSize));
+    if (!arena) {
+      return nullptr;
+    }
+    arenas_[num_arenas++] = arena;
+    num_arenas_.store(num_arenas, std::memory_order_release);
+    arena_used_ = 0;
+    footprint_.fetch_add(kArenaSize, std::memory_order_relaxed);
+  }
+
+  uint32_t arena = num_arenas - 1;
+  auto *stack = reinterpret_cast<Stack *>(arenas_[arena] + arena_used_);
+  stack->id = ((arena + 1) << kOffsetBits) | (arena_used_ / kOffsetUnit);
+  arena_used_ += size;
+  return stack;
+}
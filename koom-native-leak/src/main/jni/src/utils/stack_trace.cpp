@@ -19,69 +19,25 @@
 
 #include "utils/stack_trace.h"
 
-static const uint32_t kT32InstrLen = 2;
-static const uint32_t kA32InstrLen = 4;
-static const uint32_t kA64InstrLen = 4;
-static FAST_UNWIND_TLS_INITIAL_EXEC uintptr_t stack_top = 0;
-static FAST_UNWIND_TLS_INITIAL_EXEC pthread_once_t once_control_tls =
-    PTHREAD_ONCE_INIT;
+#include <kwai_util/frame_pointer_unwind.h>
 
-inline __attribute__((__always_inline__)) uintptr_t get_thread_stack_top() {
-  return stack_top;
-}
-
-struct frame_record {
-  uintptr_t next_frame, return_addr;
-};
+#include <atomic>
 
-void fast_unwind_init() {
-  pthread_attr_t attr;
-  pthread_getattr_np(pthread_self(), &attr);
-  stack_top =
-      (uintptr_t)(attr.stack_size + static_cast<char *>(attr.stack_base));
-}
-
-static inline uintptr_t GetAdjustPC(uintptr_t pc) {
-#if defined(__aarch64__) || defined(__arm__)
-  if (pc < kA64InstrLen) {
-    return 0;
-  }
+static std::atomic<size_t> prefix_cache_depth(0);
 
-#if defined(__aarch64__)
-  if (pc > kA64InstrLen) {
-    pc -= kA64InstrLen;
+// Out of line, the first frame is the return address into the caller
+KWAI_EXPORT size_t StackTrace::FastUnwind(uintptr_t *buf, size_t num_entries,
+                                          uint32_t *hash) {
+  auto frame_address = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  size_t depth = prefix_cache_depth.load(std::memory_order_relaxed);
+  if (depth) {
+    return kwai::util::FramePointerUnwindCached<true>(frame_address, buf,
+                                                      num_entries, hash, depth);
   }
-#else
-  if (pc & 1) {
-    pc -= kT32InstrLen;
-  } else {
-    pc -= kA32InstrLen;
-  }
-#endif
-#endif
-  return pc;
+  return kwai::util::FramePointerUnwind<true>(frame_address, buf, num_entries,
+                                              hash);
 }
 
-KWAI_EXPORT size_t StackTrace::FastUnwind(uintptr_t *buf, size_t num_entries) {
-  pthread_once(&once_control_tls, fast_unwind_init);
-  auto begin = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
-  auto end = get_thread_stack_top();
-  stack_t ss;
-  if (sigaltstack(nullptr, &ss) == 0 && (ss.ss_flags & SS_ONSTACK)) {
-    end = reinterpret_cast<uintptr_t>(ss.ss_sp) + ss.ss_size;
-  }
-  size_t num_frames = 0;
-  while (num_frames < kMaxBacktraceSize) {
-    auto *frame = reinterpret_cast<frame_record *>(begin);
-    if (num_frames < num_entries) {
-      buf[num_frames] = GetAdjustPC(frame->return_addr);
-    }
-    ++num_frames;
-    if (frame->next_frame < begin + sizeof(frame_record) ||
-        frame->next_frame >= end || frame->next_frame % sizeof(void *) != 0) {
-      break;
-    }
-    begin = frame->next_frame;
-  }
-  return num_frames;
-}
\ No newline at end of file
+void StackTrace::SetPrefixCache(size_t depth) {
+  prefix_cache_depth.store(depth, std::memory_order_relaxed);
+}
@@ -41,6 +41,8 @@ std::mutex CallStack::dumpJavaLock;
 std::atomic<bool> CallStack::inSymbolize;
 
 unwindstack::UnwinderFromPid *CallStack::unwinder;
+kwai::util::PcCache<unwindstack::FrameData> CallStack::frameCache(
+    koom::Constant::kFrameCacheBytes);
 
 void CallStack::Init() {
   if (koom::Util::AndroidApi() < __ANDROID_API_L__) {
@@ -129,7 +131,13 @@ std::string CallStack::SymbolizePc(uintptr_t pc, int index) {
     unwinder->SetRegs(unwindstack::Regs::CreateFromLocal());
   }
   std::string format;
-  unwindstack::FrameData data = unwinder->BuildFrameFromPcOnly(pc);
+  unwindstack::FrameData data;
+  //相同pc只查找一次map和符号，格式化时只替换序号
+  if (!frameCache.Find(pc, &data)) {
+    data = unwinder->BuildFrameFromPcOnly(pc);
+    frameCache.Put(pc, data,
+                   data.function_name.capacity() + data.map_name.capacity());
+  }
   if (data.map_name.find("libkoom-thread") != std::string::npos) {
     inSymbolize = false;
     return "";
@@ -141,6 +149,10 @@ std::string CallStack::SymbolizePc(uintptr_t pc, int index) {
   return format;
 }
 
+uint64_t CallStack::FrameCacheHits() { return frameCache.Hits(); }
+
+uint64_t CallStack::FrameCacheMisses() { return frameCache.Misses(); }
+
 void CallStack::DisableJava() { disableJava = true; }
 
 void CallStack::DisableNative() { disableNative = true; }
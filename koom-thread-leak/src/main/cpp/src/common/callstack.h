@@ -21,6 +21,7 @@
 #define APM_CALLSTACK_H
 
 #include <fast_unwind/fast_unwind.h>
+#include <kwai_util/pc_cache.h>
 #include <unistd.h>
 #include <unwindstack/Unwinder.h>
 
@@ -44,6 +45,7 @@ class CallStack {
   static dump_java_stack_ptr dump_java_stack;
   static pthread_key_t pthread_key_self;
   static unwindstack::UnwinderFromPid *unwinder;
+  static kwai::util::PcCache<unwindstack::FrameData> frameCache;
   static std::atomic<bool> inSymbolize;
 
   static std::atomic<bool> disableJava;
@@ -64,6 +66,10 @@ class CallStack {
 
   static std::string SymbolizePc(uintptr_t pc, int index);
 
+  static uint64_t FrameCacheHits();
+
+  static uint64_t FrameCacheMisses();
+
   static void *GetCurrentThread();
 };
 
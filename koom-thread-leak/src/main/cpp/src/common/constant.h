@@ -30,6 +30,8 @@ namespace Constant {
 
 const static int kMaxCallStackDepth = 18;
 const static int kDlopenSourceInit = 0;
+// Symbolized frames cached by pc, thread creation stacks repeat a lot
+const static size_t kFrameCacheBytes = 256 * 1024;
 }  // namespace Constant
 }  // namespace koom
 #endif  // APM_RESDETECTOR_CONSTANT_H
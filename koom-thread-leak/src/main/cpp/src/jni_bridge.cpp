@@ -18,6 +18,7 @@
  */
 
 #include <jni.h>
+#include <unwindstack/SymbolIndex.h>
 
 #include "common/callstack.h"
 #include "koom.h"
@@ -71,6 +72,14 @@ Java_com_kwai_performance_overhead_thread_monitor_NativeHandler_setThreadLeakDel
   koom::threadLeakDelay = delay;
 }
 
+JNIEXPORT void JNICALL
+Java_com_kwai_performance_overhead_thread_monitor_NativeHandler_setSymbolIndexCacheDir(
+    JNIEnv *env, jclass obj, jstring dir) {
+  const char *path = env->GetStringUTFChars(dir, nullptr);
+  unwindstack::SymbolIndex::SetCacheDir(path);
+  env->ReleaseStringUTFChars(dir, path);
+}
+
 JNIEXPORT void JNICALL
 Java_com_kwai_performance_overhead_thread_monitor_NativeHandler_enableNativeLog(
     JNIEnv *env, jclass jObject) {
@@ -166,6 +166,8 @@ void ThreadHolder::ReportThreadLeak(long long time) {
   writer.EndArray();
   writer.EndObject();
   koom::Log::info(holder_tag, "ReportThreadLeak %d", needReport);
+  koom::Log::info(holder_tag, "frame cache hit %llu miss %llu",
+                  CallStack::FrameCacheHits(), CallStack::FrameCacheMisses());
   if (needReport) {
     JavaCallback(jsonBuf.GetString());
     // clean up
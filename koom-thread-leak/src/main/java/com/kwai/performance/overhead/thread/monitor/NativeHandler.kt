@@ -44,6 +44,9 @@ object NativeHandler {
   @JvmStatic
   external fun enableNativeLog()
 
+  @JvmStatic
+  external fun setSymbolIndexCacheDir(dir: String)
+
   @JvmStatic
   fun nativeReport(resultJson: String) {
     ThreadMonitor.nativeReport(resultJson)
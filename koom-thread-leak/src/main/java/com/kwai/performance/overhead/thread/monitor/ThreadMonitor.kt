@@ -28,6 +28,7 @@ import com.kwai.koom.base.loop.LoopMonitor
 
 object ThreadMonitor : LoopMonitor<ThreadMonitorConfig>() {
   private const val TAG = "koom-thread-monitor"
+  private const val SYMBOL_INDEX_DIR = "thread-symbol-index"
 
   @Volatile
   private var mIsRunning = false
@@ -90,6 +91,12 @@ object ThreadMonitor : LoopMonitor<ThreadMonitorConfig>() {
     if (monitorConfig.enableNativeLog) {
       NativeHandler.enableNativeLog()
     }
+    if (monitorConfig.enableSymbolIndexCache) {
+      val dir = commonConfig.rootFileInvoker(SYMBOL_INDEX_DIR)
+      if (dir.isDirectory || dir.mkdirs()) {
+        NativeHandler.setSymbolIndexCacheDir(dir.absolutePath)
+      }
+    }
     NativeHandler.setThreadLeakDelay(monitorConfig.threadLeakDelay)
     NativeHandler.start()
     MonitorLog.i(TAG, "init finish")
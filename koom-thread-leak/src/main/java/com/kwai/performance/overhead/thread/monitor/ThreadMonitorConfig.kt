@@ -25,6 +25,7 @@ class ThreadMonitorConfig(val loopInterval: Long,
     val disableNativeStack: Boolean, val disableJavaStack: Boolean,
     val threadLeakDelay: Long,
     val enableNativeLog:Boolean,
+    val enableSymbolIndexCache: Boolean,
     var listener: ThreadLeakListener?) :
     MonitorConfig<ThreadMonitor>() {
 
@@ -37,6 +38,9 @@ class ThreadMonitorConfig(val loopInterval: Long,
     private var disableJavaStack = false
     private var enableNativeLog = false
 
+    // 符号索引按build-id保存到应用私有目录，下次启动直接映射，不再解析.symtab
+    private var enableSymbolIndexCache = false
+
     // 线程泄露检测延迟时间
     private var mThreadLeakDelay = 1 * 60 * 1000L //1min
 
@@ -52,6 +56,10 @@ class ThreadMonitorConfig(val loopInterval: Long,
       enableNativeLog = true
     }
 
+    fun enableSymbolIndexCache() = apply {
+      enableSymbolIndexCache = true
+    }
+
     fun setStartDelay(startDelay: Long) = apply {
       mStartDelay = startDelay
     }
@@ -72,6 +80,7 @@ class ThreadMonitorConfig(val loopInterval: Long,
         disableNativeStack = disableNativeStack,
         threadLeakDelay = mThreadLeakDelay,
         enableNativeLog = enableNativeLog,
+        enableSymbolIndexCache = enableSymbolIndexCache,
         listener = mListener
     )
   }